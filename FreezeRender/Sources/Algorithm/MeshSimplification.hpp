@@ -0,0 +1,369 @@
+#pragma once
+
+#include <Common.hpp>
+#include <Core/Polygon.hpp>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+
+
+/**
+ * @brief The implemention of quadric error metric simplification by half-edge collapse.
+ *        The vertex only moves onto one of its neighbours, so the simplified mesh shares the vertex buffer with the original one.
+ *        The quadrics keep accumulating, every call simplifies the last result and the error is always measured against the original surface.
+ * @see [ Garland & Heckbert, "Surface Simplification Using Quadric Error Metrics" ]
+ * @see [ Zeux, "meshoptimizer: meshopt_simplify" ]
+ */
+class QuadricSimplifier
+{
+	/**
+	 * @brief The symmetric 4 x 4 matrix of plane equations, weighted by triangle area.
+	 */
+	struct Quadric
+	{
+		double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+		double b0 = 0, b1 = 0, b2 = 0, c = 0;
+		double weight = 0;
+
+		force_inline void AddPlane(const double& x, const double& y, const double& z, const double& d, const double& w)
+		{
+			a00 += w * x * x; a11 += w * y * y; a22 += w * z * z;
+			a01 += w * x * y; a02 += w * x * z; a12 += w * y * z;
+			b0 += w * x * d; b1 += w * y * d; b2 += w * z * d;
+			c += w * d * d;
+			weight += w;
+		}
+
+		force_inline void operator += (const Quadric& rhs)
+		{
+			a00 += rhs.a00; a11 += rhs.a11; a22 += rhs.a22;
+			a01 += rhs.a01; a02 += rhs.a02; a12 += rhs.a12;
+			b0 += rhs.b0; b1 += rhs.b1; b2 += rhs.b2;
+			c += rhs.c;
+			weight += rhs.weight;
+		}
+
+		/**
+		 * @brief The weighted sum of squared distances from the point to planes.
+		 */
+		warn_nodiscard force_inline double Evaluate(const Vector3& p) const
+		{
+			const double x = p.x, y = p.y, z = p.z;
+			return
+				a00 * x * x + a11 * y * y + a22 * z * z +
+				2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+				2 * (b0 * x + b1 * y + b2 * z) + c;
+		}
+	};
+
+	/**
+	 * @brief The candidate collapse moving the vertex `from` onto `to`.
+	 */
+	struct Collapse
+	{
+		unsigned int from;
+		unsigned int to;
+		float cost;
+	};
+
+	const Vertex* vertices;
+
+	// The first vertex with the same position, the topology is built on it.
+	std::vector<unsigned int> positionRemap;
+
+	// The vertex on border or uv seam never moves, the silhouette and texture layout keep unchanged.
+	std::vector<bool> locked;
+
+	// Indexed by position.
+	std::vector<Quadric> quadrics;
+
+	// The largest squared distance of accepted collapses.
+	double maxCost = 0;
+
+public:
+	/**
+	 * @brief Build the quadrics from the original triangle list, `indices` is rewritten so that identical vertices share one index.
+	 */
+	inline QuadricSimplifier(const std::vector<Vertex>& inVertices, std::vector<unsigned int>& indices);
+
+	/**
+	 * @brief Collapse edges in the order of error until the triangle number reaches the target or nothing is collapsible.
+	 * @return The distance from the simplified surface to the original one, in the space of vertices.
+	 */
+	inline float Simplify(std::vector<unsigned int>& indices, const size_t& targetTriangleNum);
+
+private:
+	/**
+	 * @brief Determines whether moving `from` onto `to` flips or squeezes any triangle around `from`.
+	 */
+	inline bool IsFlipped(const std::vector<unsigned int>& indices, const unsigned int* triangles, const unsigned int& triangleNum, const unsigned int& from, const unsigned int& to) const;
+};
+
+
+
+#ifndef MESHSIMPLIFICATION_HPP_QUADRICSIMPLIFIER_IMPL
+#define MESHSIMPLIFICATION_HPP_QUADRICSIMPLIFIER_IMPL
+
+	inline QuadricSimplifier::QuadricSimplifier(const std::vector<Vertex>& inVertices, std::vector<unsigned int>& indices)
+		: vertices(inVertices.data())
+	{
+		// Weld the vertices by bits, the identical ones share an index and the ones only sharing position share a quadric.
+		struct Key
+		{
+			float values[8];
+
+			bool operator == (const Key& rhs) const { return std::memcmp(values, rhs.values, sizeof(values)) == 0; }
+		};
+		struct Hash
+		{
+			size_t operator () (const Key& key) const
+			{
+				unsigned int words[8];
+				std::memcpy(words, key.values, sizeof(words));
+				size_t hash = 0;
+				for (const unsigned int& word : words)
+				{
+					hash = (hash ^ word) * 1099511628211ull;
+				}
+				return hash;
+			}
+		};
+
+		const unsigned int vertexNum = static_cast<unsigned int>(inVertices.size());
+		std::unordered_map<Key, unsigned int, Hash> identical, position;
+		std::vector<unsigned int> vertexRemap(vertexNum);
+		std::vector<unsigned int> wedgeNum(vertexNum, 0);
+		positionRemap.resize(vertexNum);
+		for (unsigned int index = 0; index < vertexNum; ++index)
+		{
+			const Vertex& vertex = inVertices[index];
+			const Key full = { {
+				vertex.position.x, vertex.position.y, vertex.position.z,
+				vertex.normal.x, vertex.normal.y, vertex.normal.z,
+				vertex.uv.x, vertex.uv.y } };
+			const Key partial = { { vertex.position.x, vertex.position.y, vertex.position.z } };
+			vertexRemap[index] = identical.try_emplace(full, index).first->second;
+			positionRemap[index] = position.try_emplace(partial, index).first->second;
+			wedgeNum[positionRemap[index]] += vertexRemap[index] == index ? 1 : 0;
+		}
+
+		for (unsigned int& index : indices)
+		{
+			index = vertexRemap[index];
+		}
+
+		// The edge without an opposite one is on border.
+		std::unordered_map<unsigned long long, int> edges;
+		auto EdgeKey = [](const unsigned int& a, const unsigned int& b) -> unsigned long long
+		{
+			return static_cast<unsigned long long>(a) << 32 | b;
+		};
+
+		quadrics.resize(vertexNum);
+		const size_t indexNum = indices.size() / 3 * 3;
+		for (size_t first = 0; first < indexNum; first += 3)
+		{
+			const unsigned int p[3] = { positionRemap[indices[first]], positionRemap[indices[first + 1]], positionRemap[indices[first + 2]] };
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				++edges[EdgeKey(p[corner], p[corner == 2 ? 0 : corner + 1])];
+			}
+
+			const Vector3& a = vertices[p[0]].position;
+			const Vector3& b = vertices[p[1]].position;
+			const Vector3& c = vertices[p[2]].position;
+			const Vector3 cross = (b - a) ^ (c - a);
+			const float area2 = cross.Length();
+			if (area2 > 0.f)
+			{
+				const Vector3 normal = cross / area2;
+				Quadric quadric;
+				quadric.AddPlane(normal.x, normal.y, normal.z, -(normal | a), area2 * 0.5f);
+				quadrics[p[0]] += quadric;
+				quadrics[p[1]] += quadric;
+				quadrics[p[2]] += quadric;
+			}
+		}
+
+		locked.resize(vertexNum);
+		for (unsigned int index = 0; index < vertexNum; ++index)
+		{
+			locked[index] = wedgeNum[index] > 1;
+		}
+		for (const auto& [key, count] : edges)
+		{
+			const unsigned int a = static_cast<unsigned int>(key >> 32);
+			const unsigned int b = static_cast<unsigned int>(key);
+			if (edges.find(EdgeKey(b, a)) == edges.end())
+			{
+				locked[a] = true;
+				locked[b] = true;
+			}
+		}
+	}
+
+	inline float QuadricSimplifier::Simplify(std::vector<unsigned int>& indices, const size_t& targetTriangleNum)
+	{
+		const unsigned int vertexNum = static_cast<unsigned int>(positionRemap.size());
+		std::vector<unsigned int> triangleOffsets(vertexNum + 1);
+		std::vector<unsigned int> adjacency;
+		std::vector<Collapse> collapses;
+		std::vector<unsigned int> remap(vertexNum);
+		std::vector<bool> touched(vertexNum);
+
+		indices.resize(indices.size() / 3 * 3);
+		while (indices.size() / 3 > targetTriangleNum)
+		{
+			// The triangles around every position, compressed in one array.
+			const unsigned int triangleNum = static_cast<unsigned int>(indices.size() / 3);
+			std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+			for (const unsigned int& index : indices)
+			{
+				++triangleOffsets[positionRemap[index] + 1];
+			}
+			for (unsigned int position = 0; position < vertexNum; ++position)
+			{
+				triangleOffsets[position + 1] += triangleOffsets[position];
+			}
+			adjacency.resize(indices.size());
+			{
+				std::vector<unsigned int> cursor(triangleOffsets.begin(), triangleOffsets.end() - 1);
+				for (unsigned int triangle = 0; triangle < triangleNum; ++triangle)
+				{
+					for (int corner = 0; corner < 3; ++corner)
+					{
+						adjacency[cursor[positionRemap[indices[triangle * 3 + corner]]]++] = triangle;
+					}
+				}
+			}
+
+			// Every edge in both directions, the cost is the error of the merged quadric at the remaining vertex.
+			collapses.clear();
+			for (unsigned int first = 0; first < triangleNum * 3; first += 3)
+			{
+				for (int corner = 0; corner < 3; ++corner)
+				{
+					const unsigned int from = indices[first + corner];
+					const unsigned int to = indices[first + (corner == 2 ? 0 : corner + 1)];
+					const unsigned int p0 = positionRemap[from];
+					const unsigned int p1 = positionRemap[to];
+					if (p0 == p1 || locked[p0])
+					{
+						continue;
+					}
+
+					Quadric merged = quadrics[p0];
+					merged += quadrics[p1];
+					const double cost = merged.weight > 0 ? std::max(merged.Evaluate(vertices[to].position), 0.0) / merged.weight : 0.0;
+					collapses.push_back({ from, to, static_cast<float>(cost) });
+				}
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& lhs, const Collapse& rhs) { return lhs.cost < rhs.cost; });
+
+			// Each collapse removes about two triangles, the neighbourhood of a collapsed vertex is frozen until the next pass.
+			std::fill(touched.begin(), touched.end(), false);
+			for (unsigned int index = 0; index < vertexNum; ++index)
+			{
+				remap[index] = index;
+			}
+
+			size_t collapseNum = 0;
+			const size_t collapseTarget = (triangleNum - targetTriangleNum + 1) / 2;
+			for (const Collapse& collapse : collapses)
+			{
+				if (collapseNum >= collapseTarget)
+				{
+					break;
+				}
+
+				const unsigned int p0 = positionRemap[collapse.from];
+				const unsigned int p1 = positionRemap[collapse.to];
+				if (touched[p0] || touched[p1])
+				{
+					continue;
+				}
+
+				const unsigned int* triangles = adjacency.data() + triangleOffsets[p0];
+				const unsigned int neighbourNum = triangleOffsets[p0 + 1] - triangleOffsets[p0];
+				if (IsFlipped(indices, triangles, neighbourNum, p0, collapse.to))
+				{
+					continue;
+				}
+
+				for (unsigned int k = 0; k < neighbourNum; ++k)
+				{
+					const unsigned int* corners = indices.data() + triangles[k] * 3;
+					touched[positionRemap[corners[0]]] = true;
+					touched[positionRemap[corners[1]]] = true;
+					touched[positionRemap[corners[2]]] = true;
+				}
+
+				// The unlocked position has a single vertex.
+				remap[collapse.from] = collapse.to;
+				quadrics[p1] += quadrics[p0];
+				maxCost = std::max(maxCost, static_cast<double>(collapse.cost));
+				++collapseNum;
+			}
+
+			if (collapseNum == 0)
+			{
+				break;
+			}
+
+			// Apply the collapses and remove the degenerate triangles.
+			size_t writeIndex = 0;
+			for (size_t first = 0; first < indices.size(); first += 3)
+			{
+				const unsigned int a = remap[indices[first + 0]];
+				const unsigned int b = remap[indices[first + 1]];
+				const unsigned int c = remap[indices[first + 2]];
+				const unsigned int pa = positionRemap[a], pb = positionRemap[b], pc = positionRemap[c];
+				if (pa != pb && pb != pc && pc != pa)
+				{
+					indices[writeIndex++] = a;
+					indices[writeIndex++] = b;
+					indices[writeIndex++] = c;
+				}
+			}
+			indices.resize(writeIndex);
+		}
+		return static_cast<float>(std::sqrt(maxCost));
+	}
+
+	inline bool QuadricSimplifier::IsFlipped(const std::vector<unsigned int>& indices, const unsigned int* triangles, const unsigned int& triangleNum, const unsigned int& from, const unsigned int& to) const
+	{
+		const unsigned int target = positionRemap[to];
+		const Vector3& destination = vertices[to].position;
+		for (unsigned int k = 0; k < triangleNum; ++k)
+		{
+			const unsigned int* corners = indices.data() + triangles[k] * 3;
+			const unsigned int p[3] = { positionRemap[corners[0]], positionRemap[corners[1]], positionRemap[corners[2]] };
+
+			// The triangle sharing the edge is removed.
+			if (p[0] == target || p[1] == target || p[2] == target)
+			{
+				continue;
+			}
+
+			const Vector3& a = vertices[p[0]].position;
+			const Vector3& b = vertices[p[1]].position;
+			const Vector3& c = vertices[p[2]].position;
+			const Vector3 before = (b - a) ^ (c - a);
+			const Vector3& na = p[0] == from ? destination : a;
+			const Vector3& nb = p[1] == from ? destination : b;
+			const Vector3& nc = p[2] == from ? destination : c;
+			const Vector3 after = (nb - na) ^ (nc - na);
+
+			// Reject the rotation beyond about 78 degrees, it is a flip or a sliver.
+			if ((before | after) <= 0.2f * before.Length() * after.Length())
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+#endif // !MESHSIMPLIFICATION_HPP_QUADRICSIMPLIFIER_IMPL
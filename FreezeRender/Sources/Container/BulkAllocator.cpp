@@ -0,0 +1,223 @@
+#include "BulkAllocator.hpp"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <algorithm>
+#include <vector>
+
+
+
+unsigned long long LargePageAllocator::LargePageSize()
+{
+	static const unsigned long long size = []() -> unsigned long long
+	{
+		// Large page requires `SeLockMemoryPrivilege` enabled in the process token.
+		HANDLE token = nullptr;
+		if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		{
+			return 0;
+		}
+
+		TOKEN_PRIVILEGES privileges = {};
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+		bool bEnabled = ::LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid);
+		bEnabled = bEnabled && ::AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr);
+
+		// `AdjustTokenPrivileges` succeeds even if the privilege is not granted.
+		bEnabled = bEnabled && ::GetLastError() == ERROR_SUCCESS;
+		::CloseHandle(token);
+
+		return bEnabled ? ::GetLargePageMinimum() : 0;
+	}();
+
+	return size;
+}
+
+namespace
+{
+	/**
+	 * @brief The size of large page, the unit of interleaving pages as well.
+	 */
+	unsigned long long LargePageMinimum()
+	{
+		// The minimum is reported even if the privilege of large page is not granted.
+		static const unsigned long long size = ::GetLargePageMinimum() ? ::GetLargePageMinimum() : 2 * 1024 * 1024;
+		return size;
+	}
+
+	/**
+	 * @brief Whether the memory is taken from heap rather than `VirtualAlloc`, the same answer for allocation and release.
+	 */
+	bool IsSmall(const unsigned long long bytes)
+	{
+		return bytes < LargePageMinimum();
+	}
+
+	/**
+	 * @brief The NUMA nodes having both processors and memory, empty if there is only one.
+	 */
+	const std::vector<unsigned short>& InterleavedNodes()
+	{
+		static const std::vector<unsigned short> nodes = []()
+		{
+			std::vector<unsigned short> result;
+			ULONG highest = 0;
+			if (!::GetNumaHighestNodeNumber(&highest))
+			{
+				return result;
+			}
+
+			for (unsigned short node = 0; node <= highest; ++node)
+			{
+				GROUP_AFFINITY affinity = {};
+				ULONGLONG available = 0;
+				if (::GetNumaNodeProcessorMaskEx(node, &affinity) && affinity.Mask != 0 && ::GetNumaAvailableMemoryNodeEx(node, &available) && available != 0)
+				{
+					result.push_back(node);
+				}
+			}
+
+			if (result.size() < 2)
+			{
+				result.clear();
+			}
+			return result;
+		}();
+
+		return nodes;
+	}
+
+	/**
+	 * @brief Release every allocation in [ptr, ptr + bytes), the interleaved large pages are allocated one by one.
+	 */
+	void Release(void* ptr, const unsigned long long bytes)
+	{
+		unsigned char* address = static_cast<unsigned char*>(ptr);
+		unsigned char* const end = address + bytes;
+		while (address < end)
+		{
+			MEMORY_BASIC_INFORMATION info;
+			if (!::VirtualQuery(address, &info, sizeof(info)))
+			{
+				return;
+			}
+
+			// The region never crosses its allocation, the rest of a released allocation is queried as free.
+			address = static_cast<unsigned char*>(info.BaseAddress) + info.RegionSize;
+			if (info.State != MEM_FREE)
+			{
+				::VirtualFree(info.AllocationBase, 0, MEM_RELEASE);
+			}
+		}
+	}
+
+	/**
+	 * @brief Allocate large pages interleaved over `nodes`, returns nullptr if failed.
+	 *        Large pages are committed at allocation, so each one is allocated on its node at the address found for it.
+	 */
+	void* AllocateInterleavedLargePages(const unsigned long long bytes, const unsigned long long largePage, const std::vector<unsigned short>& nodes)
+	{
+		const unsigned long long rounded = (bytes + largePage - 1) / largePage * largePage;
+		const HANDLE process = ::GetCurrentProcess();
+
+		// The range is found by a reservation released at once, retried if another thread takes it meanwhile.
+		for (int attempt = 0; attempt < 4; ++attempt)
+		{
+			void* reserved = ::VirtualAlloc(nullptr, rounded + largePage, MEM_RESERVE, PAGE_NOACCESS);
+			if (!reserved)
+			{
+				return nullptr;
+			}
+			::VirtualFree(reserved, 0, MEM_RELEASE);
+
+			// Large pages are aligned to their size.
+			unsigned char* base = reinterpret_cast<unsigned char*>((reinterpret_cast<unsigned long long>(reserved) + largePage - 1) / largePage * largePage);
+			unsigned long long offset = 0;
+			for (unsigned long long page = 0; offset < rounded; offset += largePage, ++page)
+			{
+				if (!::VirtualAllocExNuma(process, base + offset, largePage, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, nodes[page % nodes.size()]))
+				{
+					break;
+				}
+			}
+			if (offset == rounded)
+			{
+				return base;
+			}
+
+			const bool bTaken = ::GetLastError() == ERROR_INVALID_ADDRESS;
+			Release(base, offset);
+			if (!bTaken)
+			{
+				return nullptr;
+			}
+		}
+		return nullptr;
+	}
+
+	/**
+	 * @brief Allocate normal pages interleaved over `nodes`, returns nullptr if failed.
+	 *        The committed page is placed on its preferred node on first touch, whichever thread touches it.
+	 */
+	void* AllocateInterleavedPages(const unsigned long long bytes, const unsigned long long unit, const std::vector<unsigned short>& nodes)
+	{
+		unsigned char* base = static_cast<unsigned char*>(::VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_READWRITE));
+		if (!base)
+		{
+			return nullptr;
+		}
+
+		const HANDLE process = ::GetCurrentProcess();
+		for (unsigned long long offset = 0, page = 0; offset < bytes; offset += unit, ++page)
+		{
+			if (!::VirtualAllocExNuma(process, base + offset, std::min(unit, bytes - offset), MEM_COMMIT, PAGE_READWRITE, nodes[page % nodes.size()]))
+			{
+				::VirtualFree(base, 0, MEM_RELEASE);
+				return nullptr;
+			}
+		}
+		return base;
+	}
+}
+
+void* LargePageAllocator::Allocate(const unsigned long long bytes)
+{
+	if (IsSmall(bytes))
+	{
+		return AlignedAllocator::Allocate(bytes);
+	}
+
+	const std::vector<unsigned short>& nodes = InterleavedNodes();
+	const unsigned long long largePage = LargePageSize();
+	if (largePage != 0)
+	{
+		const unsigned long long rounded = (bytes + largePage - 1) / largePage * largePage;
+		void* ptr = nodes.empty()
+			? ::VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE)
+			: AllocateInterleavedLargePages(bytes, largePage, nodes);
+		if (ptr)
+		{
+			return ptr;
+		}
+	}
+
+	// Committed pages are not backed by physical memory until they are touched.
+	return nodes.empty()
+		? ::VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE)
+		: AllocateInterleavedPages(bytes, LargePageMinimum(), nodes);
+}
+
+void LargePageAllocator::Deallocate(void* ptr, const unsigned long long bytes)
+{
+	if (IsSmall(bytes))
+	{
+		AlignedAllocator::Deallocate(ptr);
+	}
+	else if (ptr)
+	{
+		Release(ptr, bytes);
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Common.hpp>
+#include <malloc.h>
+
+
+
+/**
+ * @brief The allocation policy of `Bulkdata`, aligned to cache line so that SIMD aligned store is always allowed.
+ */
+struct AlignedAllocator
+{
+	// The alignment of the returned memory.
+	static constexpr const unsigned long long alignment = 64;
+
+	/**
+	 * @brief Allocate uninitialized memory, returns nullptr if it failed.
+	 */
+	allocator_as force_inline static void* Allocate(const unsigned long long bytes)
+	{
+		return ::_aligned_malloc(bytes, alignment);
+	}
+
+	/**
+	 * @brief Release memory returned by `Allocate()`.
+	 */
+	force_inline static void Deallocate(void* ptr)
+	{
+		::_aligned_free(ptr);
+	}
+};
+
+
+
+/**
+ * @brief The allocation policy of `Bulkdata` for huge buffer, e.g. render targets and textures.
+ *        The memory smaller than one large page is taken from `AlignedAllocator`, since `VirtualAlloc` reserves 64KB at least.
+ *        The bigger one uses 2MB large pages when `SeLockMemoryPrivilege` is granted, otherwise falls back to normal pages.
+ *        On NUMA system, the pages are interleaved over the nodes running workers one large page at a time, since every
+ *        worker reads and writes the whole target. Otherwise the large pages are placed at allocation and the normal
+ *        pages on first touch, by the node of the thread doing it.
+ */
+struct LargePageAllocator
+{
+	// The alignment of the returned memory, the one of small memory.
+	static constexpr const unsigned long long alignment = AlignedAllocator::alignment;
+
+	/**
+	 * @brief Allocate uninitialized memory, returns nullptr if it failed.
+	 */
+	allocator_as static void* Allocate(const unsigned long long bytes);
+
+	/**
+	 * @brief Release memory returned by `Allocate()`, `bytes` is the size passed to it which decides the way of release.
+	 */
+	static void Deallocate(void* ptr, const unsigned long long bytes);
+
+	/**
+	 * @brief Returns the size of large page, or 0 if large page is unavailable.
+	 */
+	static unsigned long long LargePageSize();
+};
@@ -1,18 +1,37 @@
 #pragma once
 
 #include <Common.hpp>
+#include <Container/BulkAllocator.hpp>
+#include <immintrin.h>
 #include <type_traits>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <ppl.h>
 
 
 
 /**
  * @brief The unique pointer class of bulk data. 
  */
-template<typename Type>
+template<typename Type, typename Allocator = AlignedAllocator>
 class Bulkdata
 {
 	// Check type during compilation.
 	static_assert(std::is_same_v<Type, std::decay_t<Type>>, "[FreezeRender] only support decay type!");
+	static_assert(Allocator::alignment % 32 == 0 && Allocator::alignment % alignof(Type) == 0, "[FreezeRender] unsupported alignment!");
+
+	// The number of bytes touched by one worker, a multiple of both alignment and page size.
+	static constexpr const unsigned long long blockSize = 64 * 1024;
+
+	// The number of elements touched by one worker.
+	static constexpr const unsigned long long blockCount = blockSize / sizeof(Type) > 0 ? blockSize / sizeof(Type) : 1;
+
+	// The minimum number of bytes to spread over workers.
+	static constexpr const unsigned long long parallelSize = 4 * blockSize;
+
+	// Whether `Initialize()` is able to fill the memory by repeating a 32-bytes pattern.
+	static constexpr const bool bStreamable = (32 % sizeof(Type) == 0) && std::is_trivially_destructible_v<Type>;
 
 	// The data pointer.
 	Type* ptr;
@@ -41,11 +60,14 @@ public:
 
 	/**
 	 * @brief Release old memory, reallocate new one manually.
+	 *        The memory is constructed by worker threads, so the page faults of normal pages are spread over them.
+	 *        The NUMA placement of pages is decided by `Allocator`.
 	 */
 	inline void Reallocate(const unsigned long long count);
 
 	/**
 	 * @brief Initalize the memory by calling constructor of `Type`.
+	 *        Huge memory is filled by worker threads with non-temporal store.
 	 */
 	template<typename ...Args>
 	inline void Initialize(Args&& ...args);
@@ -58,7 +80,14 @@ public:
 	/**
 	 * @brief Swap memory pointer and count.
 	 */
-	force_inline void Swap(Bulkdata<Type>& rhs) noexcept;
+	force_inline void Swap(Bulkdata<Type, Allocator>& rhs) noexcept;
+
+private:
+	/**
+	 * @brief Invoke `function(first, last)` with element ranges of `blockSize` bytes, in parallel if the memory is huge.
+	 */
+	template<typename Function>
+	force_inline void ForEachBlock(Function&& function);
 };
 
 
@@ -69,52 +98,117 @@ public:
 #ifndef BULKDATA_HPP_BULKDATA_IMPL
 #define BULKDATA_HPP_BULKDATA_IMPL
 
-	template<typename Type>
-	inline void Bulkdata<Type>::Reallocate(const unsigned long long count)
+	template<typename Type, typename Allocator>
+	inline void Bulkdata<Type, Allocator>::Reallocate(const unsigned long long count)
 	{
 		Deallocate();
-		this->ptr = new Type[count];
+		if (count == 0)
+		{
+			return;
+		}
+
+		this->ptr = static_cast<Type*>(Allocator::Allocate(count * sizeof(Type)));
+		if (!this->ptr)
+		{
+			throw std::bad_alloc();
+		}
 		this->count = count;
+
+		// Trivial type leaves pages untouched until `Initialize()`.
+		if constexpr (!std::is_trivially_default_constructible_v<Type>)
+		{
+			ForEachBlock([this](const unsigned long long first, const unsigned long long last)
+			{
+				std::uninitialized_default_construct(ptr + first, ptr + last);
+			});
+		}
 	}
 
-	template<typename Type>
-	template<typename ...Args> inline void Bulkdata<Type>::Initialize(Args&& ...args)
+	template<typename Type, typename Allocator>
+	template<typename ...Args> inline void Bulkdata<Type, Allocator>::Initialize(Args&& ...args)
 	{
-		Type temp = { std::forward<Args>(args)... };
-		unsigned long long ext = count % 8;
-		unsigned long long batch = count / 8;
-		Type* begin = ptr;
-		while (ext --> 0)
+		const Type temp = { std::forward<Args>(args)... };
+
+		if constexpr (bStreamable)
 		{
-			*(begin++) = temp;
+			// Repeat the value to a 32-bytes pattern.
+			alignas(32) unsigned char pattern[32];
+			for (unsigned long long offset = 0; offset < 32; offset += sizeof(Type))
+			{
+				std::memcpy(pattern + offset, &temp, sizeof(Type));
+			}
+
+			ForEachBlock([this, &pattern, &temp](const unsigned long long first, const unsigned long long last)
+			{
+				// The beginning of each block is aligned to 32 bytes.
+				const __m256i value = _mm256_load_si256((const __m256i*)pattern);
+				__m256i* begin = (__m256i*)(ptr + first);
+				__m256i* end = begin + (last - first) * sizeof(Type) / 32;
+				while (begin != end)
+				{
+					_mm256_stream_si256(begin++, value);
+				}
+
+				Type* tail = (Type*)end;
+				while (tail != ptr + last)
+				{
+					*(tail++) = temp;
+				}
+
+				// Make non-temporal stores visible before the worker quits.
+				_mm_sfence();
+			});
 		}
-
-		while (batch --> 0)
+		else
 		{
-			*(begin++) = temp;
-			*(begin++) = temp;
-			*(begin++) = temp;
-			*(begin++) = temp;
-			*(begin++) = temp;
-			*(begin++) = temp;
-			*(begin++) = temp;
-			*(begin++) = temp;
+			ForEachBlock([this, &temp](const unsigned long long first, const unsigned long long last)
+			{
+				unsigned long long ext = (last - first) % 8;
+				unsigned long long batch = (last - first) / 8;
+				Type* begin = ptr + first;
+				while (ext --> 0)
+				{
+					*(begin++) = temp;
+				}
+
+				while (batch --> 0)
+				{
+					*(begin++) = temp;
+					*(begin++) = temp;
+					*(begin++) = temp;
+					*(begin++) = temp;
+					*(begin++) = temp;
+					*(begin++) = temp;
+					*(begin++) = temp;
+					*(begin++) = temp;
+				}
+			});
 		}
 	}
 
-	template<typename Type>
-	inline void Bulkdata<Type>::Deallocate()
+	template<typename Type, typename Allocator>
+	inline void Bulkdata<Type, Allocator>::Deallocate()
 	{
 		if (ptr)
 		{
-			delete[] ptr;
+			std::destroy_n(ptr, count);
+
+			// The allocator choosing the way by size takes the size back.
+			if constexpr (requires { Allocator::Deallocate(ptr, count * sizeof(Type)); })
+			{
+				Allocator::Deallocate(ptr, count * sizeof(Type));
+			}
+			else
+			{
+				Allocator::Deallocate(ptr);
+			}
 			ptr = nullptr;
 		}
 		count = 0;
 	}
 
-	template<typename Type>
-	force_inline void Bulkdata<Type>::Swap(Bulkdata<Type>& rhs) noexcept
+	template<typename Type, typename Allocator>
+	force_inline void Bulkdata<Type, Allocator>::Swap(Bulkdata<Type, Allocator>& rhs) noexcept
 	{
 		Type* tempPtr = rhs.ptr;
 		unsigned long long tempCount = rhs.count;
@@ -124,4 +218,22 @@ public:
 		this->count = tempCount;
 	}
 
+	template<typename Type, typename Allocator>
+	template<typename Function> force_inline void Bulkdata<Type, Allocator>::ForEachBlock(Function&& function)
+	{
+		if (count * sizeof(Type) < parallelSize)
+		{
+			function(0ull, count);
+			return;
+		}
+
+		const unsigned long long blockNum = (count + blockCount - 1) / blockCount;
+		Concurrency::parallel_for(0ull, blockNum, [this, &function](const unsigned long long block)
+		{
+			const unsigned long long first = block * blockCount;
+			const unsigned long long last = first + blockCount < count ? first + blockCount : count;
+			function(first, last);
+		});
+	}
+
 #endif // !BULKDATA_HPP_BULKDATA_IMPL
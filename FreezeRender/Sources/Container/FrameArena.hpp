@@ -0,0 +1,166 @@
+#pragma once
+
+#include <Common.hpp>
+#include <Container/BulkAllocator.hpp>
+#include <type_traits>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <vector>
+#include <new>
+#include <ppl.h>
+
+
+
+/**
+ * @brief The linear allocator of transient data living in one frame.
+ *        Every thread bumps its own chunks without lock, `Reset()` rewinds all chunks so that they are reused in the next frame.
+ */
+class FrameArena
+{
+	// The minimum bytes of one chunk.
+	static constexpr const unsigned long long chunkSize = 1024 * 1024;
+
+	struct Chunk
+	{
+		unsigned char* ptr;
+		unsigned long long size;
+	};
+
+	// The chunks owned by one thread.
+	struct ThreadArena
+	{
+		std::vector<Chunk> chunks;
+
+		// The index of chunk in use.
+		unsigned long long current = 0;
+
+		// The used bytes of chunk in use.
+		unsigned long long offset = 0;
+	};
+
+	// The thread local arenas.
+	Concurrency::combinable<ThreadArena> arenas;
+
+	// The number of chunks requested from system, never decrease.
+	std::atomic<unsigned long long> systemAllocations = 0;
+
+	// The total bytes of chunks.
+	std::atomic<unsigned long long> reservedBytes = 0;
+
+public:
+	/// Non-copyable.
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+	/// Non-copyable.
+
+	/// Inline function.
+	FrameArena() = default;
+	~FrameArena() { Release(); }
+	unsigned long long SystemAllocations() const { return systemAllocations.load(std::memory_order_relaxed); }
+	unsigned long long ReservedBytes() const { return reservedBytes.load(std::memory_order_relaxed); }
+	/// Inline function.
+
+	/**
+	 * @brief Allocate memory from the chunks of current thread, it is valid until `Reset()`.
+	 */
+	allocator_as inline void* Allocate(const unsigned long long bytes, const unsigned long long alignment);
+
+	/**
+	 * @brief Allocate `count` default constructed objects, the destructor is never called.
+	 */
+	template<typename Type>
+	force_inline Type* Allocate(const unsigned long long count);
+
+	/**
+	 * @brief Rewind all chunks without releasing them, must not be called with `Allocate()` at the same time.
+	 */
+	inline void Reset();
+
+	/**
+	 * @brief Release all chunks to system.
+	 */
+	inline void Release();
+};
+
+
+
+/**
+ * @brief The Detail implemention of `FrameArena` class.
+ */
+#ifndef FRAMEARENA_HPP_FRAMEARENA_IMPL
+#define FRAMEARENA_HPP_FRAMEARENA_IMPL
+
+	inline void* FrameArena::Allocate(const unsigned long long bytes, const unsigned long long alignment)
+	{
+		assert((alignment & (alignment - 1)) == 0 && alignment <= AlignedAllocator::alignment);
+
+		ThreadArena& arena = arenas.local();
+		while (arena.current < arena.chunks.size())
+		{
+			const Chunk& chunk = arena.chunks[arena.current];
+			const unsigned long long offset = (arena.offset + alignment - 1) & ~(alignment - 1);
+			if (offset + bytes <= chunk.size)
+			{
+				arena.offset = offset + bytes;
+				return chunk.ptr + offset;
+			}
+
+			++arena.current;
+			arena.offset = 0;
+		}
+
+		// Out of chunks, request a new one which becomes the chunk in use.
+		// Huge chunk is rounded up to power of two, so that a growing request settles down quickly.
+		const unsigned long long size = bytes > chunkSize ? std::bit_ceil(bytes) : chunkSize;
+		unsigned char* ptr = static_cast<unsigned char*>(AlignedAllocator::Allocate(size));
+		if (!ptr)
+		{
+			throw std::bad_alloc();
+		}
+
+		arena.chunks.push_back({ ptr, size });
+		arena.offset = bytes;
+		systemAllocations.fetch_add(1, std::memory_order_relaxed);
+		reservedBytes.fetch_add(size, std::memory_order_relaxed);
+		return ptr;
+	}
+
+	template<typename Type>
+	force_inline Type* FrameArena::Allocate(const unsigned long long count)
+	{
+		static_assert(std::is_trivially_destructible_v<Type>, "[FreezeRender] only support trivially destructible type!");
+
+		Type* ptr = static_cast<Type*>(Allocate(count * sizeof(Type), alignof(Type)));
+		if constexpr (!std::is_trivially_default_constructible_v<Type>)
+		{
+			std::uninitialized_default_construct_n(ptr, count);
+		}
+		return ptr;
+	}
+
+	inline void FrameArena::Reset()
+	{
+		arenas.combine_each([](ThreadArena& arena)
+		{
+			arena.current = 0;
+			arena.offset = 0;
+		});
+	}
+
+	inline void FrameArena::Release()
+	{
+		arenas.combine_each([](ThreadArena& arena)
+		{
+			for (const Chunk& chunk : arena.chunks)
+			{
+				AlignedAllocator::Deallocate(chunk.ptr);
+			}
+			arena.chunks.clear();
+			arena.current = 0;
+			arena.offset = 0;
+		});
+		reservedBytes.store(0, std::memory_order_relaxed);
+	}
+
+#endif // !FRAMEARENA_HPP_FRAMEARENA_IMPL
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <Common.hpp>
+#include <Utility/Number.hpp>
+#include <algorithm>
+#include <cmath>
+#include "Matrix.hpp"
+
+
+
+/**
+ * @brief The axis-aligned bounding box and the bounding sphere sharing the same center.
+ */
+struct BoundingVolume
+{
+	Vector3 minimum = Number::FLOAT_INF;
+
+	Vector3 maximum = Number::FLOAT_NEG_INF;
+
+	Vector3 center;
+
+	float radius = 0.f;
+
+
+	warn_nodiscard bool IsValid() const { return minimum.x <= maximum.x; }
+
+	/**
+	 * @brief Expand the box to contain the point, call `UpdateCenter()` after all points are added.
+	 */
+	force_inline void ExpandBox(const Vector3& point);
+
+	/**
+	 * @brief Use the box center as sphere center.
+	 */
+	force_inline void UpdateCenter();
+
+	/**
+	 * @brief Expand the sphere to contain the point.
+	 */
+	force_inline void ExpandSphere(const Vector3& point);
+};
+
+
+
+/**
+ * @brief The six clipping planes of canonical view volume, in the space of the matrix they are extracted from.
+ */
+struct Frustum
+{
+	enum class Containment : unsigned char
+	{
+		Outside,
+		Intersecting,
+		Inside,
+	};
+
+	// The normalized plane equation, `dot(plane.xyz, point) + plane.w >= 0` means inside.
+	Vector4 planes[6];
+
+
+	/**
+	 * @brief Extract planes from the clip matrix, e.g. the MVP matrix gives the planes in local space.
+	 */
+	force_inline static Frustum FromMatrix(const Matrix& clip);
+
+	/**
+	 * @brief Test the sphere first and then the box, the box is only tested against the planes intersecting the sphere.
+	 */
+	warn_nodiscard force_inline Containment Test(const BoundingVolume& volume) const;
+};
+
+
+
+#ifndef BOUNDINGVOLUME_HPP_BOUNDINGVOLUME_IMPL
+#define BOUNDINGVOLUME_HPP_BOUNDINGVOLUME_IMPL
+
+	force_inline void BoundingVolume::ExpandBox(const Vector3& point)
+	{
+		minimum = { std::min(minimum.x, point.x), std::min(minimum.y, point.y), std::min(minimum.z, point.z) };
+		maximum = { std::max(maximum.x, point.x), std::max(maximum.y, point.y), std::max(maximum.z, point.z) };
+	}
+
+	force_inline void BoundingVolume::UpdateCenter()
+	{
+		center = (minimum + maximum) * 0.5f;
+		radius = 0.f;
+	}
+
+	force_inline void BoundingVolume::ExpandSphere(const Vector3& point)
+	{
+		radius = std::max(radius, (point - center).Length());
+	}
+
+#endif // !BOUNDINGVOLUME_HPP_BOUNDINGVOLUME_IMPL
+
+
+
+#ifndef BOUNDINGVOLUME_HPP_FRUSTUM_IMPL
+#define BOUNDINGVOLUME_HPP_FRUSTUM_IMPL
+
+	force_inline Frustum Frustum::FromMatrix(const Matrix& clip)
+	{
+		// Look at -z, the canonical view volume is |x| <= -w, |y| <= -w, |z| <= -w.
+		const Vector4 rowW = { -clip.m[3][0], -clip.m[3][1], -clip.m[3][2], -clip.m[3][3] };
+
+		Frustum frustum;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const Vector4 row = { clip.m[axis][0], clip.m[axis][1], clip.m[axis][2], clip.m[axis][3] };
+			frustum.planes[axis * 2 + 0] = rowW - row;
+			frustum.planes[axis * 2 + 1] = rowW + row;
+		}
+
+		for (Vector4& plane : frustum.planes)
+		{
+			const float length = plane.XYZ().Length();
+			plane = length > Number::SMALL_NUMBER ? plane / length : plane;
+		}
+		return frustum;
+	}
+
+	force_inline Frustum::Containment Frustum::Test(const BoundingVolume& volume) const
+	{
+		const Vector3 extent = (volume.maximum - volume.minimum) * 0.5f;
+
+		bool bInside = true;
+		for (const Vector4& plane : planes)
+		{
+			const float distance = plane.x * volume.center.x + plane.y * volume.center.y + plane.z * volume.center.z + plane.w;
+			if (distance < -volume.radius)
+			{
+				return Containment::Outside;
+			}
+
+			if (distance >= volume.radius)
+			{
+				continue;
+			}
+
+			// The projected radius of box on the plane normal.
+			const float projected = std::fabs(plane.x) * extent.x + std::fabs(plane.y) * extent.y + std::fabs(plane.z) * extent.z;
+			if (distance < -projected)
+			{
+				return Containment::Outside;
+			}
+
+			bInside &= distance >= projected;
+		}
+		return bInside ? Containment::Inside : Containment::Intersecting;
+	}
+
+#endif // !BOUNDINGVOLUME_HPP_FRUSTUM_IMPL
@@ -0,0 +1,114 @@
+#include "Cubemap.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+
+void Cubemap::Resize(const int& inSize, const int& levelNum)
+{
+	size = std::max(inSize, 1);
+
+	int fullLevelNum = 1;
+	while ((size >> fullLevelNum) > 0)
+	{
+		++fullLevelNum;
+	}
+
+	levels.resize(levelNum > 0 ? std::min(levelNum, fullLevelNum) : fullLevelNum);
+	for (int level = 0; level < LevelNum(); ++level)
+	{
+		const size_t stride = LevelSize(level) + 2;
+		levels[level].assign(FACE_NUM * stride * stride, Vector4(0.f));
+	}
+}
+
+void Cubemap::GenerateMips()
+{
+	UpdateBorders(0);
+	for (int level = 1; level < LevelNum(); ++level)
+	{
+		const int levelSize = LevelSize(level);
+		const int sourceSize = LevelSize(level - 1);
+		Concurrency::parallel_for(0, FACE_NUM * levelSize, [this, &level, &levelSize, &sourceSize](const int& row)
+		{
+			const int face = row / levelSize;
+			const int y = row - face * levelSize;
+			const int y0 = std::min(y * 2, sourceSize - 1);
+			const int y1 = std::min(y * 2 + 1, sourceSize - 1);
+			for (int x = 0; x < levelSize; ++x)
+			{
+				const int x0 = std::min(x * 2, sourceSize - 1);
+				const int x1 = std::min(x * 2 + 1, sourceSize - 1);
+				Texel(level, face, x, y) = (Texel(level - 1, face, x0, y0) + Texel(level - 1, face, x1, y0)
+					+ Texel(level - 1, face, x0, y1) + Texel(level - 1, face, x1, y1)) * 0.25f;
+			}
+		});
+		UpdateBorders(level);
+	}
+}
+
+void Cubemap::UpdateBorders(const int& level)
+{
+	const int levelSize = LevelSize(level);
+	const auto CopyAdjacent = [this, &level, &levelSize](const int& face, const int& x, const int& y)
+	{
+		// The direction through the border texel center pierces the adjacent face.
+		float s, t;
+		const Vector3 direction = Direction(face, (x + 0.5f) * 2.f / levelSize - 1.f, (y + 0.5f) * 2.f / levelSize - 1.f);
+		const int adjacent = Project(direction, s, t);
+		const int adjacentX = std::clamp(static_cast<int>((s + 1.f) * 0.5f * levelSize), 0, levelSize - 1);
+		const int adjacentY = std::clamp(static_cast<int>((t + 1.f) * 0.5f * levelSize), 0, levelSize - 1);
+		Texel(level, face, x, y) = Texel(level, adjacent, adjacentX, adjacentY);
+	};
+
+	for (int face = 0; face < FACE_NUM; ++face)
+	{
+		for (int i = -1; i <= levelSize; ++i)
+		{
+			CopyAdjacent(face, i, -1);
+			CopyAdjacent(face, i, levelSize);
+			CopyAdjacent(face, -1, i);
+			CopyAdjacent(face, levelSize, i);
+		}
+	}
+}
+
+Vector3 Cubemap::Direction(const int& face, const float& s, const float& t)
+{
+	Vector3 direction;
+	switch (face)
+	{
+	case 0:  direction = {  1.f,   -t,   -s }; break;
+	case 1:  direction = { -1.f,   -t,    s }; break;
+	case 2:  direction = {    s,  1.f,    t }; break;
+	case 3:  direction = {    s, -1.f,   -t }; break;
+	case 4:  direction = {    s,   -t,  1.f }; break;
+	default: direction = {   -s,   -t, -1.f }; break;
+	}
+	return direction.Normalize();
+}
+
+int Cubemap::Project(const Vector3& direction, float& s, float& t)
+{
+	const float absX = std::fabs(direction.x);
+	const float absY = std::fabs(direction.y);
+	const float absZ = std::fabs(direction.z);
+	if (absX >= absY && absX >= absZ)
+	{
+		const float invMajor = 1.f / std::max(absX, 1e-20f);
+		s = (direction.x > 0.f ? -direction.z : direction.z) * invMajor;
+		t = -direction.y * invMajor;
+		return direction.x > 0.f ? 0 : 1;
+	}
+	if (absY >= absZ)
+	{
+		const float invMajor = 1.f / absY;
+		s = direction.x * invMajor;
+		t = (direction.y > 0.f ? direction.z : -direction.z) * invMajor;
+		return direction.y > 0.f ? 2 : 3;
+	}
+	const float invMajor = 1.f / absZ;
+	s = (direction.z > 0.f ? direction.x : -direction.x) * invMajor;
+	t = -direction.y * invMajor;
+	return direction.z > 0.f ? 4 : 5;
+}
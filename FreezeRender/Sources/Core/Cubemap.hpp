@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Common.hpp>
+#include "Matrix.hpp"
+#include <vector>
+#include <algorithm>
+#include <ppl.h>
+
+
+
+/**
+ * @brief Cube texture of linear radiance, 6 square faces per mip level in the order +X, -X, +Y, -Y, +Z, -Z.
+ *        The face coordinates follow Direct3D convention, the rows of face are stored from top to bottom.
+ *        Every face is surrounded by a border of 1 texel copied from the adjacent faces, so the bilinear
+ *        footprint never leaves the face and the sampling is seamless without any branch.
+ */
+struct Cubemap
+{
+	// The number of faces of a cube.
+	static constexpr const int FACE_NUM = 6;
+
+	// The texels of every mip level, [ r, g, b, unused ], `FACE_NUM * (size + 2) * (size + 2)` texels per level with borders.
+	std::vector<std::vector<Vector4>> levels;
+
+	// The size of faces of the first level.
+	int size = 0;
+
+
+	/**
+	 * @brief Reallocate the texels of `levelNum` mip levels, zero is the full chain down to 1 x 1.
+	 */
+	void Resize(const int& inSize, const int& levelNum = 1);
+
+	int LevelNum() const { return static_cast<int>(levels.size()); }
+
+	int LevelSize(const int& level) const { return std::max(size >> level, 1); }
+
+	/**
+	 * @brief The texel of face, `x` and `y` are in [-1, size], the outer ones are the border.
+	 */
+	Vector4& Texel(const int& level, const int& face, const int& x, const int& y)
+	{
+		const int stride = LevelSize(level) + 2;
+		return levels[level][(face * stride + y + 1) * stride + x + 1];
+	}
+
+	const Vector4& Texel(const int& level, const int& face, const int& x, const int& y) const
+	{
+		const int stride = LevelSize(level) + 2;
+		return levels[level][(face * stride + y + 1) * stride + x + 1];
+	}
+
+	/**
+	 * @brief Fill the first level with the radiance along the direction through every texel center, the faces in parallel,
+	 *        then the other levels are filtered from it.
+	 */
+	template<typename Radiance>
+	void Fill(const Radiance& radiance);
+
+	/**
+	 * @brief Filter every level from the previous one by 2 x 2 box filter, the rows in parallel.
+	 *        The borders of every level are updated.
+	 */
+	void GenerateMips();
+
+	/**
+	 * @brief Copy the border of every face of the level from the closest texels of the adjacent faces.
+	 */
+	void UpdateBorders(const int& level);
+
+	/**
+	 * @brief The unit direction through the face coordinates, `s` is to the right and `t` is downward, both in [-1, 1].
+	 */
+	warn_nodiscard static Vector3 Direction(const int& face, const float& s, const float& t);
+
+	/**
+	 * @brief The face pierced by the direction, and the face coordinates of it.
+	 */
+	static int Project(const Vector3& direction, float& s, float& t);
+};
+
+
+
+#ifndef CUBEMAP_HPP_CUBEMAP_IMPL
+#define CUBEMAP_HPP_CUBEMAP_IMPL
+
+	template<typename Radiance>
+	void Cubemap::Fill(const Radiance& radiance)
+	{
+		Concurrency::parallel_for(0, FACE_NUM * size, [this, &radiance](const int& row)
+		{
+			const int face = row / size;
+			const int y = row - face * size;
+			const float t = (y + 0.5f) * 2.f / size - 1.f;
+			for (int x = 0; x < size; ++x)
+			{
+				const float s = (x + 0.5f) * 2.f / size - 1.f;
+				Texel(0, face, x, y) = Vector4(radiance(Direction(face, s, t)), 0.f);
+			}
+		});
+		GenerateMips();
+	}
+
+#endif // !CUBEMAP_HPP_CUBEMAP_IMPL
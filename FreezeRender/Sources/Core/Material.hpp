@@ -7,19 +7,40 @@
 
 
 
+/**
+ * @brief The parameters of metallic-roughness model, the base color is sampled from the diffuse texture.
+ */
+struct MaterialParameters
+{
+	// 0 is a dielectric reflecting 4% at normal incidence, 1 is a metal reflecting its base color.
+	float metallic = 0.f;
+
+	// The perceptual roughness, its square is the alpha of GGX distribution.
+	float roughness = 0.5f;
+};
+
+
+
 class Material
 {
 	using TextureReference = std::unique_ptr<Texture>;
-	
-	WideString id { L"Native" };
 
-	WideString name { L"Native" };
+	// The members read per pixel by the geometry pass are packed at the front, one cache line per lookup.
+	MaterialParameters parameters;
 
 	TextureReference diffuse { nullptr };
 
 	TextureReference normal { nullptr };
 
+	WideString id { L"Native" };
+
+	WideString name { L"Native" };
+
 public:		
+	inline const MaterialParameters& Parameters() const { return parameters; }
+
+	inline MaterialParameters& Parameters() { return parameters; }
+
 	inline Texture* Diffuse() const { return diffuse.get(); }
 	
 	inline Texture* ReallocateDiffuse()
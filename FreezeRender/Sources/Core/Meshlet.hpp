@@ -4,8 +4,90 @@
 #include <Container/String.hpp>
 #include <vector>
 #include <memory>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include "Material.hpp"
 #include "Polygon.hpp"
+#include "BoundingVolume.hpp"
+#include <Algorithm/MeshSimplification.hpp>
+
+
+
+/**
+ * @brief The continuous triangles in index buffer, culled as a whole.
+ */
+struct MeshletCluster
+{
+	// The first index in index buffer.
+	unsigned int firstIndex = 0;
+
+	// The number of indices, a multiple of 3.
+	unsigned int indexNum = 0;
+
+	// The bounding volume in local space.
+	BoundingVolume bounds;
+
+	// The average direction of face normals in local space.
+	Vector3 coneAxis;
+
+	// The sine of the widest angle between face normal and `coneAxis`, 1 means the cone is too wide to cull.
+	float coneCutoff = 1.f;
+
+	// The point behind all triangle planes along `coneAxis`, in local space.
+	Vector3 coneApex;
+
+	// Visible in last frame, rendered before the occlusion test by temporal occlusion culling.
+	bool bVisible = true;
+
+
+	/**
+	 * @brief Determines whether all triangles are back facing, `eye` is the camera position in local space.
+	 *        The view direction to the apex must be within (90 - cone angle) degrees of the cone axis.
+	 */
+	warn_nodiscard force_inline bool IsBackFacing(const Vector3& eye) const
+	{
+		const Vector3 direction = coneApex - eye;
+		return coneCutoff < 1.f && (direction | coneAxis) >= coneCutoff * direction.Length();
+	}
+};
+
+
+
+/**
+ * @brief The level of detail, a range of index buffer and its clusters.
+ */
+struct MeshletLod
+{
+	// The first index in index buffer.
+	unsigned int firstIndex = 0;
+
+	// The number of indices, a multiple of 3.
+	unsigned int indexNum = 0;
+
+	// The first cluster in cluster buffer.
+	unsigned int firstCluster = 0;
+
+	// The number of clusters.
+	unsigned int clusterNum = 0;
+
+	// The distance from the simplified surface to the full detail one in local space, zero for the full detail level.
+	float error = 0.f;
+};
+
+
+
+/**
+ * @brief One copy of a mesh, sharing the geometry and materials with the others.
+ */
+struct MeshletInstance
+{
+	// Applied after the transform of mesh.
+	Matrix transform = Matrix::Identity;
+
+	// Non-zero if the cluster was visible in last frame, the instance keeps its own visible set for temporal occlusion culling.
+	std::vector<unsigned char> visibleClusters;
+};
 
 
 
@@ -15,6 +97,15 @@
 class Meshlet
 {
 public:
+	// The maximum number of triangles in one cluster.
+	static constexpr const unsigned int CLUSTER_TRIANGLE_NUM = 64;
+
+	// The maximum number of levels, including the full detail one.
+	static constexpr const unsigned int LOD_NUM = 8;
+
+	// The level is not simplified further once it has fewer triangles.
+	static constexpr const unsigned int LOD_MIN_TRIANGLE_NUM = CLUSTER_TRIANGLE_NUM;
+
 	WideString id;
 	
 	WideString name;
@@ -23,12 +114,344 @@ public:
 
 	std::vector<Vertex> vertices;
 
+	// The indices of every level in order, the full detail level comes first.
 	std::vector<VertexIndex> indices;
 
 	std::vector<Material> materials;
 
+	// Rasterized into the low resolution occlusion buffer to cull the hidden geometry, a large and closed mesh is preferred.
+	bool bOccluder = false;
+
+	// The bounding volume in local space, built by `BuildClusters()`.
+	BoundingVolume bounds;
+
+	// The triangle clusters of every level in order, built by `BuildClusters()` and `BuildLods()`.
+	std::vector<MeshletCluster> clusters;
+
+	// The levels from full detail to the coarsest, built by `BuildClusters()` and `BuildLods()`.
+	std::vector<MeshletLod> lods;
+
+	// The copies drawn with their own transform, the mesh is drawn once by `transform` if it is empty.
+	std::vector<MeshletInstance> instances;
+
 	warn_nodiscard bool IsValid() const
 	{
 		return !vertices.empty() && !indices.empty();
 	}
+
+	/**
+	 * @brief Mark the vertices or indices changed, the data derived from them, e.g. the hierarchies of ray queries, is rebuilt.
+	 *        Called by `BuildClusters()`, `BuildLods()` and the loaders, call it after editing the geometry in place.
+	 */
+	void MarkGeometryChanged()
+	{
+		// Unique across meshes, so a mesh replaced by another one never looks unchanged.
+		static std::atomic<unsigned long long> version = 0;
+		geometryVersion = version.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+
+	/**
+	 * @brief The version of the geometry, changed by `MarkGeometryChanged()`.
+	 */
+	warn_nodiscard unsigned long long GetGeometryVersion() const
+	{
+		return geometryVersion;
+	}
+
+	/**
+	 * @brief The number of copies to draw, at least one.
+	 */
+	warn_nodiscard unsigned int GetInstanceNum() const
+	{
+		return instances.empty() ? 1 : static_cast<unsigned int>(instances.size());
+	}
+
+	/**
+	 * @brief The local to world transform of the instance.
+	 */
+	warn_nodiscard Matrix GetInstanceTransform(const unsigned int& instance) const
+	{
+		return instances.empty() ? transform : instances[instance].transform * transform;
+	}
+
+	/**
+	 * @brief The number of indices of the full detail level.
+	 */
+	warn_nodiscard unsigned int GetIndexNum() const
+	{
+		return lods.empty() ? static_cast<unsigned int>(indices.size()) / 3 * 3 : lods[0].indexNum;
+	}
+
+	/**
+	 * @brief Split index buffer into clusters and compute bounding volumes, call it once the geometry is loaded.
+	 *        The simplified levels are dropped, only the full detail level is kept.
+	 */
+	inline void BuildClusters();
+
+	/**
+	 * @brief Build the simplified levels by quadric error metric, each one has about half the triangles of the previous one.
+	 *        Call it after `BuildClusters()`, the levels share the vertex buffer and follow the full detail level in index buffer.
+	 */
+	inline void BuildLods();
+
+	/**
+	 * @brief Select the coarsest level whose error is at most `threshold` pixels on screen.
+	 * @param projectedRadius  The radius of the projected bounding sphere in pixels.
+	 */
+	warn_nodiscard inline const MeshletLod& SelectLod(const float& projectedRadius, const float& threshold) const;
+
+private:
+	// The version of vertices and indices, zero if never marked.
+	unsigned long long geometryVersion = 0;
+
+	/**
+	 * @brief Compute the bounding volume of triangles in index range.
+	 */
+	inline BoundingVolume BuildBounds(const unsigned int& first, const unsigned int& last) const;
+
+	/**
+	 * @brief Sort and split the indices after the last level into clusters, and append them as a new level.
+	 */
+	inline void AppendLod(const float& error);
+
+	/**
+	 * @brief Compute normal cone of the cluster, the face normal follows counter-clockwise winding.
+	 */
+	inline void BuildNormalCone(MeshletCluster& cluster) const;
+
+	/**
+	 * @brief Reorder triangles in index range so that the neighbouring triangles facing the same side fall into one cluster.
+	 */
+	inline void SortTriangles(const unsigned int& first, const unsigned int& last);
 };
+
+
+
+#ifndef MESHLET_HPP_MESHLET_IMPL
+#define MESHLET_HPP_MESHLET_IMPL
+
+	inline void Meshlet::BuildClusters()
+	{
+		const unsigned int indexNum = GetIndexNum();
+		indices.resize(indexNum);
+		clusters.clear();
+		lods.clear();
+
+		bounds = BuildBounds(0, indexNum);
+		AppendLod(0.f);
+		MarkGeometryChanged();
+	}
+
+	inline void Meshlet::BuildLods()
+	{
+		if (lods.empty())
+		{
+			BuildClusters();
+		}
+
+		// Drop the simplified levels built before.
+		indices.resize(lods[0].indexNum);
+		clusters.resize(lods[0].clusterNum);
+		lods.resize(1);
+
+		std::vector<unsigned int> levelIndices(indices.size());
+		for (size_t index = 0; index < indices.size(); ++index)
+		{
+			levelIndices[index] = indices[index].index;
+		}
+
+		QuadricSimplifier simplifier(vertices, levelIndices);
+		while (lods.size() < LOD_NUM)
+		{
+			const size_t triangleNum = levelIndices.size() / 3;
+			if (triangleNum <= LOD_MIN_TRIANGLE_NUM)
+			{
+				break;
+			}
+
+			// The level stuck on locked border and seam vertices is not worth its memory.
+			const float error = simplifier.Simplify(levelIndices, triangleNum / 2);
+			if (levelIndices.size() / 3 * 4 > triangleNum * 3)
+			{
+				break;
+			}
+
+			Vertex* vertex = vertices.data();
+			for (const unsigned int& index : levelIndices)
+			{
+				indices.push_back({ index, vertex + index });
+			}
+			AppendLod(error);
+		}
+
+		// The index buffer may be reallocated.
+		MarkGeometryChanged();
+	}
+
+	inline const MeshletLod& Meshlet::SelectLod(const float& projectedRadius, const float& threshold) const
+	{
+		// The error projects to `error / radius * projectedRadius` pixels.
+		const float maxError = bounds.radius > 0.f ? threshold * bounds.radius / projectedRadius : 0.f;
+		size_t level = 0;
+		while (level + 1 < lods.size() && lods[level + 1].error <= maxError)
+		{
+			++level;
+		}
+		return lods[level];
+	}
+
+	inline BoundingVolume Meshlet::BuildBounds(const unsigned int& first, const unsigned int& last) const
+	{
+		BoundingVolume volume;
+		for (unsigned int index = first; index < last; ++index)
+		{
+			volume.ExpandBox(vertices[indices[index].index].position);
+		}
+
+		volume.UpdateCenter();
+		for (unsigned int index = first; index < last; ++index)
+		{
+			volume.ExpandSphere(vertices[indices[index].index].position);
+		}
+		return volume;
+	}
+
+	inline void Meshlet::AppendLod(const float& error)
+	{
+		const unsigned int firstIndex = lods.empty() ? 0 : lods.back().firstIndex + lods.back().indexNum;
+		const unsigned int lastIndex = static_cast<unsigned int>(indices.size()) / 3 * 3;
+		SortTriangles(firstIndex, lastIndex);
+
+		MeshletLod& lod = lods.emplace_back();
+		lod.firstIndex = firstIndex;
+		lod.indexNum = lastIndex - firstIndex;
+		lod.firstCluster = static_cast<unsigned int>(clusters.size());
+		lod.error = error;
+
+		clusters.reserve(clusters.size() + (lod.indexNum / 3 + CLUSTER_TRIANGLE_NUM - 1) / CLUSTER_TRIANGLE_NUM);
+		for (unsigned int first = firstIndex; first < lastIndex; first += CLUSTER_TRIANGLE_NUM * 3)
+		{
+			MeshletCluster& cluster = clusters.emplace_back();
+			cluster.firstIndex = first;
+			cluster.indexNum = std::min(CLUSTER_TRIANGLE_NUM * 3, lastIndex - first);
+			cluster.bounds = BuildBounds(first, first + cluster.indexNum);
+			BuildNormalCone(cluster);
+		}
+		lod.clusterNum = static_cast<unsigned int>(clusters.size()) - lod.firstCluster;
+	}
+
+	inline void Meshlet::BuildNormalCone(MeshletCluster& cluster) const
+	{
+		// [ Zeux, "meshoptimizer: meshopt_computeClusterBounds" ]
+		auto FaceNormal = [this](const unsigned int& first) -> Vector3
+		{
+			const Vector3& a = vertices[indices[first + 0].index].position;
+			const Vector3& b = vertices[indices[first + 1].index].position;
+			const Vector3& c = vertices[indices[first + 2].index].position;
+			// Small triangles are still normalized, only the degenerate one keeps zero.
+			return ((b - a) ^ (c - a)).Normalize(0.f);
+		};
+
+		const unsigned int last = cluster.firstIndex + cluster.indexNum;
+		Vector3 axis = Vector3::Zero;
+		for (unsigned int first = cluster.firstIndex; first < last; first += 3)
+		{
+			axis += FaceNormal(first);
+		}
+
+		cluster.coneAxis = axis.Normalize();
+		cluster.coneCutoff = 1.f;
+		if (cluster.coneAxis.LengthSquared() < Number::SMALL_NUMBER)
+		{
+			return;
+		}
+
+		float minDot = 1.f;
+		for (unsigned int first = cluster.firstIndex; first < last; first += 3)
+		{
+			// Degenerate triangle is never rasterized.
+			const Vector3 normal = FaceNormal(first);
+			if (normal.LengthSquared() > 0.5f)
+			{
+				minDot = std::min(minDot, normal | cluster.coneAxis);
+			}
+		}
+
+		// The cone is wider than a hemisphere.
+		if (minDot <= 0.f)
+		{
+			return;
+		}
+
+		// Move the apex along the axis until it is behind every triangle plane.
+		float maxOffset = 0.f;
+		for (unsigned int first = cluster.firstIndex; first < last; first += 3)
+		{
+			const Vector3 normal = FaceNormal(first);
+			if (normal.LengthSquared() > 0.5f)
+			{
+				const Vector3& a = vertices[indices[first].index].position;
+				maxOffset = std::max(maxOffset, ((cluster.bounds.center - a) | normal) / (cluster.coneAxis | normal));
+			}
+		}
+
+		cluster.coneApex = cluster.bounds.center - cluster.coneAxis * maxOffset;
+		cluster.coneCutoff = std::sqrt(1.f - minDot * minDot);
+	}
+
+	inline void Meshlet::SortTriangles(const unsigned int& first, const unsigned int& last)
+	{
+		// Spread the lower 10 bits so that there are two zero bits between each bit.
+		auto Spread = [](unsigned int x) -> unsigned long long
+		{
+			x &= 0x3ff;
+			x = (x | (x << 16)) & 0x030000ff;
+			x = (x | (x << 8)) & 0x0300f00f;
+			x = (x | (x << 4)) & 0x030c30c3;
+			x = (x | (x << 2)) & 0x09249249;
+			return x;
+		};
+
+		const unsigned int triangleNum = (last - first) / 3;
+		const Vector3 extent = bounds.maximum - bounds.minimum;
+		const Vector3 scale = {
+			extent.x > 0.f ? 1023.f / extent.x : 0.f,
+			extent.y > 0.f ? 1023.f / extent.y : 0.f,
+			extent.z > 0.f ? 1023.f / extent.z : 0.f,
+		};
+
+		// Key layout: [ top 3 bits of morton code | facing side | rest 27 bits of morton code ].
+		// The coarse cell keeps clusters compact, the facing side narrows the normal cone inside one cell.
+		std::vector<std::pair<unsigned long long, unsigned int>> keys(triangleNum);
+		for (unsigned int triangle = 0; triangle < triangleNum; ++triangle)
+		{
+			const Vector3& a = vertices[indices[first + triangle * 3 + 0].index].position;
+			const Vector3& b = vertices[indices[first + triangle * 3 + 1].index].position;
+			const Vector3& c = vertices[indices[first + triangle * 3 + 2].index].position;
+
+			const Vector3 cell = ((a + b + c) * (1.f / 3.f) - bounds.minimum) * scale;
+			const unsigned long long morton =
+				Spread(static_cast<unsigned int>(std::clamp(cell.x, 0.f, 1023.f))) |
+				Spread(static_cast<unsigned int>(std::clamp(cell.y, 0.f, 1023.f))) << 1 |
+				Spread(static_cast<unsigned int>(std::clamp(cell.z, 0.f, 1023.f))) << 2;
+
+			const Vector3 normal = (b - a) ^ (c - a);
+			const float x = std::fabs(normal.x), y = std::fabs(normal.y), z = std::fabs(normal.z);
+			const unsigned long long side =
+				x >= y && x >= z ? (normal.x > 0.f ? 0 : 1) :
+				y >= z ? (normal.y > 0.f ? 2 : 3) : (normal.z > 0.f ? 4 : 5);
+
+			keys[triangle] = { (morton >> 27) << 30 | side << 27 | (morton & ((1ull << 27) - 1)), triangle };
+		}
+		std::sort(keys.begin(), keys.end());
+
+		std::vector<VertexIndex> sorted;
+		sorted.reserve(triangleNum * 3);
+		for (const auto& [key, triangle] : keys)
+		{
+			sorted.insert(sorted.end(), indices.begin() + first + triangle * 3, indices.begin() + first + triangle * 3 + 3);
+		}
+		std::copy(sorted.begin(), sorted.end(), indices.begin() + first);
+	}
+
+#endif // !MESHLET_HPP_MESHLET_IMPL
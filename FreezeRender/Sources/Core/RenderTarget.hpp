@@ -3,6 +3,7 @@
 #include <Common.hpp>
 #include <Container/Bulkdata.hpp>
 #include <Utility/Math.hpp>
+#include <atomic>
 #include "Shadingon.hpp"
 #include "Material.hpp"
 #include "Matrix.hpp"
@@ -20,7 +21,7 @@ public:
 
 protected:
 	// The raw data.
-	Bulkdata<PixelType> data;
+	Bulkdata<PixelType, LargePageAllocator> data;
 
 	// The columns number of image.
 	int width = 0;
@@ -61,6 +62,22 @@ public:
 	 */
 	inline void Clear();
 
+	/**
+	 * @brief Fill the pixels that are cleared lazily, nothing to do for a plain render target.
+	 */
+	force_inline void Resolve() {}
+
+	/**
+	 * @brief Make sure the pixels in [first, last] are written in current epoch, nothing to do for a plain render target.
+	 */
+	force_inline void TouchRange(const int& first, const int& last) {}
+
+	/**
+	 * @brief Get pixel value at given index, without the epoch check of a lazily cleared render target.
+	 *        The pixel must be inside a range touched by `TouchRange()` in current epoch.
+	 */
+	force_inline PixelType& GetTouchedPixel(const int& index) { return data[index]; }
+
 	/**
 	 * @brief Returns source data pointer of the image.
 	 */
@@ -106,6 +123,118 @@ public:
 	 * @brief Returns default pixel value.
 	 */
 	constexpr PixelTraits::Type GetDefaultPixel() const { return PixelTraits::defaultPixelValue; }
+
+	/**
+	 * @brief Whether `Clear()` is deferred rather than writing every pixel.
+	 */
+	static constexpr const bool bLazyClear = false;
+};
+
+
+
+/**
+ * @brief The render target that is cleared lazily by epoch tag.
+ *        Every span of pixels is tagged with the epoch it is written in, `Clear()` just starts a new epoch,
+ *        a stale span reads as default value and is filled on its first write of the current epoch.
+ */
+template <typename PixelTraits>
+class TaggedRenderTarget : public RenderTarget<PixelTraits>
+{
+	using Super = RenderTarget<PixelTraits>;
+	using Super::data;
+
+public:
+	using PixelType = Super::PixelType;
+
+	// The number of pixels share one tag.
+	static constexpr const int spanShift = 6;
+	static constexpr const int spanSize = 1 << spanShift;
+
+	// The tag of a span being filled by other thread.
+	static constexpr const unsigned int LOCKED_EPOCH = 0xffffffffu;
+
+protected:
+	// The epoch tag of every span.
+	Bulkdata<unsigned int> tags;
+
+	// The current epoch, starts from 1.
+	unsigned int epoch = 1;
+
+public:
+	explicit TaggedRenderTarget(const int& inWidth, const int& inHeight);
+
+	/**
+	 * @brief Resizes the image to given size.
+	 */
+	void Resize(const int& inWidth, const int& inHeight);
+
+	/**
+	 * @brief Clear the image by starting a new epoch, without writing any pixel.
+	 */
+	inline void Clear();
+
+	/**
+	 * @brief Fill all stale spans with default pixel value, call it before reading raw data.
+	 */
+	inline void Resolve();
+
+	/**
+	 * @brief Returns the number of spans.
+	 */
+	warn_nodiscard force_inline int SpanNum() const { return static_cast<int>(tags.Size()); }
+
+	/**
+	 * @brief Determines whether the span at given index is written in current epoch.
+	 */
+	warn_nodiscard force_inline bool IsFresh(const int& span) const;
+
+	/**
+	 * @brief Make sure the spans of pixels in [first, last] are written in current epoch, one tag check per span.
+	 *        The rasterizer touches a run of pixels once, then accesses them by `GetTouchedPixel()`.
+	 */
+	force_inline void TouchRange(const int& first, const int& last);
+
+	/**
+	 * @brief Swap memory without reallocation.
+	 */
+	force_inline void Swap(TaggedRenderTarget& rhs) { Super::Swap(rhs); tags.Swap(rhs.tags); std::swap(epoch, rhs.epoch); }
+
+	/**
+	 * @brief Set pixel value at given index.
+	 */
+	template<typename OtherPixelType>
+	force_inline void SetPixel(const int& index, const OtherPixelType& value) { Touch(index); Super::SetPixel(index, value); }
+
+	/**
+	 * @brief Set pixel value at given index.
+	 */
+	force_inline void SetPixel(const int& index, const PixelType& value) { Touch(index); Super::SetPixel(index, value); }
+
+	/**
+	 * @brief Get pixel value at given index, the span is filled if it is stale.
+	 */
+	force_inline PixelType& GetPixel(const int& index) { Touch(index); return data[index]; }
+
+	/**
+	 * @brief Get pixel value at given index.
+	 */
+	force_inline const PixelType& GetPixel(const int& index) const { return IsFresh(index >> spanShift) ? data[index] : PixelTraits::defaultPixelValue; }
+
+	/**
+	 * @brief Whether `Clear()` is deferred rather than writing every pixel.
+	 */
+	static constexpr const bool bLazyClear = true;
+
+private:
+	/**
+	 * @brief Make sure the span of given pixel is written in current epoch.
+	 */
+	force_inline void Touch(const int& index);
+
+	/**
+	 * @brief Fill the stale span with default pixel value, only one thread does it.
+	 */
+	force_noinline void Refresh(const int& span, unsigned int expected);
 };
 
 
@@ -156,6 +285,7 @@ struct ColorPixelTraits
 	using Type = Color;
 	inline static const Type defaultPixelValue = Color::Transparent;
 }; typedef RenderTarget<ColorPixelTraits> ColorRenderTarget;
+typedef TaggedRenderTarget<ColorPixelTraits> TaggedColorRenderTarget;
 
 
 
@@ -167,6 +297,31 @@ struct DepthPixelTraits
 	using Type = float;
 	inline static const Type defaultPixelValue = Number::FLOAT_NEG_INF;
 }; typedef RenderTarget<DepthPixelTraits> DepthRenderTarget;
+typedef TaggedRenderTarget<DepthPixelTraits> TaggedDepthRenderTarget;
+
+
+
+/**
+ * @brief The render target for the reversed z-depth, stores -1 / w, the farther one is closer to zero.
+ */
+struct ReverseDepthPixelTraits
+{
+	using Type = float;
+	inline static const Type defaultPixelValue = 0.f;
+}; typedef RenderTarget<ReverseDepthPixelTraits> ReverseDepthRenderTarget;
+typedef TaggedRenderTarget<ReverseDepthPixelTraits> TaggedReverseDepthRenderTarget;
+
+
+
+/**
+ * @brief The render target for the 16-bits unorm z-depth, stores -1 / w remapped from [1 / far, 1 / near] to [1, 65535].
+ */
+struct Depth16PixelTraits
+{
+	using Type = unsigned short;
+	inline static const Type defaultPixelValue = 0;
+}; typedef RenderTarget<Depth16PixelTraits> Depth16RenderTarget;
+typedef TaggedRenderTarget<Depth16PixelTraits> TaggedDepth16RenderTarget;
 
 
 
@@ -211,6 +366,18 @@ struct MaterialIdBufferPixelTraits
 	using Type = Material*;
 	inline static const Type defaultPixelValue = { nullptr };
 }; typedef RenderTarget<MaterialIdBufferPixelTraits> MaterialIdBufferRenderTarget;
+typedef TaggedRenderTarget<MaterialIdBufferPixelTraits> TaggedMaterialIdBufferRenderTarget;
+
+
+
+/**
+ * @brief The buffer of instance, the index of instance in its mesh.
+ */
+struct InstanceIdBufferPixelTraits
+{
+	using Type = unsigned int;
+	inline static const Type defaultPixelValue = 0;
+}; typedef RenderTarget<InstanceIdBufferPixelTraits> InstanceIdBufferRenderTarget;
 
 
 
@@ -280,4 +447,113 @@ struct MaterialIdBufferPixelTraits
 		data[index] = value;
 	}
 
-#endif // !RENDERTARGET_HPP_RENDERTARGET_IMPL
\ No newline at end of file
+#endif // !RENDERTARGET_HPP_RENDERTARGET_IMPL
+
+
+
+/**
+ * @brief The Detail implemention of `TaggedRenderTarget` template class.
+ */
+#ifndef RENDERTARGET_HPP_TAGGEDRENDERTARGET_IMPL
+#define RENDERTARGET_HPP_TAGGEDRENDERTARGET_IMPL
+
+	template <typename PixelTraits>
+	TaggedRenderTarget<PixelTraits>::TaggedRenderTarget(const int& inWidth, const int& inHeight)
+		: Super(0, 0)
+	{
+		Resize(inWidth, inHeight);
+	}
+
+	template <typename PixelTraits>
+	void TaggedRenderTarget<PixelTraits>::Resize(const int& inWidth, const int& inHeight)
+	{
+		if (inWidth > 0 && inHeight > 0)
+		{
+			Super::Resize(inWidth, inHeight);
+
+			// Pixels are filled by default value, all spans are fresh.
+			epoch = 1;
+			tags.Reallocate((inWidth * inHeight + spanSize - 1) >> spanShift);
+			tags.Initialize(epoch);
+		}
+	}
+
+	template <typename PixelTraits>
+	inline void TaggedRenderTarget<PixelTraits>::Clear()
+	{
+		// The epoch is running out, fall back to a full clear.
+		if (++epoch == LOCKED_EPOCH)
+		{
+			Super::Clear();
+			epoch = 1;
+			tags.Initialize(epoch);
+		}
+	}
+
+	template <typename PixelTraits>
+	inline void TaggedRenderTarget<PixelTraits>::Resolve()
+	{
+		const int spanNum = SpanNum();
+		for (int span = 0; span < spanNum; ++span)
+		{
+			Touch(span << spanShift);
+		}
+	}
+
+	template <typename PixelTraits>
+	force_inline bool TaggedRenderTarget<PixelTraits>::IsFresh(const int& span) const
+	{
+		return std::atomic_ref<unsigned int>(tags[span]).load(std::memory_order_acquire) == epoch;
+	}
+
+	template <typename PixelTraits>
+	force_inline void TaggedRenderTarget<PixelTraits>::Touch(const int& index)
+	{
+		const int span = index >> spanShift;
+		const unsigned int current = std::atomic_ref<unsigned int>(tags[span]).load(std::memory_order_acquire);
+		if (current != epoch)
+		{
+			Refresh(span, current);
+		}
+	}
+
+	template <typename PixelTraits>
+	force_inline void TaggedRenderTarget<PixelTraits>::TouchRange(const int& first, const int& last)
+	{
+		for (int span = first >> spanShift; span <= last >> spanShift; ++span)
+		{
+			const unsigned int current = std::atomic_ref<unsigned int>(tags[span]).load(std::memory_order_acquire);
+			if (current != epoch)
+			{
+				Refresh(span, current);
+			}
+		}
+	}
+
+	template <typename PixelTraits>
+	force_noinline void TaggedRenderTarget<PixelTraits>::Refresh(const int& span, unsigned int expected)
+	{
+		std::atomic_ref<unsigned int> tag(tags[span]);
+		while (expected != epoch)
+		{
+			if (expected == LOCKED_EPOCH)
+			{
+				// Other thread is filling the span.
+				_mm_pause();
+				expected = tag.load(std::memory_order_acquire);
+			}
+			else if (tag.compare_exchange_weak(expected, LOCKED_EPOCH, std::memory_order_acquire))
+			{
+				const int begin = span << spanShift;
+				const int end = std::min(begin + spanSize, static_cast<int>(data.Size()));
+				for (int index = begin; index < end; ++index)
+				{
+					data[index] = PixelTraits::defaultPixelValue;
+				}
+				tag.store(epoch, std::memory_order_release);
+				return;
+			}
+		}
+	}
+
+#endif // !RENDERTARGET_HPP_TAGGEDRENDERTARGET_IMPL
\ No newline at end of file
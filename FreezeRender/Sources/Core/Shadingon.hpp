@@ -83,6 +83,9 @@ struct ShadingTriangle
 	// Target sampling material.
 	const Material* material = nullptr;
 
+	// The index of instance in its mesh.
+	unsigned int instance = 0;
+
 
 	ShadingTriangle() = default;
 
@@ -116,12 +119,17 @@ class ShadingMeshletIterator
 public:
 	explicit ShadingMeshletIterator(const Meshlet* meshlet)
 		: begin(meshlet->indices.data())
-		, end(meshlet->indices.data() + meshlet->indices.size())
+		, end(meshlet->indices.data() + meshlet->GetIndexNum())
 	{}
 
 	explicit ShadingMeshletIterator(const Meshlet& meshlet)
 		: begin(meshlet.indices.data())
-		, end(meshlet.indices.data() + meshlet.indices.size())
+		, end(meshlet.indices.data() + meshlet.GetIndexNum())
+	{}
+
+	explicit ShadingMeshletIterator(const Meshlet& meshlet, const MeshletCluster& cluster)
+		: begin(meshlet.indices.data() + cluster.firstIndex)
+		, end(meshlet.indices.data() + cluster.firstIndex + cluster.indexNum)
 	{}
 
 	/// Iterative operations.
@@ -33,7 +33,7 @@ struct Texture
 	unsigned char channels = 0;
 
 	// The raw data.
-	Bulkdata<unsigned char> bits;
+	Bulkdata<unsigned char, LargePageAllocator> bits;
 
 	// The batch size for one columns, equals `width * bytePerPixel`.
 	int strides = 0;
@@ -1,5 +1,6 @@
 #include "TextureSampler.hpp"
 #include "Texture.hpp"
+#include "Cubemap.hpp"
 
 
 
@@ -281,6 +282,36 @@ namespace Detail
 			return Color::FromClampedVector(result);
 		}
 
+		/**
+		 * @brief The seamless bilinear sample of one mip level of cubemap, the footprint across the edge reads the border.
+		 */
+		R128 CubeBilinearSampler(const Cubemap& cubemap, const int& level, const int& face, const float& s, const float& t)
+		{
+			// Get position of texel.
+			const int size = cubemap.LevelSize(level);
+			const float realx = (s + 1.f) * 0.5f * size - 0.5f;
+			const float realy = (t + 1.f) * 0.5f * size - 0.5f;
+			const int x0 = Math::Clamp(-1, static_cast<int>(std::floorf(realx)), size - 1);
+			const int y0 = Math::Clamp(-1, static_cast<int>(std::floorf(realy)), size - 1);
+
+			// Get interpolation coefficient.
+			const R128 alphax = MakeRegister(realx - x0);
+			const R128 alphay = MakeRegister(realy - y0);
+
+			// Get a piece of color.
+			const Vector4* row0 = &cubemap.Texel(level, face, x0, y0);
+			const Vector4* row1 = &cubemap.Texel(level, face, x0, y0 + 1);
+			const R128 texel00 = RegisterLoad(row0);
+			const R128 texel01 = RegisterLoad(row0 + 1);
+			const R128 texel10 = RegisterLoad(row1);
+			const R128 texel11 = RegisterLoad(row1 + 1);
+
+			// interpolation.
+			const R128 tempx0 = RegisterMultiplyAdd(alphax, RegisterSubtract(texel01, texel00), texel00);
+			const R128 tempx1 = RegisterMultiplyAdd(alphax, RegisterSubtract(texel11, texel10), texel10);
+			return RegisterMultiplyAdd(alphay, RegisterSubtract(tempx1, tempx0), tempx0);
+		}
+
 		// The count of address mode.
 		constexpr int ADDRESS_MAX = static_cast<int>(TextureSampler::AddressMode::Max);
 
@@ -384,3 +415,24 @@ TextureSampler::TextureSampler(const Texture* inTarget, FilterMode&& inFilterMod
 		sampler = Detail::SamplerFunction::Biilinear[entry];
 	}
 }
+
+Vector4 TextureSampler::SampleCube(const Cubemap& cubemap, const Vector3& direction, const float& level)
+{
+	float s, t;
+	const int face = Cubemap::Project(direction, s, t);
+
+	// Trilinear, the two closest levels are blended.
+	const float clampedLevel = Math::Clamp(0.f, level, cubemap.LevelNum() - 1.f);
+	const int level0 = static_cast<int>(clampedLevel);
+	const int level1 = std::min(level0 + 1, cubemap.LevelNum() - 1);
+	R128 temp = Detail::SamplerFunction::CubeBilinearSampler(cubemap, level0, face, s, t);
+	if (level1 != level0)
+	{
+		const R128 next = Detail::SamplerFunction::CubeBilinearSampler(cubemap, level1, face, s, t);
+		temp = RegisterMultiplyAdd(MakeRegister(clampedLevel - level0), RegisterSubtract(next, temp), temp);
+	}
+
+	Vector4 result;
+	RegisterStoreAligned(temp, &result);
+	return result;
+}
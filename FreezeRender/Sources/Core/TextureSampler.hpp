@@ -5,6 +5,9 @@
 
 /// forward declaration.
 struct Texture;
+struct Cubemap;
+struct Vector3;
+struct Vector4;
 /// forward declaration.
 
 
@@ -46,6 +49,12 @@ public:
 
 	force_inline Color operator()(const float& u, const float& v) const { return sampler(target, u, v); }
 
+	/**
+	 * @brief Seamless trilinear sample of cubemap along the direction, `level` is clamped to the mip chain.
+	 *        The bilinear footprint across the edge of face takes the texels of the adjacent face.
+	 */
+	static Vector4 SampleCube(const Cubemap& cubemap, const Vector3& direction, const float& level);
+
 private:
 	const Texture* target;
 
@@ -1,9 +1,14 @@
 ﻿#include "FreezeRender.hpp"
 
 #include <Renderer/ParallelRasterizer.hpp>
+#include <Renderer/RayTracer.hpp>
 #include <Core/Camera.hpp>
+#include <Core/Cubemap.hpp>
+#include <Shader/EnvironmentLighting.hpp>
 #include <Loader/Texture/TextureLoaderLibrary.hpp>
 #include <Loader/Mesh/MeshLoaderLibrary.hpp>
+#include <ostream>
+#include <algorithm>
 
 
 
@@ -17,6 +22,7 @@ FreezeRender::~FreezeRender()
 
 void FreezeRender::InitScene()
 {
+	// The ray tracer draws the buffers of rasterizer, so the scene is loaded once.
 	auto& meshBuffer = rasterizer->GetMeshBuffer();
 	meshBuffer.clear();
 
@@ -44,19 +50,36 @@ void FreezeRender::InitScene()
 
 		auto& material = meshBuffer[0].materials.emplace_back();
 		TextureLoaderLibrary::Load(tex, material.ReallocateDiffuse());
+		material.Parameters() = { 0.f, 0.45f };
 	}
 
 	auto& pointLightBuffer = rasterizer->GetPointLightBuffer();
+	pointLightBuffer.clear();
 	pointLightBuffer.emplace_back( PointLight{ 500, { 20, 20, 20 } } );
 	pointLightBuffer.emplace_back( PointLight{ 500, { -20, 20, 0 } } );
+
+	// A procedural sky, the prefiltered result is cached next to the test assets.
+	Cubemap sky;
+	sky.Resize(128);
+	sky.Fill([](const Vector3& direction) -> Vector3
+	{
+		static const Vector3 zenith = { 0.08f, 0.13f, 0.25f };
+		static const Vector3 horizon = { 0.25f, 0.25f, 0.24f };
+		static const Vector3 ground = { 0.06f, 0.05f, 0.04f };
+		return direction.y > 0.f ? horizon + (zenith - horizon) * std::sqrt(direction.y) : ground;
+	});
+	environment = std::make_shared<const Shader::EnvironmentLighting>(std::move(sky), L"../FreezeRender/Test/sky.ibl");
+	rasterizer->SetEnvironment(environment);
+	rayTracer->SetEnvironment(environment);
 }
 
 HRESULT FreezeRender::HandleCreateEvent(UINT width, UINT height)
 {
-	rasterizer.reset(new ParallelRasterizer(width, height));
+	rasterizer.reset(new SceneRasterizer(width, height));
+	rayTracer.reset(new RayTracer(width, height, rasterizer->GetMeshBuffer(), rasterizer->GetPointLightBuffer()));
 	camera.reset(new Camera(width, height));
 
-	camera->handleUpdated.Bind(&ParallelRasterizer::UpdateViewState, rasterizer.get(), std::placeholders::_1);
+	camera->handleUpdated.Bind(&SceneRasterizer::UpdateViewState, rasterizer.get(), std::placeholders::_1);
 	camera->Update();
 	InitScene();
 	return S_OK;
@@ -64,10 +87,128 @@ HRESULT FreezeRender::HandleCreateEvent(UINT width, UINT height)
 
 HPAINTRESULT FreezeRender::HandlePaintEvent(const float deltaTime)
 {
-	ColorRenderTarget& Scene = rasterizer->Draw();
+	if (bRayTracing)
+	{
+		rayTracer->UpdateViewState(camera->viewState);
+	}
+	ColorRenderTarget& Scene = bRayTracing ? rayTracer->Draw() : rasterizer->Draw();
 	return { Scene.Data(), (UINT)Scene.Width(), (UINT)Scene.Height() };
 }
 
+void FreezeRender::HandleFrameStatsEvent(std::ostream& out)
+{
+	if (bRayTracing)
+	{
+		const RayTracingStatistics& statistics = rayTracer->GetStatistics();
+		out << " | " << "Ray tracing: " << statistics.megaRaysPerSecond << " Mrays/s";
+		out << " | " << "Rays: " << statistics.primaryRayNum << " primary, " << statistics.shadowRayNum << " shadow";
+		out << " | " << "Trace: " << statistics.traceTime << " ms";
+		out << " | " << "Scene BVH: " << statistics.sceneUpdateTime << " ms";
+		return;
+	}
+
+	const RasterStatistics& statistics = rasterizer->GetStatistics();
+	out << " | " << "Frames in flight: " << rasterizer->GetFramesInFlight();
+	out << " | " << "Arena: " << statistics.arenaSystemAllocations << " allocs, " << (statistics.arenaReservedBytes >> 10) << " KB";
+	out << " | " << "Scene BVH: " << statistics.sceneUpdateTime << " ms, " << statistics.sceneRefittedInstanceNum << " refitted";
+	out << " | " << "Frustum Culled: " << statistics.frustumCulledInstanceNum << "/" << statistics.instanceNum << " instances, " << statistics.frustumCulledClusterNum << "/" << statistics.clusterNum << " clusters";
+	out << " | " << "LOD: " << statistics.lodTriangleNum << "/" << statistics.triangleNum << " triangles";
+	out << " | " << "Cone Culled: " << 100.f * statistics.coneCulledTriangleNum / std::max(statistics.lodTriangleNum, 1u) << "%";
+	out << " | " << "Occlusion Culled: ";
+	switch (rasterizer->GetOcclusionMode())
+	{
+	case OcclusionMode::Occluders:
+		out << 100.f * statistics.occlusionCulledTriangleNum / std::max(statistics.lodTriangleNum, 1u) << "% (" << statistics.occluderTriangleNum << " occluder triangles)";
+		break;
+	case OcclusionMode::Temporal:
+		out << 100.f * statistics.occlusionCulledTriangleNum / std::max(statistics.lodTriangleNum, 1u) << "% (" << statistics.reusedClusterNum << " clusters reused)";
+		break;
+	default:
+		out << "off";
+		break;
+	}
+	out << " | " << "Clipped: " << statistics.clippedTriangleNum << " (guard band: " << statistics.guardBandTriangleNum << ")";
+	out << " | " << "Depth prepass: ";
+	if (rasterizer->IsDepthPrepassEnabled())
+	{
+		out << statistics.deferredTriangleNum << " triangles deferred";
+	}
+	else
+	{
+		out << "off";
+	}
+	out << " | " << "Shading: " << statistics.shadingTime << " ms";
+	out << " | " << "IBL: " << (rasterizer->GetEnvironment() ? "on" : "off");
+	out << " | " << "SSAO: ";
+	if (rasterizer->IsAmbientOcclusionEnabled())
+	{
+		out << statistics.ambientOcclusionTime << " ms";
+	}
+	else
+	{
+		out << "off";
+	}
+	switch (rasterizer->GetShadowMode())
+	{
+	case ShadowMode::RayTraced:
+		out << " (" << statistics.shadowRayNum << " shadow rays)";
+		break;
+	case ShadowMode::ShadowMaps:
+		out << " | " << "Shadow maps: " << statistics.shadowMapTime << " ms, " << statistics.shadowMapFaceNum << " faces rendered";
+		break;
+	default:
+		break;
+	}
+}
+
+void FreezeRender::HandleKeyDownEvent(WPARAM nKey)
+{
+	// Cycle the number of frames in flight, pipelined mode is disabled with one frame.
+	if (nKey == VK_P)
+	{
+		rasterizer->SetFramesInFlight(rasterizer->GetFramesInFlight() % SceneRasterizer::MAX_FRAMES_IN_FLIGHT + 1);
+	}
+
+	// Toggle the two-phase depth prepass mode.
+	if (nKey == VK_Z)
+	{
+		rasterizer->SetDepthPrepass(!rasterizer->IsDepthPrepassEnabled());
+	}
+
+	// Cycle the source of occlusion culling.
+	if (nKey == VK_O)
+	{
+		rasterizer->SetOcclusionMode(static_cast<OcclusionMode>((static_cast<int>(rasterizer->GetOcclusionMode()) + 1) % 3));
+	}
+
+	// Switch between rasterizer and ray tracer.
+	if (nKey == VK_R)
+	{
+		bRayTracing = !bRayTracing;
+	}
+
+	// Toggle the screen-space ambient occlusion.
+	if (nKey == VK_B)
+	{
+		rasterizer->SetAmbientOcclusion(!rasterizer->IsAmbientOcclusionEnabled());
+	}
+
+	// Toggle the environment lighting, the ambient light is uniform without it.
+	if (nKey == VK_I)
+	{
+		const bool bEnvironment = rasterizer->GetEnvironment() == nullptr;
+		rasterizer->SetEnvironment(bEnvironment ? environment : nullptr);
+		rayTracer->SetEnvironment(bEnvironment ? environment : nullptr);
+	}
+
+	// Cycle the shadows of rasterizer, the ray tracer always traces its shadows when they are enabled.
+	if (nKey == VK_H)
+	{
+		rasterizer->SetShadowMode(static_cast<ShadowMode>((static_cast<int>(rasterizer->GetShadowMode()) + 1) % 3));
+		rayTracer->SetShadows(rasterizer->GetShadowMode() != ShadowMode::Disabled);
+	}
+}
+
 static int LastX;
 static int LastY;
 static Rotator rotation;
@@ -105,6 +246,7 @@ void FreezeRender::HandleMouseWheelEvent(UINT nFlags, short zDelta, int x, int y
 void FreezeRender::HandleResizeEvent(UINT width, UINT height)
 {
 	rasterizer->Resize(width, height);
+	rayTracer->Resize(width, height);
 	camera->Resize(width, height);
 }
 
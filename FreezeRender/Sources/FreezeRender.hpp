@@ -4,9 +4,12 @@
 #include <memory>
 
 /// forward declaration.
-class ParallelRasterizer;
+template<typename DepthTraits> class ParallelRasterizer;
+struct ReverseDepthPixelTraits;
 class Rasterizer;
+class RayTracer;
 struct Camera;
+namespace Shader { class EnvironmentLighting; }
 /// forward declaration.
 
 
@@ -16,8 +19,19 @@ struct Camera;
  */
 class FreezeRender final : public D2DApp
 {
+	// Stores 1 / w in depth buffer, no reciprocal per pixel.
+	using SceneRasterizer = ParallelRasterizer<ReverseDepthPixelTraits>;
+
 	// The core of raster rendering.
-	std::unique_ptr<ParallelRasterizer> rasterizer;
+	std::unique_ptr<SceneRasterizer> rasterizer;
+
+	// The core of ray tracing rendering, draws the mesh and light buffers of rasterizer instead of it if enabled.
+	std::unique_ptr<RayTracer> rayTracer;
+
+	bool bRayTracing = false;
+
+	// The ambient light of both renderers, prefiltered from the sky when the scene is initialized.
+	std::shared_ptr<const Shader::EnvironmentLighting> environment;
 
 	// The main player's perspective in the world scene.
 	std::unique_ptr<Camera> camera;
@@ -36,6 +50,8 @@ protected:
 	/// Override message handle.
 	virtual HRESULT HandleCreateEvent(UINT width, UINT height) override;
 	virtual HPAINTRESULT HandlePaintEvent(const float deltaTime) override;
+	virtual void HandleFrameStatsEvent(std::ostream& out) override;
+	virtual void HandleKeyDownEvent(WPARAM nKey) override;
 	virtual void HandleLeftMouseDownEvent(WPARAM nFlags, int x, int y) override;
 	virtual void HandleMouseMoveEvent(WPARAM nFlags, int x, int y) override;
 	virtual void HandleMouseWheelEvent(UINT nFlags, short zDelta, int x, int y) override;
@@ -29,15 +29,23 @@ MeshLoader::Status MeshLoaderLibrary::Load(const wchar_t* const filename, Meshle
 	using namespace Utility;
 
 	const std::filesystem::path filepath = filename;
+	MeshLoader::Status status = MeshLoader::Status::FormatNotSupported;
 	switch (GetExtension(filepath))
 	{
 		case MeshLoader::Extension::OBJ:
 		{
 			OBJMeshLoader loader(filepath);
-			return loader.Load(result);
+			status = loader.Load(result);
+			break;
 		}
 		// TODO: Support more format.
 	}
 
-	return MeshLoader::Status::FormatNotSupported;
+	// Prepare culling data at load time.
+	if (status == MeshLoader::Status::Ok)
+	{
+		result->BuildClusters();
+		result->BuildLods();
+	}
+	return status;
 }
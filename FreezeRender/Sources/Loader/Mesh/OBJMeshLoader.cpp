@@ -340,5 +340,7 @@ OBJMeshLoader::Status OBJMeshLoader::Load(Meshlet* result)
 		result->name = filepath.filename();
 	}
 
+	// The geometry is replaced, or cleared if failed.
+	result->MarkGeometryChanged();
 	return status;
 }
\ No newline at end of file
@@ -111,7 +111,7 @@ namespace Detail
 			WICRect rect = { 0, 0, static_cast<int>(width), static_cast<int>(height) };
 			unsigned int strides = width * GPixelFormat[asformat].bytePerPixel;
 			unsigned int blocks = height * strides;
-			Bulkdata<unsigned char> buffer;
+			decltype(result->bits) buffer;
 			buffer.Reallocate(strides * height);
 			hr = pConvertedSourceBitmap->CopyPixels(&rect, strides, blocks, buffer.Get());
 			if (!SUCCEEDED(hr))
@@ -0,0 +1,192 @@
+#include "AmbientOcclusion.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+
+namespace
+{
+	// The number of rotations of directions, interleaved over the quads of pixels to trade banding for noise.
+	constexpr const int ROTATION_NUM = 4;
+
+	/**
+	 * @brief The unit directions of every rotation, the rotations are spread in the angle between two directions.
+	 */
+	struct DirectionTable
+	{
+		Vector2 directions[ROTATION_NUM][AmbientOcclusion::DIRECTION_NUM];
+
+		DirectionTable()
+		{
+			constexpr const float step = 6.28318530718f / AmbientOcclusion::DIRECTION_NUM;
+			for (int rotation = 0; rotation < ROTATION_NUM; ++rotation)
+			{
+				for (int direction = 0; direction < AmbientOcclusion::DIRECTION_NUM; ++direction)
+				{
+					const float angle = step * (direction + static_cast<float>(rotation) / ROTATION_NUM);
+					directions[rotation][direction] = { std::cos(angle), std::sin(angle) };
+				}
+			}
+		}
+	};
+
+	static const DirectionTable DIRECTION_TABLE;
+}
+
+
+
+void AmbientOcclusion::Resize(int inWidth, int inHeight)
+{
+	fullWidth = inWidth;
+	fullHeight = inHeight;
+
+	width = std::max((inWidth + 1) / 2, 1);
+	height = std::max((inHeight + 1) / 2, 1);
+	stride = (width + 3) & ~3;
+
+	const size_t size = static_cast<size_t>(stride) * height;
+	viewDepth.assign(size, EMPTY_DEPTH);
+	visibility.assign(size, 1.f);
+	fullVisibility.assign(static_cast<size_t>(inWidth) * inHeight, 1.f);
+}
+
+void AmbientOcclusion::Gather(const float& focalLength)
+{
+	const int tileNumX = (stride + TILE_SIZE - 1) / TILE_SIZE;
+	const int tileNumY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	Concurrency::parallel_for(0, tileNumX * tileNumY, [this, &tileNumX, &focalLength](const int& tile)
+	{
+		const int tileX = tile % tileNumX * TILE_SIZE;
+		const int tileY = tile / tileNumX * TILE_SIZE;
+		const int endX = std::min(tileX + TILE_SIZE, stride);
+		const int endY = std::min(tileY + TILE_SIZE, height);
+		for (int y = tileY; y < endY; ++y)
+		{
+			// The rows are padded to quads, so no quad crosses the tile.
+			for (int x = tileX; x < endX; x += 4)
+			{
+				GatherQuad(x, y, focalLength);
+			}
+		}
+	});
+}
+
+void AmbientOcclusion::GatherQuad(const int& x, const int& y, const float& focalLength)
+{
+	const int index = y * stride + x;
+	const R128 pointZ = RegisterLoad(&viewDepth[index]);
+	const R128 covered = RegisterGT(pointZ, MakeRegister(EMPTY_DEPTH * 0.5f));
+	const int coveredBits = RegisterMaskBits(covered);
+
+	// The radius in pixels follows the closest pixel of quad, it looks at -z.
+	const R128 closest = RegisterMax(pointZ, RegisterSwizzle(pointZ, 2, 3, 0, 1));
+	const float radiusPixels = std::min(RADIUS * focalLength / std::max(-RegisterGetX(RegisterMax(closest, RegisterSwizzle(closest, 1, 0, 3, 2))), 1e-3f), MAX_RADIUS_PIXELS);
+	if (coveredBits == 0 || radiusPixels < 1.f)
+	{
+		RegisterStore(Number::R_ONE, &visibility[index]);
+		return;
+	}
+
+	// The view space position is the depth times the factors of column and row.
+	const R128 laneColumns = RegisterMultiply(MakeRegister(0.f, 1.f, 2.f, 3.f), MakeRegister(columnScale));
+	const R128 columnFactor = RegisterAdd(MakeRegister(columnBias + x * columnScale), laneColumns);
+	const R128 rowFactor = MakeRegister(rowBias + y * rowScale);
+	const R128 negativeX = RegisterNegate(RegisterMultiply(pointZ, columnFactor));
+	const R128 negativeY = RegisterNegate(RegisterMultiply(pointZ, rowFactor));
+
+	// The tangents toward the right and the bottom take the neighbour of smaller difference of depth on each side,
+	// so that they never cross an edge of depth. With the differences dx, dy, the neighbour depth zx, zy and the factors
+	// cx, cy of the pixel, they are (dx * cx + zx * columnScale, dx * cy, dx) and (dy * cx, dy * cy + zy * rowScale, dy),
+	// the normal is the cross product of the bottom one and the right one, which faces the camera.
+	const R128 left = LoadDepth(x - 1, y);
+	const R128 right = LoadDepth(x + 1, y);
+	const R128 up = LoadDepth(x, y - 1);
+	const R128 down = LoadDepth(x, y + 1);
+	const R128 rightDifference = RegisterSubtract(right, pointZ);
+	const R128 leftDifference = RegisterSubtract(pointZ, left);
+	const R128 downDifference = RegisterSubtract(down, pointZ);
+	const R128 upDifference = RegisterSubtract(pointZ, up);
+	const R128 bRight = RegisterLT(RegisterAbs(rightDifference), RegisterAbs(leftDifference));
+	const R128 bDown = RegisterLT(RegisterAbs(downDifference), RegisterAbs(upDifference));
+	const R128 differenceX = RegisterSelect(bRight, rightDifference, leftDifference);
+	const R128 differenceY = RegisterSelect(bDown, downDifference, upDifference);
+	const R128 neighborX = RegisterMultiply(RegisterSelect(bRight, right, left), MakeRegister(columnScale));
+	const R128 neighborY = RegisterMultiply(RegisterSelect(bDown, down, up), MakeRegister(rowScale));
+	const R128 crossX = RegisterMultiply(neighborY, differenceX);
+	const R128 crossY = RegisterMultiply(neighborX, differenceY);
+	const R128 crossZ = RegisterNegate(RegisterMultiplyAdd(RegisterMultiply(differenceY, rowFactor), neighborX, RegisterMultiply(neighborY, RegisterMultiplyAdd(differenceX, columnFactor, neighborX))));
+	const R128 invNormalLength = RegisterReciprocalSqrt(RegisterAdd(RegisterMultiplyAdd(crossZ, crossZ, RegisterMultiplyAddMultiply(crossX, crossX, crossY, crossY)), MakeRegister(1e-30f)));
+	const R128 normalX = RegisterMultiply(crossX, invNormalLength);
+	const R128 normalY = RegisterMultiply(crossY, invNormalLength);
+	const R128 normalZ = RegisterMultiply(crossZ, invNormalLength);
+
+	const R128 invRadiusSquared = MakeRegister(1.f / (RADIUS * RADIUS));
+	const R128 bias = MakeRegister(ANGLE_BIAS);
+	const R128 epsilon = MakeRegister(1e-6f);
+
+	// The rotation and the distance of steps are interleaved over 4 x 4 quads.
+	const int rotation = ((x >> 2) + (y & 3)) & (ROTATION_NUM - 1);
+	const float stepOffset = (((y >> 2) + (x >> 2) * 3) & 3) * 0.25f + 0.25f;
+	const Vector2 (&directions)[DIRECTION_NUM] = DIRECTION_TABLE.directions[rotation];
+	const R128 distances = RegisterMultiply(RegisterAdd(MakeRegister(0.f, 1.f, 2.f, 3.f), MakeRegister(stepOffset)), MakeRegister(radiusPixels / STEP_NUM));
+
+	// The horizon of every direction starts from the biased tangent plane, only the rise of it above all closer samples occludes.
+	R128 occlusion = Number::R_ZERO;
+	for (int direction = 0; direction < DIRECTION_NUM; ++direction)
+	{
+		// The offsets of all steps in pixels, rounded to the nearest.
+		alignas(16) int offsetX[4], offsetY[4];
+		_mm_store_si128(reinterpret_cast<R128i*>(offsetX), _mm_cvtps_epi32(RegisterMultiply(distances, MakeRegister(directions[direction].x))));
+		_mm_store_si128(reinterpret_cast<R128i*>(offsetY), _mm_cvtps_epi32(RegisterMultiply(distances, MakeRegister(directions[direction].y))));
+
+		R128 horizon = bias;
+		for (int step = 0; step < STEP_NUM; ++step)
+		{
+			if (offsetX[step] == 0 && offsetY[step] == 0)
+			{
+				continue;
+			}
+
+			// The samples outside the screen are clamped to its edge.
+			const int sampleX = std::clamp(x + offsetX[step], 0, stride - 4);
+			const int sampleY = std::clamp(y + offsetY[step], 0, height - 1);
+			const R128 sampleZ = RegisterLoad(&viewDepth[sampleY * stride + sampleX]);
+			const R128 sampleColumn = RegisterAdd(MakeRegister(columnBias + sampleX * columnScale), laneColumns);
+			const R128 vectorX = RegisterMultiplyAdd(sampleZ, sampleColumn, negativeX);
+			const R128 vectorY = RegisterMultiplyAdd(sampleZ, MakeRegister(rowBias + sampleY * rowScale), negativeY);
+			const R128 vectorZ = RegisterSubtract(sampleZ, pointZ);
+			const R128 lengthSquared = RegisterMultiplyAdd(vectorZ, vectorZ, RegisterMultiplyAddMultiply(vectorX, vectorX, vectorY, vectorY));
+			const R128 projection = RegisterMultiplyAdd(normalZ, vectorZ, RegisterMultiplyAddMultiply(normalX, vectorX, normalY, vectorY));
+
+			// The sine of elevation above the tangent plane, the rise of horizon fades out to the radius.
+			const R128 elevation = RegisterMultiply(projection, RegisterReciprocalSqrt(RegisterAdd(lengthSquared, epsilon)));
+			const R128 falloff = RegisterMax(RegisterSubtract(Number::R_ONE, RegisterMultiply(lengthSquared, invRadiusSquared)), Number::R_ZERO);
+			occlusion = RegisterMultiplyAdd(RegisterMax(RegisterSubtract(elevation, horizon), Number::R_ZERO), falloff, occlusion);
+			horizon = RegisterMax(horizon, elevation);
+		}
+	}
+
+	const R128 scale = MakeRegister(STRENGTH / ((1.f - ANGLE_BIAS) * DIRECTION_NUM));
+	const R128 result = RegisterMax(RegisterSubtract(Number::R_ONE, RegisterMultiply(occlusion, scale)), Number::R_ZERO);
+	RegisterStore(RegisterSelect(covered, result, Number::R_ONE), &visibility[index]);
+}
+
+R128 AmbientOcclusion::LoadDepth(const int& x, const int& y) const
+{
+	if (y < 0 || y >= height)
+	{
+		return MakeRegister(EMPTY_DEPTH);
+	}
+	if (x >= 0 && x + 4 <= stride)
+	{
+		return RegisterLoad(&viewDepth[y * stride + x]);
+	}
+
+	alignas(16) float values[4];
+	for (int lane = 0; lane < 4; ++lane)
+	{
+		const int column = x + lane;
+		values[lane] = column >= 0 && column < stride ? viewDepth[y * stride + column] : EMPTY_DEPTH;
+	}
+	return RegisterLoadAligned(values);
+}
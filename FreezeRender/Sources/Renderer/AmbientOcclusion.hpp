@@ -0,0 +1,258 @@
+#pragma once
+
+#include <Core/Matrix.hpp>
+#include <Core/RenderTarget.hpp>
+#include <algorithm>
+#include <vector>
+#include <ppl.h>
+
+
+
+/**
+ * @brief The horizon-based screen-space ambient occlusion of geometry buffer in half resolution, in the style of HBAO.
+ *        Every pixel in half resolution takes the view space depth of the top-left pixel it covers, its position
+ *        is derived from the projection and its normal from the depth of its neighbours.
+ *        It marches `STEP_NUM` steps in each of `DIRECTION_NUM` directions, the occlusion of a direction is
+ *        the rise of its horizon above the tangent plane, every rise faded out to the radius.
+ *        4 adjacent pixels of a row share the sample offsets so that each sample is one unaligned load.
+ *        The full resolution is recovered by a bilateral upsample pass weighted by depth, 4 pixels at a time.
+ */
+class AmbientOcclusion
+{
+public:
+	// The radius of occluders in view space.
+	static constexpr const float RADIUS = 0.5f;
+
+	// The maximum radius in pixels of half resolution, bounds the cost of the closest surfaces.
+	static constexpr const float MAX_RADIUS_PIXELS = 24.f;
+
+	// The number of directions around the pixel, rotated over 4 x 4 quads.
+	static constexpr const int DIRECTION_NUM = 4;
+
+	// The number of samples along every direction.
+	static constexpr const int STEP_NUM = 3;
+	static_assert(STEP_NUM <= 4, "[FreezeRender] the offsets of steps are rounded in one register!");
+
+	// The sine of elevation the horizon starts from, hides the tessellation of curved surfaces.
+	static constexpr const float ANGLE_BIAS = 0.1f;
+
+	// The scale of occlusion, zero keeps the constant ambient light.
+	static constexpr const float STRENGTH = 1.5f;
+
+	// The weight of upsample drops to zero when the relative difference of depth reaches 1 / DEPTH_SHARPNESS.
+	static constexpr const float DEPTH_SHARPNESS = 16.f;
+
+	// The number of columns and rows of pixels in half resolution computed by one task, a multiple of quads.
+	static constexpr const int TILE_SIZE = 32;
+	static_assert(TILE_SIZE % 4 == 0, "[FreezeRender] the tile must hold whole quads!");
+
+	// The depth of pixels not covered, far enough to be out of the radius of any occluder.
+	static constexpr const float EMPTY_DEPTH = -1e6f;
+
+private:
+	// The size of full resolution.
+	int fullWidth = 0;
+	int fullHeight = 0;
+
+	// The size of half resolution.
+	int width = 0;
+	int height = 0;
+
+	// The number of pixels per row in half resolution, rounded up to quads. The padding pixels are never covered.
+	int stride = 0;
+
+	// The view space x and y of a pixel in half resolution over its depth, linear in its column and row.
+	float columnScale = 0.f;
+	float columnBias = 0.f;
+	float rowScale = 0.f;
+	float rowBias = 0.f;
+
+	// The view space depth in half resolution, stored from top to bottom. It looks at -z.
+	std::vector<float> viewDepth;
+
+	// The ambient visibility in half resolution, 1 is not occluded.
+	std::vector<float> visibility;
+
+	// The ambient visibility upsampled to full resolution, stored from top to bottom.
+	std::vector<float> fullVisibility;
+
+public:
+	AmbientOcclusion(int inWidth, int inHeight) { Resize(inWidth, inHeight); }
+
+	/**
+	 * @brief Resize to the full resolution, the half resolution is rounded up.
+	 */
+	void Resize(int inWidth, int inHeight);
+
+	/**
+	 * @brief Render the ambient visibility of pixels covered in `depth`, the rows are stored from top to bottom.
+	 *        `decode` converts the stored depth to -1 / w, `position` is in view space, only its depth is read.
+	 *        `projection` is the matrix of the camera, it maps the pixels back to view space.
+	 */
+	template<typename DepthTarget, typename Decoder>
+	void Render(const DepthTarget& depth, const Decoder& decode, const Float4RenderTarget& position, const Matrix& projection);
+
+	/**
+	 * @brief The ambient visibility of the covered full resolution pixel.
+	 */
+	warn_nodiscard force_inline float GetVisibility(const int& screenIndex) const { return fullVisibility[screenIndex]; }
+
+private:
+	/**
+	 * @brief Gather the occlusion of every tile in parallel, from the depth in half resolution.
+	 */
+	void Gather(const float& focalLength);
+
+	/**
+	 * @brief Gather the occlusion of 4 adjacent pixels in a row.
+	 */
+	void GatherQuad(const int& x, const int& y, const float& focalLength);
+
+	/**
+	 * @brief The depth of 4 adjacent pixels in half resolution from (x, y), the pixels outside the rows are not covered.
+	 */
+	warn_nodiscard R128 LoadDepth(const int& x, const int& y) const;
+
+	/**
+	 * @brief Upsample the visibility of every row in parallel, the 2 x 2 pixels of half resolution around
+	 *        each full resolution pixel are weighted by bilinear filter and by the relative difference of their depth.
+	 */
+	template<typename DepthTarget, typename Decoder>
+	void Upsample(const DepthTarget& depth, const Decoder& decode);
+};
+
+
+
+#ifndef AMBIENTOCCLUSION_HPP_AMBIENTOCCLUSION_IMPL
+#define AMBIENTOCCLUSION_HPP_AMBIENTOCCLUSION_IMPL
+
+	template<typename DepthTarget, typename Decoder>
+	void AmbientOcclusion::Render(const DepthTarget& depth, const Decoder& decode, const Float4RenderTarget& position, const Matrix& projection)
+	{
+		// The normalized device coordinates of the top-left pixel of every 2 x 2 block, y-axis up,
+		// mapped back by x = z * (ndc.x - m02) / m00 and y = z * (ndc.y - m12) / m11 since w = z.
+		columnScale = 4.f / (fullWidth * projection.m[0][0]);
+		columnBias = (1.f / fullWidth - 1.f - projection.m[0][2]) / projection.m[0][0];
+		rowScale = -4.f / (fullHeight * projection.m[1][1]);
+		rowBias = (1.f - 1.f / fullHeight - projection.m[1][2]) / projection.m[1][1];
+
+		// Point sampled, the top-left pixel of every 2 x 2 block.
+		Concurrency::parallel_for(0, height, [this, &depth, &position](const int& y)
+		{
+			const int fullRow = y * 2 * fullWidth;
+			for (int x = 0; x < stride; x += 4)
+			{
+				auto PixelDepth = [this, &depth, &position, &fullRow, &x](const int& lane) -> float
+				{
+					const int fullIndex = fullRow + (x + lane) * 2;
+					return x + lane < width && depth.GetPixel(fullIndex) != depth.GetDefaultPixel() ? position.GetPixel(fullIndex).z : EMPTY_DEPTH;
+				};
+				RegisterStore(MakeRegister(PixelDepth(0), PixelDepth(1), PixelDepth(2), PixelDepth(3)), &viewDepth[y * stride + x]);
+			}
+		});
+
+		// The pixels of half resolution per unit length at unit distance.
+		Gather(std::fabs(projection.m[1][1]) * fullHeight * 0.25f);
+		Upsample(depth, decode);
+	}
+
+	template<typename DepthTarget, typename Decoder>
+	void AmbientOcclusion::Upsample(const DepthTarget& depth, const Decoder& decode)
+	{
+		// The full resolution pixel is at the top-left pixel of its block, or halfway to the next one.
+		// The 4 pixels of a quad lie over [ x0, x0 + 2 ] in half resolution, the lanes 1 and 3 are halfway.
+		const R128 fractionX = MakeRegister(0.f, 0.5f, 0.f, 0.5f);
+		Concurrency::parallel_for(0, fullHeight, [this, &depth, &decode, &fractionX](const int& fullY)
+		{
+			const R128 sharpness = MakeRegister(DEPTH_SHARPNESS);
+			const R128 minWeight = MakeRegister(1e-3f);
+			const R128 fractionY = MakeRegister((fullY & 1) * 0.5f);
+			const R128 topLeft = RegisterMultiply(RegisterSubtract(Number::R_ONE, fractionX), RegisterSubtract(Number::R_ONE, fractionY));
+			const R128 topRight = RegisterMultiply(fractionX, RegisterSubtract(Number::R_ONE, fractionY));
+			const R128 bottomLeft = RegisterMultiply(RegisterSubtract(Number::R_ONE, fractionX), fractionY);
+			const R128 bottomRight = RegisterMultiply(fractionX, fractionY);
+
+			const int y0 = std::min(fullY >> 1, height - 1);
+			const int y1 = std::min(y0 + 1, height - 1);
+			const float* topDepth = &viewDepth[y0 * stride];
+			const float* topVisibility = &visibility[y0 * stride];
+			const float* bottomDepth = &viewDepth[y1 * stride];
+			const float* bottomVisibility = &visibility[y1 * stride];
+			const int fullRow = fullY * fullWidth;
+			float* target = &fullVisibility[fullRow];
+
+			// The value of [ x0, x0 + 1, x0 + 2 ] in half resolution, the columns outside are clamped to the edge.
+			auto LoadRow = [this](const float* row, const int& x0) -> R128
+			{
+				if (x0 + 3 < width)
+				{
+					return RegisterLoad(row + x0);
+				}
+				const int x1 = std::min(x0 + 1, width - 1);
+				return MakeRegister(row[x0], row[x1], row[std::min(x1 + 1, width - 1)], row[x1]);
+			};
+
+			for (int fullX = 0; fullX < fullWidth; fullX += 4)
+			{
+				// The columns past the last pixel repeat it, only the pixels inside are stored.
+				const int first = fullRow + fullX;
+				const int last = fullRow + std::min(fullX + 3, fullWidth - 1);
+
+				// The spans of lazily cleared depth are checked once per quad, the quad without any covered pixel is skipped.
+				bool bFresh = true;
+				if constexpr (DepthTarget::bLazyClear)
+				{
+					const bool bFirstFresh = depth.IsFresh(first >> DepthTarget::spanShift);
+					const bool bLastFresh = depth.IsFresh(last >> DepthTarget::spanShift);
+					if (!bFirstFresh && !bLastFresh)
+					{
+						continue;
+					}
+					bFresh = bFirstFresh && bLastFresh;
+				}
+				auto Decode4 = [&decode, &first, &last](const auto& GetPixel) -> R128
+				{
+					return MakeRegister(decode(GetPixel(first)), decode(GetPixel(std::min(first + 1, last))), decode(GetPixel(std::min(first + 2, last))), decode(GetPixel(last)));
+				};
+				const R128 pixelInverse = bFresh
+					? Decode4([&depth](const int& index) { return depth.Begin()[index]; })
+					: Decode4([&depth](const int& index) { return depth.GetPixel(index); });
+
+				const int x0 = fullX >> 1;
+				const R128 top = LoadRow(topDepth, x0);
+				const R128 bottom = LoadRow(bottomDepth, x0);
+				const R128 topValue = LoadRow(topVisibility, x0);
+				const R128 bottomValue = LoadRow(bottomVisibility, x0);
+
+				// The pixels across the edge of depth are discarded by the relative difference of depth,
+				// which is | z' - z | / | z | = | z' * (-1 / w) + 1 | since w = z.
+				auto Weight = [&pixelInverse, &sharpness, &minWeight](const R128& bilinear, const R128& corner) -> R128
+				{
+					const R128 difference = RegisterAbs(RegisterMultiplyAdd(corner, pixelInverse, Number::R_ONE));
+					return RegisterMultiply(bilinear, RegisterMax(RegisterSubtract(Number::R_ONE, RegisterMultiply(difference, sharpness)), minWeight));
+				};
+				const R128 weight0 = Weight(topLeft, RegisterSwizzle(top, 0, 0, 1, 1));
+				const R128 weight1 = Weight(topRight, RegisterSwizzle(top, 1, 1, 2, 2));
+				const R128 weight2 = Weight(bottomLeft, RegisterSwizzle(bottom, 0, 0, 1, 1));
+				const R128 weight3 = Weight(bottomRight, RegisterSwizzle(bottom, 1, 1, 2, 2));
+				R128 result = RegisterMultiply(weight0, RegisterSwizzle(topValue, 0, 0, 1, 1));
+				result = RegisterMultiplyAdd(weight1, RegisterSwizzle(topValue, 1, 1, 2, 2), result);
+				result = RegisterMultiplyAdd(weight2, RegisterSwizzle(bottomValue, 0, 0, 1, 1), result);
+				result = RegisterMultiplyAdd(weight3, RegisterSwizzle(bottomValue, 1, 1, 2, 2), result);
+				result = RegisterDivide(result, RegisterAdd(RegisterAdd(weight0, weight1), RegisterAdd(weight2, weight3)));
+
+				if (fullX + 4 <= fullWidth)
+				{
+					RegisterStore(result, target + fullX);
+				}
+				else
+				{
+					alignas(16) float values[4];
+					RegisterStoreAligned(result, values);
+					std::copy(values, values + fullWidth - fullX, target + fullX);
+				}
+			}
+		});
+	}
+
+#endif // !AMBIENTOCCLUSION_HPP_AMBIENTOCCLUSION_IMPL
@@ -0,0 +1,890 @@
+#pragma once
+
+#include <Core/Shadingon.hpp>
+#include <Utility/SIMD.hpp>
+#include <algorithm>
+#include <bit>
+
+
+
+/**
+ * @brief The compact setup record of a triangle, emitted by batched setup and consumed by raster kernels.
+ *        Both the edge functions and the iterator start at the pixel center of bounding box minimum.
+ */
+struct alignas(16) TriangleSetup
+{
+	// The perspective correct iterator, [ 1 / depth, gamma, alpha, beta ].
+	R128 f;
+
+	// The steps of iterator along x-axis and y-axis.
+	R128 i;
+	R128 j;
+
+	// [ 1, 1 / w3, 1 / w1, 1 / w2 ]
+	R128 invZ;
+
+	// The fixed point edge functions of counter-clockwise triangle, the pixel is covered if all of them are non-negative.
+	long long origin[3];
+	long long stepX[3];
+	long long stepY[3];
+
+	// The bounding box clamped by viewport.
+	ShadingBoundingBox box;
+};
+
+
+
+/**
+ * @brief The fixed point half-space rasterization shared by the raster passes, the occlusion buffer and the shadow maps.
+ *        The vertices are [ x, y, unused, w ] in pixels with y-axis up, the iterator interpolates 1 / w.
+ *        The coverage is decided by the top-left rule on snapped vertices, so the shared edge of a mesh is drawn once.
+ *
+ *        The kernels write the covered pixels through a target of the interface:
+ *            int Row(const int& y)
+ *                the index of pixel (0, y).
+ *            void TouchPixels(const int& first, const int& last)
+ *                before the pixels in [first, last] of a row are tested.
+ *            bool TestPixel(const int& index, const R128& zInverseAndInterpolation)
+ *                returns true if the pixel passes.
+ *            bool TestPixels4(const int& index, const R128& zInverseAndInterpolation)
+ *                the same for 4 pixels of a row from `index`.
+ *            bool TestPixels4(const int& index, const R128& zInverseAndInterpolation, const int& covered)
+ *                the same for the pixels in 4-bit `covered` mask, the others are touched but left as they are.
+ */
+namespace HalfSpaceRaster
+{
+	// The sub-pixel precision of fixed point vertex.
+	constexpr const static int SUBPIXEL_BITS = 8;
+	constexpr const static long long SUBPIXEL_ONE = 1ll << SUBPIXEL_BITS;
+
+	// The maximum absolute pixel coordinate of vertex,
+	// keeps the bounding box in integer range and the fixed point vertex in 22 bits.
+	constexpr const static float GUARD_BAND_LIMIT = 8192.f;
+
+	// The bounding box size of triangle rasterized by small triangle path.
+	constexpr const static int SMALL_TRIANGLE_SIZE = 4;
+
+	// The number of triangles set up together, one triangle per lane of R256.
+	constexpr const static int SETUP_LANE_NUM = 8;
+
+	/**
+	 * @brief The register mask of the lanes in 4-bit `mask`.
+	 */
+	force_inline R128 MakeLaneMask(const int& mask)
+	{
+		const R128i bits = MakeRegisterInteger(1, 2, 4, 8);
+		return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(mask), bits), bits));
+	}
+
+	/**
+	 * @brief Sign extends the lower (half = 0) or upper (half = 1) 4 lanes of 32-bits integer to 64-bits.
+	 */
+	force_inline R256i Widen(const R256i& reg, const int& half)
+	{
+		return _mm256_cvtepi32_epi64(half == 0 ? _mm256_castsi256_si128(reg) : _mm256_extracti128_si256(reg, 1));
+	}
+
+	/**
+	 * @brief Transposes 8 registers into 4 rows of 8 lanes, the n-th lane of row is [ input[n].x, input[n].y, input[n].z, input[n].w ].
+	 */
+	force_inline void Transpose8x4(const R128* input, R256& row0, R256& row1, R256& row2, R256& row3)
+	{
+		const R256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(input[0]), input[4], 1);
+		const R256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(input[1]), input[5], 1);
+		const R256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(input[2]), input[6], 1);
+		const R256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(input[3]), input[7], 1);
+		const R256 t0 = _mm256_unpacklo_ps(r0, r1);
+		const R256 t1 = _mm256_unpackhi_ps(r0, r1);
+		const R256 t2 = _mm256_unpacklo_ps(r2, r3);
+		const R256 t3 = _mm256_unpackhi_ps(r2, r3);
+		row0 = _mm256_shuffle_ps(t0, t2, ShuffleMask(0, 1, 0, 1));
+		row1 = _mm256_shuffle_ps(t0, t2, ShuffleMask(2, 3, 2, 3));
+		row2 = _mm256_shuffle_ps(t1, t3, ShuffleMask(0, 1, 0, 1));
+		row3 = _mm256_shuffle_ps(t1, t3, ShuffleMask(2, 3, 2, 3));
+	}
+
+	/**
+	 * @brief Transposes 4 rows of 8 lanes into 8 registers, the n-th register is [ row0[n], row1[n], row2[n], row3[n] ].
+	 */
+	force_inline void Transpose4x8(const R256& row0, const R256& row1, const R256& row2, const R256& row3, R128* output)
+	{
+		const R256 t0 = _mm256_unpacklo_ps(row0, row1);
+		const R256 t1 = _mm256_unpackhi_ps(row0, row1);
+		const R256 t2 = _mm256_unpacklo_ps(row2, row3);
+		const R256 t3 = _mm256_unpackhi_ps(row2, row3);
+		const R256 c0 = _mm256_shuffle_ps(t0, t2, ShuffleMask(0, 1, 0, 1));
+		const R256 c1 = _mm256_shuffle_ps(t0, t2, ShuffleMask(2, 3, 2, 3));
+		const R256 c2 = _mm256_shuffle_ps(t1, t3, ShuffleMask(0, 1, 0, 1));
+		const R256 c3 = _mm256_shuffle_ps(t1, t3, ShuffleMask(2, 3, 2, 3));
+		output[0] = _mm256_castps256_ps128(c0);
+		output[1] = _mm256_castps256_ps128(c1);
+		output[2] = _mm256_castps256_ps128(c2);
+		output[3] = _mm256_castps256_ps128(c3);
+		output[4] = _mm256_extractf128_ps(c0, 1);
+		output[5] = _mm256_extractf128_ps(c1, 1);
+		output[6] = _mm256_extractf128_ps(c2, 1);
+		output[7] = _mm256_extractf128_ps(c3, 1);
+	}
+
+	/**
+	 * @brief Set up `number` triangles of `positions` at once, one triangle per SIMD lane, for a target of `width * height` pixels.
+	 *        The zero area and off-target triangles are rejected, the back facing ones too if `bBackFaceCulling`, the clockwise
+	 *        ones are reordered otherwise. `emit(lane, setup, bSmall)` is called for every accepted triangle in lane order,
+	 *        `bSmall` tells the triangle covers at most 4x4 pixels.
+	 *        If `bConservative`, the edge functions are moved half a pixel inwards, only the pixels completely inside are covered.
+	 */
+	template<bool bBackFaceCulling, bool bConservative, typename Emit>
+	void SetupTriangles(const R128 (&positions)[3][SETUP_LANE_NUM], const int& number, const int& width, const int& height, Emit&& emit);
+
+	/**
+	 * @brief Rasterize the triangle into the target, returns true if any pixel passes.
+	 *        The strategy is chosen by the shape of bounding box if `bAdaptive`, otherwise every pixel is tested.
+	 */
+	template<bool bAdaptive, typename Target>
+	bool RasterizeTriangle(Target& target, const TriangleSetup& setup);
+
+	/**
+	 * @brief Rasterize the triangle covering at most 4x4 pixels, all pixels are tested at once.
+	 */
+	template<typename Target>
+	bool RasterizeSmallTriangle(Target& target, const TriangleSetup& setup);
+
+	/**
+	 * @brief The float depth target of depth-only rasterization, the closer depth is greater and the empty pixel is zero.
+	 *        The depth is 1 / w at the pixel center, or the farthest one inside the pixel if `bConservative`.
+	 */
+	template<bool bConservative>
+	struct DepthTarget
+	{
+		DepthTarget(float* depth, const int& stride, const TriangleSetup& setup);
+
+		force_inline int Row(const int& y) const { return y * stride; }
+
+		force_inline void TouchPixels(const int&, const int&) const {}
+
+		force_inline bool TestPixel(const int& index, const R128& zInverseAndInterpolation);
+
+		force_inline bool TestPixels4(const int& index, const R128& zInverseAndInterpolation);
+
+		force_inline bool TestPixels4(const int& index, const R128& zInverseAndInterpolation, const int& covered);
+
+	private:
+		float* depth;
+		int stride;
+
+		// [ 0, d(1 / depth) / dx, 2 * d(1 / depth) / dx, 3 * d(1 / depth) / dx ], minus the half pixel offset if conservative.
+		R128 zInverseStep4;
+
+		// The conservative depth never gets farther than the triangle.
+		R128 farthest = Number::R_ZERO;
+	};
+
+	/**
+	 * @brief The triangles waiting for depth-only rasterization into a float depth target of `width * height` pixels.
+	 *        Both faces are drawn, the batch is set up and rasterized when it is full or flushed.
+	 */
+	template<bool bConservative>
+	class DepthBatch
+	{
+	public:
+		DepthBatch(float* depth, const int& width, const int& height);
+
+		/**
+		 * @brief Append a triangle of [ x, y, unused, w ] vertices, the closer one has greater 1 / w.
+		 */
+		void Append(const Vector4& a, const Vector4& b, const Vector4& c);
+
+		/**
+		 * @brief Rasterize the triangles appended so far.
+		 */
+		void Flush();
+
+		/**
+		 * @brief The number of triangles overlapping the target so far.
+		 */
+		unsigned int GetAcceptedNum() const { return acceptedNum; }
+
+	private:
+		float* depth;
+		int width;
+		int height;
+
+		alignas(16) R128 positions[3][SETUP_LANE_NUM];
+		int number = 0;
+
+		unsigned int acceptedNum = 0;
+	};
+}
+
+
+
+#ifndef HALFSPACERASTER_HPP_HALFSPACERASTER_IMPL
+#define HALFSPACERASTER_HPP_HALFSPACERASTER_IMPL
+
+	template<bool bBackFaceCulling, bool bConservative, typename Emit>
+	void HalfSpaceRaster::SetupTriangles(const R128 (&positions)[3][SETUP_LANE_NUM], const int& number, const int& width, const int& height, Emit&& emit)
+	{
+		constexpr const int capacity = SETUP_LANE_NUM;
+		if (number == 0)
+		{
+			return;
+		}
+
+		// SoA of vertices, the empty lane repeats the first triangle and is rejected at last.
+		const R256i zero = _mm256_setzero_si256();
+		R256 vx[3], vy[3], vw[3];
+		for (int vertex = 0; vertex < 3; ++vertex)
+		{
+			R128 lanes[capacity];
+			for (int lane = 0; lane < capacity; ++lane)
+			{
+				lanes[lane] = positions[vertex][lane < number ? lane : 0];
+			}
+
+			R256 vz;
+			Transpose8x4(lanes, vx[vertex], vy[vertex], vz, vw[vertex]);
+		}
+
+		//****************************************************************
+		// Bounding boxes clamped by viewport.
+		//****************************************************************
+		alignas(32) int boxMinX[capacity];
+		alignas(32) int boxMaxX[capacity];
+		alignas(32) int boxMinY[capacity];
+		alignas(32) int boxMaxY[capacity];
+		int empty = 0;
+		int small = 0;
+		{
+			const R256 minX = _mm256_min_ps(_mm256_min_ps(vx[0], vx[1]), vx[2]);
+			const R256 maxX = _mm256_max_ps(_mm256_max_ps(vx[0], vx[1]), vx[2]);
+			const R256 minY = _mm256_min_ps(_mm256_min_ps(vy[0], vy[1]), vy[2]);
+			const R256 maxY = _mm256_max_ps(_mm256_max_ps(vy[0], vy[1]), vy[2]);
+
+			// The pixels whose center is inside the bounds, or the whole pixel if conservative.
+			// The bounds are extended by one sub-pixel, so they hold the snapped vertices.
+			const R256 inset = MakeRegister8(bConservative ? 0.f : 0.5f);
+			const R256 extent = MakeRegister8(1.f / SUBPIXEL_ONE);
+			const R256i shrink = MakeRegister8Integer(bConservative ? 1 : 0);
+			const R256i minx = _mm256_max_epi32(_mm256_cvttps_epi32(_mm256_ceil_ps(Register8Subtract(minX, Register8Add(inset, extent)))), zero);
+			const R256i maxx = _mm256_min_epi32(_mm256_sub_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(Register8Add(Register8Subtract(maxX, inset), extent))), shrink), MakeRegister8Integer(width - 1));
+			const R256i miny = _mm256_max_epi32(_mm256_cvttps_epi32(_mm256_ceil_ps(Register8Subtract(minY, Register8Add(inset, extent)))), zero);
+			const R256i maxy = _mm256_min_epi32(_mm256_sub_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(Register8Add(Register8Subtract(maxY, inset), extent))), shrink), MakeRegister8Integer(height - 1));
+			_mm256_store_si256(reinterpret_cast<R256i*>(boxMinX), minx);
+			_mm256_store_si256(reinterpret_cast<R256i*>(boxMaxX), maxx);
+			_mm256_store_si256(reinterpret_cast<R256i*>(boxMinY), miny);
+			_mm256_store_si256(reinterpret_cast<R256i*>(boxMaxY), maxy);
+
+			// The triangle in guard band may not cover the viewport, the tiny one may cover no pixel.
+			empty = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_cmpgt_epi32(minx, maxx), _mm256_cmpgt_epi32(miny, maxy))));
+
+			// The pixels covered by small triangle must be in the 4x4 grid at bounding box minimum, even if the box is clamped.
+			const R256 limit = MakeRegister8(SMALL_TRIANGLE_SIZE - 1.f);
+			small = _mm256_movemask_ps(_mm256_and_ps(
+				_mm256_cmp_ps(Register8Subtract(maxX, minX), limit, _CMP_LE_OQ),
+				_mm256_cmp_ps(Register8Subtract(maxY, minY), limit, _CMP_LE_OQ)));
+		}
+
+		// Snap vertices to sub-pixel grid, relative to the pixel center of bounding box minimum.
+		// Round half to even, so the shared vertex is snapped to the same point in every batch.
+		R256i px[3], py[3];
+		{
+			const R256 scale = MakeRegister8(static_cast<float>(SUBPIXEL_ONE));
+			const R256i half = MakeRegister8Integer(SUBPIXEL_ONE / 2);
+			const R256i centerX = _mm256_add_epi32(_mm256_slli_epi32(Register8IntegerLoad(boxMinX), SUBPIXEL_BITS), half);
+			const R256i centerY = _mm256_add_epi32(_mm256_slli_epi32(Register8IntegerLoad(boxMinY), SUBPIXEL_BITS), half);
+			for (int vertex = 0; vertex < 3; ++vertex)
+			{
+				px[vertex] = _mm256_sub_epi32(_mm256_cvtps_epi32(Register8Multiply(vx[vertex], scale)), centerX);
+				py[vertex] = _mm256_sub_epi32(_mm256_cvtps_epi32(Register8Multiply(vy[vertex], scale)), centerY);
+			}
+		}
+
+		//****************************************************************
+		// Zero area and back facing rejection by the sign of doubled area in 64-bits.
+		//****************************************************************
+		int clockwise = 0;
+		int degenerate = 0;
+		{
+			const R256i ax = _mm256_sub_epi32(px[1], px[0]);
+			const R256i ay = _mm256_sub_epi32(py[1], py[0]);
+			const R256i bx = _mm256_sub_epi32(px[2], px[0]);
+			const R256i by = _mm256_sub_epi32(py[2], py[0]);
+			for (int half = 0; half < 2; ++half)
+			{
+				const R256i area2 = _mm256_sub_epi64(_mm256_mul_epi32(Widen(ax, half), Widen(by, half)), _mm256_mul_epi32(Widen(bx, half), Widen(ay, half)));
+				clockwise |= Register8IntegerSignBits64(area2) << (half * 4);
+				degenerate |= Register8IntegerSignBits64(_mm256_cmpeq_epi64(area2, zero)) << (half * 4);
+			}
+		}
+
+		int rejected = empty | degenerate | ~((1 << number) - 1);
+		if constexpr (bBackFaceCulling)
+		{
+			rejected |= clockwise;
+		}
+
+		const int accepted = ~rejected & ((1 << capacity) - 1);
+		if (accepted == 0)
+		{
+			return;
+		}
+
+		//****************************************************************
+		// Perspective correct iterators in float, the snapped vertices keep the area of tiny triangle far from origin.
+		//****************************************************************
+		alignas(16) R128 f[capacity];
+		alignas(16) R128 i[capacity];
+		alignas(16) R128 j[capacity];
+		alignas(16) R128 invZ[capacity];
+		{
+			const R256 one = MakeRegister8(1.f);
+			const R256 invScale = MakeRegister8(1.f / SUBPIXEL_ONE);
+			R256 rx[3], ry[3], invW[3];
+			for (int vertex = 0; vertex < 3; ++vertex)
+			{
+				rx[vertex] = Register8Multiply(_mm256_cvtepi32_ps(px[vertex]), invScale);
+				ry[vertex] = Register8Multiply(_mm256_cvtepi32_ps(py[vertex]), invScale);
+				invW[vertex] = Register8Divide(one, vw[vertex]);
+			}
+
+			// The coefficients of edge [ v1v2, v2v3, v3v1 ] give the barycentric [ gamma, alpha, beta ].
+			R256 ci[3], cj[3], ck[3];
+			for (int edge = 0; edge < 3; ++edge)
+			{
+				const int a = edge;
+				const int b = edge == 2 ? 0 : edge + 1;
+				ci[edge] = Register8Subtract(ry[a], ry[b]);
+				cj[edge] = Register8Subtract(rx[b], rx[a]);
+				ck[edge] = Register8Subtract(Register8Multiply(rx[a], ry[b]), Register8Multiply(ry[a], rx[b]));
+			}
+
+			// iteration-based (2 * area / depth), the edge is weighted by the 1 / w of opposite vertex.
+			const R256 id = Register8MultiplyAdd(ci[2], invW[1], Register8MultiplyAddMultiply(ci[0], invW[2], ci[1], invW[0]));
+			const R256 jd = Register8MultiplyAdd(cj[2], invW[1], Register8MultiplyAddMultiply(cj[0], invW[2], cj[1], invW[0]));
+			const R256 kd = Register8MultiplyAdd(ck[2], invW[1], Register8MultiplyAddMultiply(ck[0], invW[2], ck[1], invW[0]));
+			const R256 invArea2 = Register8Divide(one, Register8Add(Register8Add(ck[0], ck[1]), ck[2]));
+
+			auto Scale = [&invArea2](const R256& reg) { return Register8Multiply(reg, invArea2); };
+			Transpose4x8(Scale(kd), Scale(ck[0]), Scale(ck[1]), Scale(ck[2]), f);
+			Transpose4x8(Scale(id), Scale(ci[0]), Scale(ci[1]), Scale(ci[2]), i);
+			Transpose4x8(Scale(jd), Scale(cj[0]), Scale(cj[1]), Scale(cj[2]), j);
+			Transpose4x8(one, invW[2], invW[0], invW[1], invZ);
+		}
+
+		//****************************************************************
+		// Fixed point edge functions in 64-bits, the coordinates are bounded by guard band so they never overflow.
+		//****************************************************************
+		alignas(32) long long origin[3][capacity];
+		alignas(32) long long stepX[3][capacity];
+		alignas(32) long long stepY[3][capacity];
+		{
+			// Reorder clockwise triangle, so that the inside is always on the left of edge.
+			if constexpr (!bBackFaceCulling)
+			{
+				const R256i bits = MakeRegister8Integer(1, 2, 4, 8, 16, 32, 64, 128);
+				const R256i swap = _mm256_cmpeq_epi32(_mm256_and_si256(MakeRegister8Integer(clockwise), bits), bits);
+				const R256i px1 = _mm256_blendv_epi8(px[1], px[2], swap);
+				const R256i py1 = _mm256_blendv_epi8(py[1], py[2], swap);
+				px[2] = _mm256_blendv_epi8(px[2], px[1], swap);
+				py[2] = _mm256_blendv_epi8(py[2], py[1], swap);
+				px[1] = px1;
+				py[1] = py1;
+			}
+
+			const R256i one = MakeRegister8Integer(1);
+			for (int edge = 0; edge < 3; ++edge)
+			{
+				const int a = edge;
+				const int b = edge == 2 ? 0 : edge + 1;
+				const R256i dx = _mm256_sub_epi32(px[b], px[a]);
+				const R256i dy = _mm256_sub_epi32(py[b], py[a]);
+
+				// With y-axis up, the top edge goes left and the left edge goes down.
+				// The pixel center exactly on the edge belongs to top or left edge only, so the shared edge is drawn once.
+				// bias = bTopLeft ? 0 : 1, the mask of true is -1.
+				const R256i topLeft = _mm256_or_si256(_mm256_cmpgt_epi32(zero, dy), _mm256_and_si256(_mm256_cmpeq_epi32(dy, zero), _mm256_cmpgt_epi32(zero, dx)));
+				const R256i bias = _mm256_add_epi32(one, topLeft);
+
+				for (int half = 0; half < 2; ++half)
+				{
+					// E(p) = dx * (p.y - a.y) - dy * (p.x - a.x), p is the origin.
+					const R256i wideDx = Widen(dx, half);
+					const R256i wideDy = Widen(dy, half);
+					const R256i edgeOrigin = _mm256_sub_epi64(_mm256_mul_epi32(wideDy, Widen(px[a], half)), _mm256_mul_epi32(wideDx, Widen(py[a], half)));
+					R256i edgeBias = Widen(bias, half);
+					if constexpr (bConservative)
+					{
+						// The edge function at the pixel corner closest to outside, (|dx| + |dy|) * SUBPIXEL_ONE / 2 less than the center.
+						const R256i extent = _mm256_add_epi64(Widen(_mm256_abs_epi32(dx), half), Widen(_mm256_abs_epi32(dy), half));
+						edgeBias = _mm256_add_epi64(edgeBias, _mm256_slli_epi64(extent, SUBPIXEL_BITS - 1));
+					}
+					_mm256_store_si256(reinterpret_cast<R256i*>(origin[edge] + half * 4), _mm256_sub_epi64(edgeOrigin, edgeBias));
+					_mm256_store_si256(reinterpret_cast<R256i*>(stepX[edge] + half * 4), _mm256_slli_epi64(_mm256_sub_epi64(zero, wideDy), SUBPIXEL_BITS));
+					_mm256_store_si256(reinterpret_cast<R256i*>(stepY[edge] + half * 4), _mm256_slli_epi64(wideDx, SUBPIXEL_BITS));
+				}
+			}
+		}
+
+		//****************************************************************
+		// Emit setup records of the accepted triangles to raster kernels.
+		//****************************************************************
+		for (int mask = accepted; mask; mask &= mask - 1)
+		{
+			const int lane = std::countr_zero(static_cast<unsigned int>(mask));
+
+			TriangleSetup setup;
+			setup.f = f[lane];
+			setup.i = i[lane];
+			setup.j = j[lane];
+			setup.invZ = invZ[lane];
+			for (int edge = 0; edge < 3; ++edge)
+			{
+				setup.origin[edge] = origin[edge][lane];
+				setup.stepX[edge] = stepX[edge][lane];
+				setup.stepY[edge] = stepY[edge][lane];
+			}
+			setup.box = { boxMinX[lane], boxMaxX[lane], boxMinY[lane], boxMaxY[lane] };
+			emit(lane, setup, (small >> lane & 1) != 0);
+		}
+	}
+
+	template<bool bAdaptive, typename Target>
+	bool HalfSpaceRaster::RasterizeTriangle(Target& target, const TriangleSetup& setup)
+	{
+		bool bVisible = false;
+
+		// [ Mileff P, Nehz K, Dudra J. 2015, "Accelerated Half-Space Triangle Rasterization" ]
+		// Detail see http://acta.uni-obuda.hu//Mileff_Nehez_Dudra_63.pdf
+		enum class Strategy : unsigned char
+		{
+			HalfSpace,             // half-space rasterization
+			BlockHalfSpace,        // Block-base half-space rasterization.
+			HierarchicalHalfSpace, // Tile-base and then block-base half-space rasterization.
+		};
+
+		const auto& [ minx, maxx, miny, maxy ] = setup.box;
+
+		// Coverage is decided by fixed point edge functions only, the float iterator is used for interpolation.
+		const R128& f = setup.f;
+		const R128& i = setup.i;
+		const R128& j = setup.j;
+
+		// [ 0, edge1, edge2, edge3 ], the pixel is covered if no sign bit is set.
+		const R256i e = MakeRegister8Integer64(0, setup.origin[0], setup.origin[1], setup.origin[2]);
+		const R256i ej = MakeRegister8Integer64(0, setup.stepY[0], setup.stepY[1], setup.stepY[2]);
+
+		// The steps of one level in hierarchy, `size` pixels per tile.
+		struct Level
+		{
+			R128 movex;
+			R128 movey;
+			R256i emovex;
+			R256i emovey;
+
+			// The offsets from top-left corner to the other three corners.
+			R256i cornerx;
+			R256i cornery;
+			R256i cornerxy;
+		};
+
+		auto MakeLevel = [&](const int& size) -> Level
+		{
+			auto Scale = [](const long long* step, const int& scale) -> R256i
+			{
+				return MakeRegister8Integer64(0, step[0] * scale, step[1] * scale, step[2] * scale);
+			};
+
+			Level level;
+			level.movex = RegisterMultiply(i, MakeRegister((float)size));
+			level.movey = RegisterMultiply(j, MakeRegister((float)size));
+			level.emovex = Scale(setup.stepX, size);
+			level.emovey = Scale(setup.stepY, size);
+			level.cornerx = Scale(setup.stepX, size - 1);
+			level.cornery = Scale(setup.stepY, size - 1);
+			level.cornerxy = Register8IntegerAdd64(level.cornerx, level.cornery);
+			return level;
+		};
+
+		enum class Coverage : unsigned char
+		{
+			Outside,
+			Partial,
+			Covered,
+		};
+
+		// Trivial reject if all corners are outside one edge, trivial accept if all corners are inside all edges.
+		auto Classify = [](const Level& level, const R256i& ec) -> Coverage
+		{
+			const int check00 = Register8IntegerSignBits64(ec);
+			const int check10 = Register8IntegerSignBits64(Register8IntegerAdd64(ec, level.cornerx));
+			const int check01 = Register8IntegerSignBits64(Register8IntegerAdd64(ec, level.cornery));
+			const int check11 = Register8IntegerSignBits64(Register8IntegerAdd64(ec, level.cornerxy));
+
+			if (check00 & check10 & check01 & check11)
+			{
+				return Coverage::Outside;
+			}
+			return (check00 | check10 | check01 | check11) ? Coverage::Partial : Coverage::Covered;
+		};
+
+		// The edge functions of 4 adjacent pixels in a row, one register per edge, and their steps of 4 pixels.
+		const R256i estep4[3] = {
+			MakeRegister8Integer64(setup.stepX[0] * 4),
+			MakeRegister8Integer64(setup.stepX[1] * 4),
+			MakeRegister8Integer64(setup.stepX[2] * 4) };
+		const R256i eoffset4[3] = {
+			MakeRegister8Integer64(0, setup.stepX[0], setup.stepX[0] * 2, setup.stepX[0] * 3),
+			MakeRegister8Integer64(0, setup.stepX[1], setup.stepX[1] * 2, setup.stepX[1] * 3),
+			MakeRegister8Integer64(0, setup.stepX[2], setup.stepX[2] * 2, setup.stepX[2] * 3) };
+		const R128 move4 = RegisterMultiply(i, MakeRegister(4.f));
+
+		// Rasterize pixels in [x0, x1] x [y0, y1], `c` and `ec` are the iterators at (x0, y0).
+		// The edges of 4 pixels are tested at once, the covered span of a convex triangle ends at its first outside group.
+		auto RasterizePixels = [&](const int& x0, const int& y0, const int& x1, const int& y1, const R128& c, const R256i& ec)
+		{
+			// Accumulated locally, so the pixel loop keeps it in register.
+			bool bPixelVisible = false;
+			R128 cy = c;
+			R256i ecy = ec;
+			for (int y = y0; y <= y1; ++y)
+			{
+				R128 cx = cy;
+				R256i e4[3] = {
+					_mm256_add_epi64(_mm256_permute4x64_epi64(ecy, 0x55), eoffset4[0]),
+					_mm256_add_epi64(_mm256_permute4x64_epi64(ecy, 0xaa), eoffset4[1]),
+					_mm256_add_epi64(_mm256_permute4x64_epi64(ecy, 0xff), eoffset4[2]) };
+				const int row = target.Row(y);
+				bool bTouched = false;
+				for (int x = x0; x <= x1; x += 4)
+				{
+					// if edge1 >= 0 and edge2 >= 0 and edge3 >= 0, the pixels after `x1` are masked out.
+					const int tail = std::min(x1 - x + 1, 4);
+					const int covered = ~Register8IntegerSignBits64(_mm256_or_si256(_mm256_or_si256(e4[0], e4[1]), e4[2])) & ((1 << tail) - 1);
+					if (covered)
+					{
+						// The rest of row is touched at its first covered group.
+						if (!bTouched)
+						{
+							target.TouchPixels(row + x, row + x1);
+							bTouched = true;
+						}
+
+						// The group inside the span is tested at once, the tail pixel by pixel.
+						if (tail == 4)
+						{
+							bPixelVisible |= target.TestPixels4(row + x, cx, covered);
+						}
+						else
+						{
+							for (int mask = covered; mask; mask &= mask - 1)
+							{
+								const int lane = std::countr_zero(static_cast<unsigned int>(mask));
+								bPixelVisible |= target.TestPixel(row + x + lane, RegisterMultiplyAdd(i, MakeRegister((float)lane), cx));
+							}
+						}
+					}
+					else if (bTouched)
+					{
+						break;
+					}
+					cx = RegisterAdd(cx, move4);
+					e4[0] = _mm256_add_epi64(e4[0], estep4[0]);
+					e4[1] = _mm256_add_epi64(e4[1], estep4[1]);
+					e4[2] = _mm256_add_epi64(e4[2], estep4[2]);
+				}
+				cy = RegisterAdd(cy, j);
+				ecy = Register8IntegerAdd64(ecy, ej);
+			}
+			bVisible |= bPixelVisible;
+		};
+
+		// Fill pixels in [x0, x1] x [y0, y1] without edge test, `c` is the iterator at (x0, y0).
+		// Every 4 pixels in a row share one depth test.
+		auto FillPixels = [&](const int& x0, const int& y0, const int& x1, const int& y1, const R128& c)
+		{
+			bool bPixelVisible = false;
+			R128 cy = c;
+			for (int y = y0; y <= y1; ++y)
+			{
+				R128 cx = cy;
+				const int row = target.Row(y);
+				target.TouchPixels(row + x0, row + x1);
+				int x = x0;
+				for (; x + 3 <= x1; x += 4)
+				{
+					bPixelVisible |= target.TestPixels4(row + x, cx);
+					cx = RegisterAdd(cx, move4);
+				}
+
+				for (; x <= x1; ++x)
+				{
+					bPixelVisible |= target.TestPixel(row + x, cx);
+					cx = RegisterAdd(cx, i);
+				}
+				cy = RegisterAdd(cy, j);
+			}
+			bVisible |= bPixelVisible;
+		};
+
+		// Walk the tiles of `level` in [x0, x1] x [y0, y1], the partially covered tile is refined by `Refine`.
+		// The adjacent tiles of the same coverage in a band are filled or refined at once.
+		auto RasterizeTiles = [&](const Level& level, const int& size, const int& x0, const int& y0, const int& x1, const int& y1, const R128& c, const R256i& ec, auto&& Refine)
+		{
+			R128 cy = c;
+			R256i ecy = ec;
+			for (int y = y0; y <= y1; y += size)
+			{
+				R128 cx = cy;
+				R256i ecx = ecy;
+				const int tileY1 = std::min(y + size - 1, y1);
+
+				Coverage runCoverage = Coverage::Outside;
+				int runX0 = x0;
+				R128 runC = cx;
+				R256i runE = ecx;
+				auto FlushRun = [&](const int& runX1)
+				{
+					if (runCoverage == Coverage::Covered)
+					{
+						FillPixels(runX0, y, runX1, tileY1, runC);
+					}
+					else if (runCoverage == Coverage::Partial)
+					{
+						Refine(runX0, y, runX1, tileY1, runC, runE);
+					}
+				};
+
+				for (int x = x0; x <= x1; x += size)
+				{
+					const Coverage coverage = Classify(level, ecx);
+					if (coverage != runCoverage)
+					{
+						FlushRun(x - 1);
+						runCoverage = coverage;
+						runX0 = x;
+						runC = cx;
+						runE = ecx;
+					}
+					cx = RegisterAdd(cx, level.movex);
+					ecx = Register8IntegerAdd64(ecx, level.emovex);
+				}
+				FlushRun(x1);
+				cy = RegisterAdd(cy, level.movey);
+				ecy = Register8IntegerAdd64(ecy, level.emovey);
+			}
+		};
+
+		constexpr static const int tile = 64;
+		constexpr static const int block = 8;
+
+		Strategy strategy = Strategy::HalfSpace;
+		if constexpr (bAdaptive)
+		{
+			const int boxX = (maxx - minx + 1);
+			const int boxY = (maxy - miny + 1);
+			const float cost = boxX * 1.f / boxY;
+
+			// The thin triangle seldom covers a whole tile, the small one seldom covers a whole block.
+			const bool adapt = cost > 0.40f && cost < 1.60f;
+			const bool small = boxX < block && boxY < block;
+
+			strategy =
+				small ? Strategy::HalfSpace :
+				adapt && boxX >= tile && boxY >= tile ? Strategy::HierarchicalHalfSpace : Strategy::BlockHalfSpace;
+		}
+
+		switch (strategy)
+		{
+		case Strategy::HalfSpace:
+		{
+			RasterizePixels(minx, miny, maxx, maxy, f, e);
+			break;
+		}
+		case Strategy::BlockHalfSpace:
+		{
+			const Level blockLevel = MakeLevel(block);
+			RasterizeTiles(blockLevel, block, minx, miny, maxx, maxy, f, e, RasterizePixels);
+			break;
+		}
+		case Strategy::HierarchicalHalfSpace:
+		{
+			// tile (64 x 64) -> block (8 x 8) -> pixel.
+			const Level blockLevel = MakeLevel(block);
+			const Level tileLevel = MakeLevel(tile);
+			auto RasterizeBlocks = [&](const int& x0, const int& y0, const int& x1, const int& y1, const R128& c, const R256i& ec)
+			{
+				RasterizeTiles(blockLevel, block, x0, y0, x1, y1, c, ec, RasterizePixels);
+			};
+			RasterizeTiles(tileLevel, tile, minx, miny, maxx, maxy, f, e, RasterizeBlocks);
+			break;
+		}
+		}
+		return bVisible;
+	}
+
+	template<typename Target>
+	bool HalfSpaceRaster::RasterizeSmallTriangle(Target& target, const TriangleSetup& setup)
+	{
+		const auto& [ minx, maxx, miny, maxy ] = setup.box;
+		bool bVisible = false;
+
+		// The pixels of 4x4 grid inside the viewport.
+		const int columns = std::min(maxx - minx + 1, SMALL_TRIANGLE_SIZE);
+		const int rows = std::min(maxy - miny + 1, SMALL_TRIANGLE_SIZE);
+		const int pixelMask = (((1 << columns) - 1) * 0x1111) & ((1 << (rows * SMALL_TRIANGLE_SIZE)) - 1);
+
+		// The edge functions of small triangle fit in 32-bits, test 2 rows per R256i.
+		const R256i R_PIXEL_X = MakeRegister8Integer(0, 1, 2, 3, 0, 1, 2, 3);
+		const R256i R_PIXEL_Y = MakeRegister8Integer(0, 0, 0, 0, 1, 1, 1, 1);
+		R256i outside0 = _mm256_setzero_si256();
+		R256i outside1 = _mm256_setzero_si256();
+		for (int edge = 0; edge < 3; ++edge)
+		{
+			const int stepX = static_cast<int>(setup.stepX[edge]);
+			const int stepY = static_cast<int>(setup.stepY[edge]);
+			const R256i e0 = _mm256_add_epi32(MakeRegister8Integer(static_cast<int>(setup.origin[edge])), _mm256_add_epi32(
+				_mm256_mullo_epi32(MakeRegister8Integer(stepX), R_PIXEL_X),
+				_mm256_mullo_epi32(MakeRegister8Integer(stepY), R_PIXEL_Y)));
+			const R256i e1 = _mm256_add_epi32(e0, MakeRegister8Integer(stepY * 2));
+			outside0 = _mm256_or_si256(outside0, e0);
+			outside1 = _mm256_or_si256(outside1, e1);
+		}
+
+		const int outside = _mm256_movemask_ps(_mm256_castsi256_ps(outside0)) | (_mm256_movemask_ps(_mm256_castsi256_ps(outside1)) << 8);
+		const int covered = ~outside & pixelMask;
+
+		// The grid of 4 columns is tested row by row.
+		if (columns == SMALL_TRIANGLE_SIZE)
+		{
+			for (int by = 0; by < rows; ++by)
+			{
+				const int rowMask = covered >> (by * SMALL_TRIANGLE_SIZE) & 0xf;
+				if (rowMask)
+				{
+					const int row = target.Row(miny + by) + minx;
+					target.TouchPixels(row, row + columns - 1);
+					bVisible |= target.TestPixels4(row, RegisterMultiplyAdd(setup.j, MakeRegister((float)by), setup.f), rowMask);
+				}
+			}
+			return bVisible;
+		}
+
+		int touchedRow = -1;
+		int row = 0;
+		for (int mask = covered; mask; mask &= mask - 1)
+		{
+			const int pixel = std::countr_zero(static_cast<unsigned int>(mask));
+			const int bx = pixel & (SMALL_TRIANGLE_SIZE - 1);
+			const int by = pixel / SMALL_TRIANGLE_SIZE;
+
+			// The covered pixels of a row are touched at once.
+			if (by != touchedRow)
+			{
+				row = target.Row(miny + by) + minx;
+				target.TouchPixels(row + bx, row + columns - 1);
+				touchedRow = by;
+			}
+
+			// (1 / depth, gamma, alpha, beta )
+			const R128 zInverseAndInterpolation = RegisterAdd(setup.f,
+				RegisterMultiplyAddMultiply(setup.i, MakeRegister((float)bx), setup.j, MakeRegister((float)by)));
+			bVisible |= target.TestPixel(row + bx, zInverseAndInterpolation);
+		}
+		return bVisible;
+	}
+
+	template<bool bConservative>
+	HalfSpaceRaster::DepthTarget<bConservative>::DepthTarget(float* depth, const int& stride, const TriangleSetup& setup)
+		: depth(depth)
+		, stride(stride)
+		, zInverseStep4(RegisterMultiply(RegisterReplicate(setup.i, 0), MakeRegister(0.f, 1.f, 2.f, 3.f)))
+	{
+		// The depth plane is linear, so its farthest point inside the pixel is at a corner, half a pixel farther than the center.
+		if constexpr (bConservative)
+		{
+			const R128 extent = RegisterMultiply(RegisterAdd(RegisterAbs(setup.i), RegisterAbs(setup.j)), MakeRegister(0.5f));
+			zInverseStep4 = RegisterSubtract(zInverseStep4, RegisterReplicate(extent, 0));
+			farthest = RegisterMin(RegisterMin(RegisterReplicate(setup.invZ, 1), RegisterReplicate(setup.invZ, 2)), RegisterReplicate(setup.invZ, 3));
+		}
+	}
+
+	template<bool bConservative>
+	force_inline bool HalfSpaceRaster::DepthTarget<bConservative>::TestPixel(const int& index, const R128& zInverseAndInterpolation)
+	{
+		R128 value = RegisterAdd(zInverseAndInterpolation, zInverseStep4);
+		if constexpr (bConservative)
+		{
+			value = RegisterMax(value, farthest);
+		}
+
+		float& data = depth[index];
+		const float closer = RegisterGetX(value);
+		const bool bCloser = data < closer;
+		data = bCloser ? closer : data;
+		return bCloser;
+	}
+
+	template<bool bConservative>
+	force_inline bool HalfSpaceRaster::DepthTarget<bConservative>::TestPixels4(const int& index, const R128& zInverseAndInterpolation)
+	{
+		R128 value = RegisterAdd(RegisterReplicate(zInverseAndInterpolation, 0), zInverseStep4);
+		if constexpr (bConservative)
+		{
+			value = RegisterMax(value, farthest);
+		}
+
+		float* data = depth + index;
+		const R128 old = RegisterLoad(data);
+		RegisterStore(RegisterMax(old, value), data);
+		return RegisterMaskBits(RegisterLT(old, value)) != 0;
+	}
+
+	template<bool bConservative>
+	force_inline bool HalfSpaceRaster::DepthTarget<bConservative>::TestPixels4(const int& index, const R128& zInverseAndInterpolation, const int& covered)
+	{
+		R128 value = RegisterAdd(RegisterReplicate(zInverseAndInterpolation, 0), zInverseStep4);
+		if constexpr (bConservative)
+		{
+			value = RegisterMax(value, farthest);
+		}
+
+		float* data = depth + index;
+		const R128 old = RegisterLoad(data);
+		const R128 closer = RegisterAnd(RegisterLT(old, value), MakeLaneMask(covered));
+		RegisterStore(RegisterSelect(closer, value, old), data);
+		return RegisterMaskBits(closer) != 0;
+	}
+
+	template<bool bConservative>
+	HalfSpaceRaster::DepthBatch<bConservative>::DepthBatch(float* depth, const int& width, const int& height)
+		: depth(depth)
+		, width(width)
+		, height(height)
+	{
+	}
+
+	template<bool bConservative>
+	void HalfSpaceRaster::DepthBatch<bConservative>::Append(const Vector4& a, const Vector4& b, const Vector4& c)
+	{
+		positions[0][number] = RegisterLoad(&a);
+		positions[1][number] = RegisterLoad(&b);
+		positions[2][number] = RegisterLoad(&c);
+		if (++number == SETUP_LANE_NUM)
+		{
+			Flush();
+		}
+	}
+
+	template<bool bConservative>
+	void HalfSpaceRaster::DepthBatch<bConservative>::Flush()
+	{
+		SetupTriangles<false, bConservative>(positions, number, width, height, [this](const int&, const TriangleSetup& setup, const bool& bSmall)
+		{
+			DepthTarget<bConservative> target(depth, width, setup);
+			bSmall ? RasterizeSmallTriangle(target, setup) : RasterizeTriangle<true>(target, setup);
+			++acceptedNum;
+		});
+		number = 0;
+	}
+
+#endif // !HALFSPACERASTER_HPP_HALFSPACERASTER_IMPL
@@ -0,0 +1,163 @@
+#include "OcclusionBuffer.hpp"
+#include "HalfSpaceRaster.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+
+namespace
+{
+	// The vertex behind this plane is not projected.
+	constexpr const static float CLIPPING_PLANE = -0.000001f;
+
+	// The triangle reaching outside of the guard band is skipped, keeps the vertices inside the range of fixed point rasterization.
+	constexpr const static float GUARD_BAND_LIMIT = HalfSpaceRaster::GUARD_BAND_LIMIT;
+}
+
+
+
+OcclusionBuffer::OcclusionBuffer()
+{
+	for (int level = 0; level < LEVEL_NUM; ++level)
+	{
+		levels[level].resize((WIDTH >> level) * (HEIGHT >> level), 0.f);
+	}
+}
+
+void OcclusionBuffer::Clear()
+{
+	std::fill(levels[0].begin(), levels[0].end(), 0.f);
+	triangleNum = 0;
+}
+
+void OcclusionBuffer::RasterizeOccluder(const Meshlet& mesh, const Matrix& mvp)
+{
+	positions.resize(mesh.vertices.size());
+	for (size_t index = 0; index < mesh.vertices.size(); ++index)
+	{
+		const Vector4 clip = mvp * Vector4(mesh.vertices[index].position, 1.f);
+
+		// Look at -z, the zero depth marks the vertex behind camera.
+		if (clip.w > CLIPPING_PLANE)
+		{
+			positions[index] = Vector4::Zero;
+			continue;
+		}
+
+		// The depth is the interpolated 1 / w, which is -1 / clip.w.
+		const float invW = 1.f / clip.w;
+		positions[index] = {
+			(clip.x * invW * 0.5f + 0.5f) * WIDTH,
+			(clip.y * invW * 0.5f + 0.5f) * HEIGHT,
+			0.f,
+			-clip.w
+		};
+	}
+
+	auto IsInsideGuardBand = [](const Vector4& position) -> bool
+	{
+		return position.w > 0.f &&
+			position.x > WIDTH - GUARD_BAND_LIMIT && position.x < GUARD_BAND_LIMIT &&
+			position.y > HEIGHT - GUARD_BAND_LIMIT && position.y < GUARD_BAND_LIMIT;
+	};
+
+	// The full detail level, a simplified one may shrink inside the real surface.
+	// Only the texels covered completely, a crack between occluders never gets a depth.
+	HalfSpaceRaster::DepthBatch<true> batch(levels[0].data(), WIDTH, HEIGHT);
+	const size_t indexNum = mesh.GetIndexNum();
+	for (size_t index = 0; index < indexNum; index += 3)
+	{
+		const Vector4& a = positions[mesh.indices[index + 0].index];
+		const Vector4& b = positions[mesh.indices[index + 1].index];
+		const Vector4& c = positions[mesh.indices[index + 2].index];
+		if (IsInsideGuardBand(a) && IsInsideGuardBand(b) && IsInsideGuardBand(c))
+		{
+			batch.Append(a, b, c);
+		}
+	}
+	batch.Flush();
+	triangleNum += batch.GetAcceptedNum();
+}
+
+void OcclusionBuffer::BuildHierarchy()
+{
+	for (int level = 1; level < LEVEL_NUM; ++level)
+	{
+		const int width = WIDTH >> level;
+		const int height = HEIGHT >> level;
+		const float* source = levels[level - 1].data();
+		float* target = levels[level].data();
+		for (int y = 0; y < height; ++y)
+		{
+			const float* row0 = source + (2 * y + 0) * (2 * width);
+			const float* row1 = source + (2 * y + 1) * (2 * width);
+			for (int x = 0; x < width; ++x)
+			{
+				target[y * width + x] = std::min({ row0[2 * x], row0[2 * x + 1], row1[2 * x], row1[2 * x + 1] });
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::IsOccluded(const BoundingVolume& volume, const Matrix& mvp) const
+{
+	float minX = Number::FLOAT_INF, maxX = Number::FLOAT_NEG_INF;
+	float minY = Number::FLOAT_INF, maxY = Number::FLOAT_NEG_INF;
+	float nearest = 0.f;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const Vector4 point = {
+			corner & 1 ? volume.maximum.x : volume.minimum.x,
+			corner & 2 ? volume.maximum.y : volume.minimum.y,
+			corner & 4 ? volume.maximum.z : volume.minimum.z,
+			1.f
+		};
+		const Vector4 clip = mvp * point;
+
+		// The box crossing the camera plane is always visible.
+		if (clip.w > CLIPPING_PLANE)
+		{
+			return false;
+		}
+
+		const float invW = 1.f / clip.w;
+		const float x = (clip.x * invW * 0.5f + 0.5f) * WIDTH;
+		const float y = (clip.y * invW * 0.5f + 0.5f) * HEIGHT;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		nearest = std::max(nearest, -invW);
+	}
+
+	// The box outside viewport is left to frustum culling.
+	if (maxX < 0.f || minX > WIDTH || maxY < 0.f || minY > HEIGHT)
+	{
+		return false;
+	}
+
+	// The depth of texel holds for every point inside it, so the texels overlapping the box are tested.
+	const int x0 = std::clamp(static_cast<int>(std::floor(minX)), 0, WIDTH - 1);
+	const int x1 = std::clamp(static_cast<int>(std::floor(maxX)), 0, WIDTH - 1);
+	const int y0 = std::clamp(static_cast<int>(std::floor(minY)), 0, HEIGHT - 1);
+	const int y1 = std::clamp(static_cast<int>(std::floor(maxY)), 0, HEIGHT - 1);
+
+	// The finest level where the box covers at most 2 x 2 texels.
+	int level = 0;
+	while (level < LEVEL_NUM - 1 && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+	{
+		++level;
+	}
+
+	const int width = WIDTH >> level;
+	const float* depthData = levels[level].data();
+	float farthest = Number::FLOAT_INF;
+	for (int y = y0 >> level; y <= (y1 >> level); ++y)
+	{
+		for (int x = x0 >> level; x <= (x1 >> level); ++x)
+		{
+			farthest = std::min(farthest, depthData[y * width + x]);
+		}
+	}
+	return nearest < farthest;
+}
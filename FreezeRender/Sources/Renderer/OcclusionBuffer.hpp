@@ -0,0 +1,107 @@
+#pragma once
+
+#include <Core/Meshlet.hpp>
+#include <Core/Matrix.hpp>
+#include <Core/BoundingVolume.hpp>
+#include <vector>
+#include <algorithm>
+#include <ppl.h>
+
+
+
+/**
+ * @brief The low resolution depth of occluders and its hierarchical-z mip chain, tests whether the bounding box is hidden.
+ *        The depth is -1 / w of the farthest point inside a texel, the closer one is greater and the empty texel is zero,
+ *        so a coarse texel keeps the minimum of its four children.
+ */
+class OcclusionBuffer
+{
+public:
+	// The resolution of the finest level, covering the whole viewport.
+	static constexpr const int WIDTH = 256;
+	static constexpr const int HEIGHT = 128;
+
+	// The number of levels, the coarsest one is 2 x 1.
+	static constexpr const int LEVEL_NUM = 8;
+
+private:
+	// The depth of every level, the rows are stored from bottom to top.
+	std::vector<float> levels[LEVEL_NUM];
+
+	// The screen position of occluder vertices, [ x, y, unused, -w ], reused by every occluder.
+	std::vector<Vector4> positions;
+
+	// The number of triangles rasterized since last `Clear()`.
+	unsigned int triangleNum = 0;
+
+public:
+	OcclusionBuffer();
+
+	unsigned int GetTriangleNum() const { return triangleNum; }
+
+	/**
+	 * @brief Clear every texel of the finest level to the farthest depth.
+	 */
+	void Clear();
+
+	/**
+	 * @brief Rasterize the triangles of occluder into the finest level, `mvp` is the clip matrix of mesh.
+	 *        The triangle crossing the near plane or the guard band is skipped, so the depth never gets closer than the occluders.
+	 */
+	void RasterizeOccluder(const Meshlet& mesh, const Matrix& mvp);
+
+	/**
+	 * @brief Build the finest level from the full resolution depth, every texel keeps the farthest pixel it overlaps.
+	 *        `decode` converts the stored depth to -1 / w, the rows of render target are stored from top to bottom.
+	 */
+	template<typename DepthRenderTarget, typename Decoder>
+	void Downsample(const DepthRenderTarget& depth, const Decoder& decode);
+
+	/**
+	 * @brief Build the coarse levels from the finest one, call it after the finest level is written.
+	 */
+	void BuildHierarchy();
+
+	/**
+	 * @brief Determines whether the bounding box is behind the occluders, `mvp` is the clip matrix of the space the box is in.
+	 *        The projected box is tested against at most 2 x 2 texels of the level it fits in.
+	 */
+	warn_nodiscard bool IsOccluded(const BoundingVolume& volume, const Matrix& mvp) const;
+};
+
+
+
+#ifndef OCCLUSIONBUFFER_HPP_OCCLUSIONBUFFER_IMPL
+#define OCCLUSIONBUFFER_HPP_OCCLUSIONBUFFER_IMPL
+
+	template<typename DepthRenderTarget, typename Decoder>
+	void OcclusionBuffer::Downsample(const DepthRenderTarget& depth, const Decoder& decode)
+	{
+		const int width = depth.Width();
+		const int height = depth.Height();
+		float* target = levels[0].data();
+		Concurrency::parallel_for(0, HEIGHT, [&, target, width, height](const int& y)
+		{
+			// The pixels overlapping the texel, y-axis up.
+			const int y0 = y * height / HEIGHT;
+			const int y1 = ((y + 1) * height + HEIGHT - 1) / HEIGHT - 1;
+			for (int x = 0; x < WIDTH; ++x)
+			{
+				const int x0 = x * width / WIDTH;
+				const int x1 = ((x + 1) * width + WIDTH - 1) / WIDTH - 1;
+
+				float farthest = Number::FLOAT_INF;
+				for (int py = y0; py <= y1; ++py)
+				{
+					const int row = (height - py - 1) * width;
+					for (int px = x0; px <= x1; ++px)
+					{
+						farthest = std::min(farthest, decode(depth.GetPixel(row + px)));
+					}
+				}
+				target[y * WIDTH + x] = farthest;
+			}
+		});
+	}
+
+#endif // !OCCLUSIONBUFFER_HPP_OCCLUSIONBUFFER_IMPL
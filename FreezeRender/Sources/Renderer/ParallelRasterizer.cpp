@@ -2,7 +2,14 @@
 #include <Algorithm/KahanSummation.hpp>
 #include <Utility/RunnableTask.hpp>
 #include <Utility/Singleton.hpp>
+#include <Shader/BrdfLut.hpp>
 #include <ppl.h>
+#include <array>
+#include <span>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <atomic>
 
 
 
@@ -13,31 +20,374 @@ inline namespace ParallelRaster
 	{
 		static constexpr const bool bEnableVertexShader = false;
 		static constexpr const bool bEnableHomogeneousClipping = true;
+		static constexpr const bool bEnableGuardBandClipping = bEnableHomogeneousClipping;
+		static constexpr const bool bEnableFarPlaneClipping = true;
+		static constexpr const bool bEnableFrustumCulling = !bEnableVertexShader;
 		static constexpr const bool bEnableBackFaceCulling = true;
+		static constexpr const bool bEnableConeCulling = bEnableBackFaceCulling && !bEnableVertexShader;
+		static constexpr const bool bEnableOcclusionCulling = !bEnableVertexShader;
+		static constexpr const bool bEnableLevelOfDetail = !bEnableVertexShader;
 		static constexpr const bool bEnableAdaptiveHalfSpaceRaster = true;
+		static constexpr const bool bEnableSmallTriangleRaster = true;
 	}
 
 
 	// Used only for clipping.
 	namespace Clipping
 	{
-		ShadingTriangle gClippingTriangleBuffer[8];
-		ShadingVertex gClippingVertexBuffer[16];
+		// Up to 7 planes, each one adds at most one vertex, and two buffers are used alternately.
+		constexpr const static int CLIPPING_TRIANGLE_NUM = 8;
+		constexpr const static int CLIPPING_VERTEX_NUM = 20;
 		constexpr const static float CLIPPING_PLANE = -0.000001f;
+
+		// The maximum absolute screen coordinate of triangle skipping x/y clipping.
+		constexpr const static float GUARD_BAND_LIMIT = HalfSpaceRaster::GUARD_BAND_LIMIT;
+
+		// The outcode of vertex in homogeneous clip space.
+		enum Outcode : int
+		{
+			OUT_LEFT         = 1 << 0,
+			OUT_RIGHT        = 1 << 1,
+			OUT_BOTTOM       = 1 << 2,
+			OUT_TOP          = 1 << 3,
+			OUT_NEAR         = 1 << 4,
+			OUT_FAR          = 1 << 5,
+			OUT_W            = 1 << 6,
+			OUT_GUARD_LEFT   = 1 << 7,
+			OUT_GUARD_RIGHT  = 1 << 8,
+			OUT_GUARD_BOTTOM = 1 << 9,
+			OUT_GUARD_TOP    = 1 << 10,
+
+			OUT_VIEWPORT     = OUT_LEFT | OUT_RIGHT | OUT_BOTTOM | OUT_TOP | OUT_NEAR | OUT_FAR | OUT_W,
+			OUT_GUARD_BAND   = OUT_GUARD_LEFT | OUT_GUARD_RIGHT | OUT_GUARD_BOTTOM | OUT_GUARD_TOP,
+		};
+
+		/**
+		 * @brief Computes outcode of vertex before perspective division, `guardX` and `guardY` are the guard band size in NDC.
+		 */
+		force_inline int ComputeOutcode(const Vector4& position, const float& guardX, const float& guardY)
+		{
+			// Look at -z, the canonical view volume is |x| <= -w, |y| <= -w, |z| <= -w.
+			const float w = -position.w;
+			return
+				(position.x < -w) * OUT_LEFT | (position.x > w) * OUT_RIGHT |
+				(position.y < -w) * OUT_BOTTOM | (position.y > w) * OUT_TOP |
+				(position.z < -w) * OUT_NEAR | (position.z > w) * OUT_FAR |
+				(position.w > CLIPPING_PLANE) * OUT_W |
+				(position.x < -w * guardX) * OUT_GUARD_LEFT | (position.x > w * guardX) * OUT_GUARD_RIGHT |
+				(position.y < -w * guardY) * OUT_GUARD_BOTTOM | (position.y > w * guardY) * OUT_GUARD_TOP;
+		}
+	}
+
+
+	// Used only for culling.
+	namespace Culling
+	{
+		// The simplification error of selected level projects to at most one pixel.
+		constexpr const static float LOD_PIXEL_ERROR = 1.f;
+
+		/**
+		 * @brief The radius of projected bounding sphere in pixels, `eye` is the camera position in local space and `lodScale` is
+		 *        half the viewport height times the vertical projection scale. The camera inside the sphere gets infinity.
+		 */
+		force_inline float ProjectedRadius(const BoundingVolume& bounds, const Vector3& eye, const float& lodScale)
+		{
+			const float distanceSquared = (bounds.center - eye).LengthSquared() - bounds.radius * bounds.radius;
+			return distanceSquared > 0.f ? bounds.radius * lodScale / std::sqrt(distanceSquared) : Number::FLOAT_INF;
+		}
+
+		/**
+		 * @brief Determines whether the transform flips the triangle winding.
+		 */
+		force_inline bool IsMirrored(const Matrix& transform)
+		{
+			const auto& m = transform.m;
+			const float determinant =
+				m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+				m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+				m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+			return determinant < 0.f;
+		}
+	}
+
+
+	// Used only for geometry process.
+	namespace Geometry
+	{
+		// The number of clusters transformed in parallel at once, before they are fed to batched setup in order.
+		constexpr const static unsigned int CLUSTER_CHUNK_SIZE = 256;
+
+		/**
+		 * @brief The state of one draw shared by its clusters, a draw is one instance of a mesh.
+		 */
+		struct DrawState
+		{
+			Matrix mvp;
+			Matrix mv;
+			Matrix invMV;
+
+			// The view frustum in local space.
+			Frustum frustum;
+
+			// The camera position in local space.
+			Vector3 eye;
+
+			Meshlet* mesh;
+
+			// The selected level of detail.
+			const MeshletLod* lod;
+
+			// The visible set of the instance in temporal mode, `MeshletCluster::bVisible` is used if it is null.
+			unsigned char* visibility;
+
+			// The index of instance in mesh, zero if the mesh has no instances.
+			unsigned int instance;
+
+			// The range of cluster records.
+			unsigned int firstRecord;
+			unsigned int recordNum;
+
+			// The statistics of the draw, summed up after geometry process.
+			unsigned int frustumCulledClusterNum;
+			unsigned int coneCulledTriangleNum;
+			unsigned int occlusionCulledClusterNum;
+			unsigned int occlusionCulledTriangleNum;
+
+			Frustum::Containment containment;
+			bool bConeCulling;
+			bool bOccluded;
+		};
+
+		/**
+		 * @brief The cluster passing culling.
+		 */
+		struct ClusterRecord
+		{
+			const DrawState* draw;
+			MeshletCluster* cluster;
+			unsigned int clusterIndex;
+
+			// The cluster is inside view frustum and needs no clipping.
+			bool bInsideFrustum;
+		};
+
+		/**
+		 * @brief Mark the cluster of the draw as visible or not for the next frame.
+		 */
+		force_inline void SetClusterVisible(const DrawState& draw, MeshletCluster& cluster, const unsigned int& clusterIndex, const bool& bVisible)
+		{
+			if (draw.visibility)
+			{
+				draw.visibility[clusterIndex] = bVisible ? 1 : 0;
+			}
+			else
+			{
+				cluster.bVisible = bVisible;
+			}
+		}
+	}
+
+
+	// Used only for depth testing.
+	namespace Depth
+	{
+		/**
+		 * @brief The conversion between interpolated 1 / w and the value stored in depth buffer.
+		 *        Every format keeps the closer pixel with greater value, so the depth test is shared.
+		 *        The 4-pixels value is compared in float, and it is computed in the same way as the single pixel one,
+		 *        so that the equal depth test of visibility phase always matches the depth-only phase.
+		 */
+		template<typename DepthTraits>
+		struct Codec;
+
+		/**
+		 * @brief w in float.
+		 */
+		template<>
+		struct Codec<DepthPixelTraits>
+		{
+			using Type = DepthPixelTraits::Type;
+
+			template<typename FrameContext>
+			explicit Codec(const FrameContext&) {}
+
+			force_inline Type Encode(const R128& zInverseAndInterpolation) const { return 1.f / RegisterGetX(zInverseAndInterpolation); }
+
+			force_inline float Decode(const Type& depth) const { return -1.f / depth; }
+
+			force_inline R128 Encode4(const R128& zInverse) const { return RegisterDivide(Number::R_ONE, zInverse); }
+
+			force_inline R128 Load4(const Type* data) const { return RegisterLoad(data); }
+
+			force_inline void Store4(Type* data, const R128& depth) const { RegisterStore(depth, data); }
+		};
+
+		/**
+		 * @brief -1 / w in float, no reciprocal per pixel.
+		 */
+		template<>
+		struct Codec<ReverseDepthPixelTraits>
+		{
+			using Type = ReverseDepthPixelTraits::Type;
+
+			template<typename FrameContext>
+			explicit Codec(const FrameContext&) {}
+
+			force_inline Type Encode(const R128& zInverseAndInterpolation) const { return -RegisterGetX(zInverseAndInterpolation); }
+
+			force_inline float Decode(const Type& depth) const { return depth; }
+
+			force_inline R128 Encode4(const R128& zInverse) const { return RegisterNegate(zInverse); }
+
+			force_inline R128 Load4(const Type* data) const { return RegisterLoad(data); }
+
+			force_inline void Store4(Type* data, const R128& depth) const { RegisterStore(depth, data); }
+		};
+
+		/**
+		 * @brief -1 / w in 16-bits unorm, 0 is reserved for the cleared pixel.
+		 */
+		template<>
+		struct Codec<Depth16PixelTraits>
+		{
+			using Type = Depth16PixelTraits::Type;
+
+			R128 scale;
+			R128 bias;
+
+			template<typename FrameContext>
+			explicit Codec(const FrameContext& frame)
+				: scale(MakeRegister(frame.depthScale))
+				, bias(MakeRegister(frame.depthBias))
+			{}
+
+			/**
+			 * @brief Computes the mapping from [1 / far, 1 / near] of -1 / w to [1, 65535].
+			 */
+			static void Setup(const ViewState& viewState, float& outScale, float& outBias)
+			{
+				const float range = 65534.f / (1.f / viewState.nearPlane - 1.f / viewState.farPlane);
+				outScale = -range;
+				outBias = 1.f - range / viewState.farPlane;
+			}
+
+			force_inline Type Encode(const R128& zInverseAndInterpolation) const
+			{
+				return static_cast<Type>(_mm_cvtss_si32(Clamp(RegisterMultiplyAdd(zInverseAndInterpolation, scale, bias))));
+			}
+
+			/**
+			 * @brief Returns -1 / w, rounded down by half a step so that it is never closer than the encoded one.
+			 */
+			force_inline float Decode(const Type& depth) const
+			{
+				return depth == 0 ? 0.f : std::max((RegisterGetX(bias) - depth + 0.5f) / RegisterGetX(scale), 0.f);
+			}
+
+			force_inline R128 Encode4(const R128& zInverse) const
+			{
+				return _mm_round_ps(Clamp(RegisterMultiplyAdd(zInverse, scale, bias)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			}
+
+			force_inline R128 Load4(const Type* data) const
+			{
+				return _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64((const R128i*)data)));
+			}
+
+			force_inline void Store4(Type* data, const R128& depth) const
+			{
+				const R128i value = _mm_cvtps_epi32(depth);
+				_mm_storel_epi64((R128i*)data, _mm_packus_epi32(value, value));
+			}
+
+		private:
+			static force_inline R128 Clamp(const R128& value)
+			{
+				return RegisterMin(RegisterMax(value, MakeRegister(1.f)), MakeRegister(65535.f));
+			}
+		};
+	}
+
+
+	// Used only for worklist compaction.
+	namespace Compaction
+	{
+		/**
+		 * @brief Lane table of stream compaction, indexed by 8-bit coverage mask.
+		 *        The lane of n-th covered pixel is stored in bits [4n, 4n + 4).
+		 */
+		constexpr std::array<unsigned int, 256> MakeLaneTable()
+		{
+			std::array<unsigned int, 256> table = {};
+			for (unsigned int mask = 0; mask < 256; ++mask)
+			{
+				unsigned int packed = 0, number = 0;
+				for (unsigned int lane = 0; lane < 8; ++lane)
+				{
+					if (mask & (1u << lane))
+					{
+						packed |= lane << (4 * number++);
+					}
+				}
+				table[mask] = packed;
+			}
+			return table;
+		}
+
+		constexpr const std::array<unsigned int, 256> LANE_TABLE = MakeLaneTable();
+
+		/**
+		 * @brief Writes the screen index of covered pixels in [base, base + 8) to `output` continuously, without branch.
+		 * @return        The number of written indices.
+		 */
+		force_inline int Compress8(const unsigned int& mask, const int& base, int* output)
+		{
+			const R256i R_LANE_SHIFT = MakeRegister8Integer(0, 4, 8, 12, 16, 20, 24, 28);
+			const R256i R_LANE_ORDER = MakeRegister8Integer(0, 1, 2, 3, 4, 5, 6, 7);
+			const int number = std::popcount(mask);
+
+			R256i lanes = _mm256_srlv_epi32(MakeRegister8Integer(LANE_TABLE[mask]), R_LANE_SHIFT);
+			lanes = _mm256_and_si256(lanes, MakeRegister8Integer(0xF));
+
+			// Only the first `number` lanes are stored, so neighbouring chunks are never touched.
+			const R256i indices = _mm256_add_epi32(lanes, MakeRegister8Integer(base));
+			const R256i store = _mm256_cmpgt_epi32(MakeRegister8Integer(number), R_LANE_ORDER);
+			Register8IntegerMaskStore(indices, store, output);
+			return number;
+		}
+
+		// The number of pixels processed at once, stale spans of a tagged render target are skipped as a whole.
+		constexpr const int SPAN = 64;
+
+		/**
+		 * @brief Determines whether the span starting at given pixel may contain covered pixels.
+		 */
+		template<typename RenderTarget>
+		force_inline bool MaybeCovered(const RenderTarget& materialid, const int& index)
+		{
+			if constexpr (RenderTarget::bLazyClear)
+			{
+				static_assert(RenderTarget::spanSize == SPAN, "[FreezeRender] span size mismatch!");
+				return materialid.IsFresh(index / SPAN);
+			}
+			else
+			{
+				return true;
+			}
+		}
 	}
 
 
 	/**
-	* @brief The Async task to clear or re-allocate render target.
+	* @brief The Async task to clear or re-allocate render target, the tagged render target is skipped since it is cleared lazily.
 	*/
 	class DoubleBufferingTask final : public Singleton<DoubleBufferingTask>, TinyRunnableTask
 	{
 		// background render target.
 		struct
 		{
-			MaterialIdBufferRenderTarget materialid { 2, 2 };
-			DepthRenderTarget depth { 2, 2 };
-			ColorRenderTarget scene { 2, 2 };
+			VisibilityMaterialIdRenderTarget materialid { 2, 2 };
+			SceneRenderTarget scene { 2, 2 };
 		} background;
 
 		std::atomic<int> width = 2;
@@ -47,6 +397,11 @@ inline namespace ParallelRaster
 		template<typename RenderTarget>
 		force_inline void ResizeOrReallocate(RenderTarget& target, const int& width, const int& height)
 		{
+			if constexpr (RenderTarget::bLazyClear)
+			{
+				return;
+			}
+
 			if (target.Width() != width || target.Height() != height)
 			{
 				target.Resize(width, height);
@@ -60,24 +415,44 @@ inline namespace ParallelRaster
 		template<typename RenderTarget>
 		force_inline void TryResize(RenderTarget& target, const int& width, const int& height)
 		{
+			if constexpr (RenderTarget::bLazyClear)
+			{
+				return;
+			}
+
 			if (target.Width() != width || target.Height() != height)
 			{
 				target.Resize(width, height);
 			}
 		}
 
-		force_inline void Sync(VisibilityBuffer* VBuffer, GeometryBuffer* GBuffer, ColorRenderTarget* scene)
+		template<typename RenderTarget>
+		force_inline void SwapOrClear(RenderTarget& target, RenderTarget& backgroundTarget)
 		{
-			VBuffer->materialid.Swap(background.materialid);
-			GBuffer->depth.Swap(background.depth);
-			scene->Swap(background.scene);
+			if constexpr (RenderTarget::bLazyClear)
+			{
+				target.Clear();
+			}
+			else
+			{
+				target.Swap(backgroundTarget);
+			}
+		}
+
+		template<typename GeometryBuffer>
+		force_inline void Sync(VisibilityBuffer* VBuffer, GeometryBuffer* GBuffer, SceneRenderTarget* scene)
+		{
+			// Every format of depth is cleared lazily.
+			static_assert(decltype(GBuffer->depth)::bLazyClear, "[FreezeRender] depth must be cleared lazily!");
+			SwapOrClear(VBuffer->materialid, background.materialid);
+			GBuffer->depth.Clear();
+			SwapOrClear(*scene, background.scene);
 		}
 
 		force_inline void TryWork(const int& width, const int& height)
 		{
-			auto& [materialid, depth, scene] = background;
+			auto& [materialid, scene] = background;
 			TryResize(materialid, width, height);
-			TryResize(depth, width, height);
 			TryResize(scene, width, height);
 		}
 
@@ -87,16 +462,16 @@ inline namespace ParallelRaster
 			const int width = this->width.load(std::memory_order::consume);
 			const int height = this->height.load(std::memory_order::consume);
 				
-			auto& [materialid, depth, scene] = background;
+			auto& [materialid, scene] = background;
 			ResizeOrReallocate(materialid, width, height);
-			ResizeOrReallocate(depth, width, height);
 			ResizeOrReallocate(scene, width, height);
 		}
 
 	public:
 		DoubleBufferingTask(Token) { Start(); }
 
-		void TrySync(VisibilityBuffer* VBuffer, GeometryBuffer* GBuffer, ColorRenderTarget* scene)
+		template<typename GeometryBuffer>
+		void TrySync(VisibilityBuffer* VBuffer, GeometryBuffer* GBuffer, SceneRenderTarget* scene)
 		{
 			if (nullptr == VBuffer || nullptr == GBuffer)
 				return;
@@ -125,146 +500,706 @@ inline namespace ParallelRaster
 
 
 
-ParallelRasterizer::ParallelRasterizer(int inWidth, int inHeight)
+template<typename DepthTraits>
+ParallelRasterizer<DepthTraits>::ParallelRasterizer(int inWidth, int inHeight)
 	: width(inWidth)
 	, height(inHeight)
 	, VBuffer(inWidth, inHeight)
-	, WBuffer(inWidth, inHeight)
-	, GBuffer(inWidth, inHeight)
-	, scene(inWidth, inHeight)
+	, frameIndex(0)
+	, presentIndex(0)
 {
+	frames.push_back(std::make_unique<FrameContext>(inWidth, inHeight));
+
+	// Integrated in parallel before the first frame, not lazily by a shading task.
+	Shader::BrdfLut::Instance();
 }
 
-void ParallelRasterizer::Resize(int inWidth, int inHeight)
+template<typename DepthTraits>
+ParallelRasterizer<DepthTraits>::~ParallelRasterizer()
 {
+	WaitFramesInFlight();
+}
+
+template<typename DepthTraits>
+void ParallelRasterizer<DepthTraits>::Resize(int inWidth, int inHeight)
+{
+	WaitFramesInFlight();
+
 	width = inWidth;
 	height = inHeight;
 	VBuffer.Resize(inWidth, inHeight);
-	WBuffer.Resize(inWidth, inHeight);
-	GBuffer.Resize(inWidth, inHeight);
-	scene.Resize(inWidth, inHeight);
+	for (auto& frame : frames)
+	{
+		frame->Resize(inWidth, inHeight);
+	}
 }
 
-ColorRenderTarget& ParallelRasterizer::Draw()
+template<typename DepthTraits>
+void ParallelRasterizer<DepthTraits>::SetFramesInFlight(int number)
 {
-	PrePass();
-	BasePass();
+	WaitFramesInFlight();
+
+	// The frame presented last is kept in the first slot, which is submitted next.
+	std::swap(frames[0], frames[presentIndex]);
 
-	return scene;
+	number = std::clamp(number, 1, MAX_FRAMES_IN_FLIGHT);
+	frames.resize(number);
+	for (auto& frame : frames)
+	{
+		if (!frame)
+		{
+			frame = std::make_unique<FrameContext>(width, height);
+		}
+		RetireFrame(*frame);
+	}
+
+	// The other slots are presented before they are rendered once, they show the last frame again rather than a blank or older one.
+	for (size_t index = 1; index < frames.size(); ++index)
+	{
+		std::copy_n(frames[0]->scene.Begin(), width * height, frames[index]->scene.Begin());
+	}
+	frameIndex = 0;
+	presentIndex = 0;
 }
 
-void ParallelRasterizer::PrePass()
+template<typename DepthTraits>
+ColorRenderTarget& ParallelRasterizer<DepthTraits>::Draw()
 {
+	auto SystemAllocations = [this]() -> unsigned long long
+	{
+		unsigned long long number = 0;
+		for (const auto& frame : frames)
+		{
+			number += frame->frameArena.SystemAllocations();
+		}
+		return number;
+	};
+
+	const unsigned long long systemAllocations = SystemAllocations();
+	FrameContext& frame = *frames[frameIndex];
+	FrameContext* present = &frame;
+
+	// Take the snapshot of scene states, the shading of this frame is isolated from the later frames.
+	frame.shading.wait();
+	frame.viewState = viewStateBuffer;
+	frame.pointLights = pointLightBuffer;
+	frame.environment = environment;
+	frame.shadowMode = shadowMode;
+	frame.bAmbientOcclusion = bAmbientOcclusion;
+
+	PrePass(frame);
+
+	if (frames.size() == 1)
+	{
+		BasePass(frame);
+
+		// Fill the pixels not covered in this frame.
+		frame.scene.Resolve();
+	}
+	else
+	{
+		// Shade this frame in background, overlapped with the geometry process of the next frame.
+		frame.shading.run([this, &frame]()
+		{
+			BasePass(frame);
+			frame.scene.Resolve();
+		});
+
+		// Present the oldest frame in flight.
+		frameIndex = (frameIndex + 1) % frames.size();
+		presentIndex = frameIndex;
+		present = frames[frameIndex].get();
+		present->shading.wait();
+	}
+
+	statistics.shadingTime = present->shadingTime;
+	statistics.ambientOcclusionTime = present->ambientOcclusionTime;
+	statistics.shadowRayNum = present->shadowRayNum;
+	RetireFrame(*present);
+	statistics.arenaSystemAllocations = SystemAllocations() - systemAllocations;
+	statistics.arenaReservedBytes = 0;
+	for (const auto& frame : frames)
+	{
+		statistics.arenaReservedBytes += frame->frameArena.ReservedBytes();
+	}
+
+	return present->scene;
+}
+
+template<typename DepthTraits>
+void ParallelRasterizer<DepthTraits>::WaitFramesInFlight()
+{
+	for (auto& frame : frames)
+	{
+		frame->shading.wait();
+	}
+}
+
+template<typename DepthTraits>
+void ParallelRasterizer<DepthTraits>::RetireFrame(FrameContext& frame)
+{
+	frame.WBuffer.Clear();
+	frame.frameArena.Reset();
+
+	// The shadow maps and the scene hierarchy only held by the rasterizer are updated in place.
+	frame.shadowMap.Invalidate();
+	frame.sceneBvh = SceneBvh();
+}
+
+template<typename DepthTraits>
+void ParallelRasterizer<DepthTraits>::PrePass(FrameContext& frame)
+{
+	WorklistBuffer& WBuffer = frame.WBuffer;
+	GeometryBuffer& GBuffer = frame.GBuffer;
+	FrameArena& frameArena = frame.frameArena;
+	const ViewState& viewState = frame.viewState;
+
 	// Clear last frame.
-	DoubleBufferingTask::Instance()->TrySync(&VBuffer, &GBuffer, &scene);
+	DoubleBufferingTask::Instance()->TrySync(&VBuffer, &GBuffer, &frame.scene);
 	WBuffer.Clear();
+	frame.deferredTriangles.Clear();
+	if constexpr (std::is_same_v<DepthTraits, Depth16PixelTraits>)
+	{
+		Depth::Codec<DepthTraits>::Setup(viewState, frame.depthScale, frame.depthBias);
+	}
 
 	//****************************************************************
 	// stage 1: Geometry process.
 	//****************************************************************
 	using namespace Clipping;
+	using namespace Culling;
+	using namespace Geometry;
 
-	const Matrix& projection = viewStateBuffer.projection;
-	const Matrix& view = viewStateBuffer.view;
-	const Matrix vp = projection * view;
-	const float ndc2screen1 = (viewStateBuffer.farPlane - viewStateBuffer.nearPlane) / 2.f;
-	const float ndc2screen2 = (viewStateBuffer.farPlane + viewStateBuffer.nearPlane) / 2.f;
+	ShadingTriangle* clippingTriangles = frameArena.Allocate<ShadingTriangle>(CLIPPING_TRIANGLE_NUM);
+	ShadingVertex* clippingVertices = frameArena.Allocate<ShadingVertex>(CLIPPING_VERTEX_NUM);
 
+	const Matrix& projection = viewState.projection;
+	const Matrix& view = viewState.view;
+	const Matrix vp = projection * view;
+	const float ndc2screen1 = (viewState.farPlane - viewState.nearPlane) / 2.f;
+	const float ndc2screen2 = (viewState.farPlane + viewState.nearPlane) / 2.f;
+	const float lodScale = 0.5f * viewState.resolutionY * std::fabs(projection.m[1][1]);
+	statistics.instanceNum = 0;
+	statistics.frustumCulledInstanceNum = 0;
+	statistics.sceneUpdateTime = 0.f;
+	statistics.sceneRefittedInstanceNum = 0;
+	statistics.clusterNum = 0;
+	statistics.frustumCulledClusterNum = 0;
+	statistics.triangleNum = 0;
+	statistics.lodTriangleNum = 0;
+	statistics.coneCulledTriangleNum = 0;
+	statistics.occlusionCulledClusterNum = 0;
+	statistics.occlusionCulledTriangleNum = 0;
+	statistics.occluderTriangleNum = 0;
+	statistics.reusedClusterNum = 0;
+	statistics.clippedTriangleNum = 0;
+	statistics.guardBandTriangleNum = 0;
+	statistics.deferredTriangleNum = 0;
+
+	// Every draw is one instance of a mesh, the mesh without instances is drawn once by its own transform.
+	unsigned int drawNum = 0;
 	for (auto& mesh : meshBuffer)
 	{
-		if (!mesh.IsValid())
+		if (mesh.IsValid())
 		{
-			continue;
+			// The mesh which is not created by loader.
+			if (mesh.clusters.empty())
+			{
+				mesh.BuildClusters();
+			}
+			drawNum += mesh.GetInstanceNum();
 		}
+	}
+
+	DrawState* draws = frameArena.Allocate<DrawState>(drawNum);
+	{
+		DrawState* draw = draws;
+		for (auto& mesh : meshBuffer)
+		{
+			const unsigned int instanceNum = mesh.IsValid() ? mesh.GetInstanceNum() : 0;
+			for (unsigned int instance = 0; instance < instanceNum; ++instance, ++draw)
+			{
+				draw->mesh = &mesh;
+				draw->instance = instance;
+				draw->containment = Config::bEnableFrustumCulling ? Frustum::Containment::Outside : Frustum::Containment::Intersecting;
+			}
+		}
+	}
+
+	// The primitives of scene hierarchy follow the order of draws.
+	sceneBvh.Update(meshBuffer);
+	statistics.sceneUpdateTime = sceneBvh.GetUpdateTime();
+	statistics.sceneRefittedInstanceNum = sceneBvh.GetRefittedPrimitiveNum();
+
+	// The hierarchies of meshes are only rebuilt when their geometry changes.
+	if (frame.shadowMode == ShadowMode::RayTraced)
+	{
+		sceneBvh.BuildMeshHierarchies();
+		frame.sceneBvh = sceneBvh;
+	}
+
+	// The shadow maps are cached while neither the lights nor the instances move.
+	statistics.shadowMapTime = 0.f;
+	statistics.shadowMapFaceNum = 0;
+	if (frame.shadowMode == ShadowMode::ShadowMaps)
+	{
+		shadowMap.Update(meshBuffer, sceneBvh, frame.pointLights, sceneBvh.IsRebuilt() || sceneBvh.GetRefittedPrimitiveNum() > 0);
+		statistics.shadowMapTime = shadowMap.GetUpdateTime();
+		statistics.shadowMapFaceNum = shadowMap.GetRenderedFaceNum();
+		frame.shadowMap = shadowMap;
+	}
+	else
+	{
+		shadowMap.Invalidate();
+	}
 
-		const Matrix mvp = vp * mesh.transform;
-		const Matrix mv = view * mesh.transform;
-		const Matrix invMV = mv.Inverse().Transpose();
+	// Hierarchical frustum culling in world space, the draws not visited stay outside.
+	if constexpr (Config::bEnableFrustumCulling)
+	{
+		sceneBvh.CullFrustum(Frustum::FromMatrix(vp), [draws](const unsigned int& primitive, const Frustum::Containment& containment)
+		{
+			draws[primitive].containment = containment;
+		});
+	}
 
-		for (ShadingMeshletIterator It(mesh); It; ++It)
+	// Occlusion culling against the occluders rasterized in low resolution.
+	bool bOcclusionTest = false;
+	if constexpr (Config::bEnableOcclusionCulling)
+	{
+		if (occlusionMode == OcclusionMode::Occluders)
 		{
-			// Init triangle.
-			ShadingTriangle triangle = It.Assembly();
+			bOcclusionTest = RasterizeOccluders(vp);
+			statistics.occluderTriangleNum = occlusionBuffer.GetTriangleNum();
+		}
+	}
+
+	// Temporal occlusion culling renders the clusters visible in last frame at first,
+	// then the others are tested against the depth of the first phase, and only the newly visible ones are rendered.
+	const bool bTemporalOcclusion = Config::bEnableOcclusionCulling && occlusionMode == OcclusionMode::Temporal;
+	const int phaseNum = bTemporalOcclusion ? 2 : 1;
 
-			// Disable vertex shader during compilation.
-			if constexpr (Config::bEnableVertexShader)
+	// The transform, level of detail and mesh level culling of every draw.
+	Concurrency::parallel_for(0u, drawNum, [&](const unsigned int& drawIndex)
+	{
+		DrawState& draw = draws[drawIndex];
+		Meshlet& mesh = *draw.mesh;
+		draw.visibility = nullptr;
+		draw.recordNum = 0;
+		draw.frustumCulledClusterNum = 0;
+		draw.coneCulledTriangleNum = 0;
+		draw.occlusionCulledClusterNum = 0;
+		draw.occlusionCulledTriangleNum = 0;
+		const Matrix model = mesh.GetInstanceTransform(draw.instance);
+		draw.eye = model.Inverse() * viewState.location;
+
+		// The level of detail by the projected bounding sphere, measured in local space so a uniform scale cancels out.
+		draw.lod = Config::bEnableLevelOfDetail ? &mesh.SelectLod(ProjectedRadius(mesh.bounds, draw.eye, lodScale), LOD_PIXEL_ERROR) : &mesh.lods[0];
+
+		// The draw culled by scene hierarchy only counts its level of detail.
+		if (draw.containment == Frustum::Containment::Outside)
+		{
+			draw.bOccluded = false;
+			return;
+		}
+
+		draw.mvp = vp * model;
+		draw.mv = view * model;
+		draw.invMV = draw.mv.Inverse().Transpose();
+
+		// Normal cone culling in local space, the winding is flipped by a mirrored transform.
+		draw.bConeCulling = Config::bEnableConeCulling && !IsMirrored(model);
+
+		// The world box of hierarchy is looser than the local one, so the draw crossing the frustum is tested again in local space.
+		draw.frustum = Frustum::FromMatrix(draw.mvp);
+		if (draw.containment == Frustum::Containment::Intersecting && Config::bEnableFrustumCulling)
+		{
+			draw.containment = draw.frustum.Test(mesh.bounds);
+		}
+		draw.bOccluded = draw.containment != Frustum::Containment::Outside && bOcclusionTest && occlusionBuffer.IsOccluded(mesh.bounds, draw.mvp);
+
+		// The instances keep their own visible set, the mesh drawn once keeps it in clusters.
+		if (bTemporalOcclusion && !mesh.instances.empty())
+		{
+			std::vector<unsigned char>& visibleClusters = mesh.instances[draw.instance].visibleClusters;
+			visibleClusters.resize(mesh.clusters.size(), 1);
+			draw.visibility = visibleClusters.data();
+		}
+	});
+
+	// Reserve the cluster records of every visible draw.
+	unsigned int recordCapacity = 0;
+	for (unsigned int drawIndex = 0; drawIndex < drawNum; ++drawIndex)
+	{
+		DrawState& draw = draws[drawIndex];
+		const MeshletLod& lod = *draw.lod;
+		statistics.clusterNum += lod.clusterNum;
+		statistics.triangleNum += draw.mesh->lods[0].indexNum / 3;
+		statistics.lodTriangleNum += lod.indexNum / 3;
+
+		draw.firstRecord = recordCapacity;
+		if (draw.containment == Frustum::Containment::Outside)
+		{
+			++statistics.frustumCulledInstanceNum;
+			statistics.frustumCulledClusterNum += lod.clusterNum;
+		}
+		else if (draw.bOccluded)
+		{
+			statistics.occlusionCulledClusterNum += lod.clusterNum;
+			statistics.occlusionCulledTriangleNum += lod.indexNum / 3;
+		}
+		else
+		{
+			recordCapacity += lod.clusterNum;
+		}
+	}
+	statistics.instanceNum = drawNum;
+
+	// The triangles of clusters transformed in parallel, every cluster owns a slot of fixed size.
+	TriangleBatch& batch = frame.triangles;
+	ShadingTriangle* transformedTriangles = static_cast<ShadingTriangle*>(frameArena.Allocate(
+		sizeof(ShadingTriangle) * CLUSTER_CHUNK_SIZE * Meshlet::CLUSTER_TRIANGLE_NUM, alignof(ShadingTriangle)));
+
+	// Model-View-Projection, the vertex shader runs before it.
+	auto TransformTriangle = [this](ShadingTriangle& triangle, const DrawState& draw)
+	{
+		// Disable vertex shader during compilation.
+		if constexpr (Config::bEnableVertexShader)
+		{
+			// execute vertex shader.
+			vertexShader({ triangle, draw.mv, draw.invMV, draw.mvp });
+		}
+
+		triangle.vertices[0].screenspace.position = draw.mvp * triangle.vertices[0].screenspace.position;
+		triangle.vertices[1].screenspace.position = draw.mvp * triangle.vertices[1].screenspace.position;
+		triangle.vertices[2].screenspace.position = draw.mvp * triangle.vertices[2].screenspace.position;
+	};
+
+	// From homogeneous clip space to screen space and view space.
+	auto ProjectTriangle = [this, ndc2screen1, ndc2screen2](ShadingTriangle& triangle, const DrawState& draw)
+	{
+		for (ShadingVertex& vertex : triangle.vertices)
+		{
+			Vector4& position = vertex.screenspace.position;
+			Vector3& location = vertex.viewspace.position;
+			Vector3& normal = vertex.viewspace.normal;
+
+			// Perspective division.
+			// homogeneous clip space to normalized device coordinates(NDC) space.
+			position.x /= position.w;
+			position.y /= position.w;
+			position.z /= position.w;
+
+			// Viewport transformation (screen mapping).
+			// NDC-space to screen space, y-axis up.
+			position.x = 0.5f * width * (position.x + 1.f);
+			position.y = 0.5f * height * (position.y + 1.f);
+			position.z = position.z * ndc2screen1 + ndc2screen2;
+
+			// view transformation.
+			// local space to view space.
+			location = draw.mv * location;
+			normal = (draw.invMV * Vector4(normal, 0.f)).XYZ().Normalize();
+		}
+
+		triangle.material = &draw.mesh->materials[0];
+		triangle.instance = draw.instance;
+	};
+
+	// The clusters rendered by the first phase, tested again by the complete depth for the next frame.
+	ClusterRecord* reusedRecords = nullptr;
+	unsigned int reusedRecordNum = 0;
+
+	for (int phase = 0; phase < phaseNum; ++phase)
+	{
+		if (phase == 1)
+		{
+			SetupTriangles(frame);
+			BuildDepthOcclusion(frame);
+		}
+
+		// Cluster culling of every draw in parallel, the records of a draw are written into its own range.
+		const bool bFirstPhase = phase == 0;
+		ClusterRecord* records = frameArena.Allocate<ClusterRecord>(recordCapacity);
+		Concurrency::parallel_for(0u, drawNum, [&, records, bFirstPhase](const unsigned int& drawIndex)
+		{
+			DrawState& draw = draws[drawIndex];
+			draw.recordNum = 0;
+			if (draw.containment == Frustum::Containment::Outside || draw.bOccluded)
 			{
-				// execute vertex shader.
-				vertexShader({ triangle, mv, invMV, mvp });
+				return;
 			}
 
-			// Model-View-Projection.
-			triangle.vertices[0].screenspace.position = mvp * triangle.vertices[0].screenspace.position;
-			triangle.vertices[1].screenspace.position = mvp * triangle.vertices[1].screenspace.position;
-			triangle.vertices[2].screenspace.position = mvp * triangle.vertices[2].screenspace.position;
+			const MeshletLod& lod = *draw.lod;
+			MeshletCluster* const clusters = draw.mesh->clusters.data();
+			for (unsigned int clusterIndex = lod.firstCluster; clusterIndex < lod.firstCluster + lod.clusterNum; ++clusterIndex)
+			{
+				MeshletCluster& cluster = clusters[clusterIndex];
+				Frustum::Containment containment = draw.containment;
+				if (Config::bEnableFrustumCulling && containment == Frustum::Containment::Intersecting)
+				{
+					containment = draw.frustum.Test(cluster.bounds);
+				}
+
+				if (containment == Frustum::Containment::Outside)
+				{
+					draw.frustumCulledClusterNum += bFirstPhase ? 1 : 0;
+					continue;
+				}
 
-			// Homogeneous clip.
-			int triangleNum = 0;
-			HomogeneousClipping(triangle, gClippingTriangleBuffer, triangleNum);
+				if (draw.bConeCulling && cluster.IsBackFacing(draw.eye))
+				{
+					draw.coneCulledTriangleNum += bFirstPhase ? cluster.indexNum / 3 : 0;
+					continue;
+				}
 
-			while (triangleNum --> 0)
+				if (bTemporalOcclusion)
+				{
+					// The first phase renders the visible set of last frame, the second phase tests the others.
+					const bool bVisible = draw.visibility ? draw.visibility[clusterIndex] != 0 : cluster.bVisible;
+					if (bVisible != bFirstPhase)
+					{
+						continue;
+					}
+
+					if (!bFirstPhase && occlusionBuffer.IsOccluded(cluster.bounds, draw.mvp))
+					{
+						++draw.occlusionCulledClusterNum;
+						draw.occlusionCulledTriangleNum += cluster.indexNum / 3;
+						continue;
+					}
+					SetClusterVisible(draw, cluster, clusterIndex, true);
+				}
+				else if (bOcclusionTest && occlusionBuffer.IsOccluded(cluster.bounds, draw.mvp))
+				{
+					++draw.occlusionCulledClusterNum;
+					draw.occlusionCulledTriangleNum += cluster.indexNum / 3;
+					continue;
+				}
+
+				records[draw.firstRecord + draw.recordNum++] = { &draw, &cluster, clusterIndex, containment == Frustum::Containment::Inside };
+			}
+		});
+
+		// Compact the records in the order of draws, so the raster order is independent of scheduling.
+		unsigned int recordNum = 0;
+		for (unsigned int drawIndex = 0; drawIndex < drawNum; ++drawIndex)
+		{
+			const DrawState& draw = draws[drawIndex];
+			for (unsigned int index = 0; index < draw.recordNum; ++index)
 			{
-				ShadingTriangle& clippedTriangle = gClippingTriangleBuffer[triangleNum];
-				for (ShadingVertex& vertex : clippedTriangle.vertices)
+				records[recordNum++] = records[draw.firstRecord + index];
+			}
+		}
+
+		if (bTemporalOcclusion && bFirstPhase)
+		{
+			reusedRecords = records;
+			reusedRecordNum = recordNum;
+		}
+
+		for (unsigned int chunkBegin = 0; chunkBegin < recordNum; chunkBegin += CLUSTER_CHUNK_SIZE)
+		{
+			const unsigned int chunkEnd = std::min(chunkBegin + CLUSTER_CHUNK_SIZE, recordNum);
+
+			// The clusters inside view frustum need no clipping, they are transformed in parallel.
+			Concurrency::parallel_for(chunkBegin, chunkEnd, [&, records, chunkBegin](const unsigned int& recordIndex)
+			{
+				const ClusterRecord& record = records[recordIndex];
+				if (!record.bInsideFrustum)
 				{
-					Vector4& position = vertex.screenspace.position;
-					Vector3& location = vertex.viewspace.position;
-					Vector3& normal = vertex.viewspace.normal;
-
-					// Perspective division.
-					// homogeneous clip space to normalized device coordinates(NDC) space.
-					position.x /= position.w;
-					position.y /= position.w;
-					position.z /= position.w;
-
-					// Viewport transformation (screen mapping).
-					// NDC-space to screen space, y-axis up.
-					position.x = 0.5f * width * (position.x + 1.f);
-					position.y = 0.5f * height * (position.y + 1.f);
-					position.z = position.z * ndc2screen1 + ndc2screen2;
-
-					// view transformation.
-					// local space to view space.
-					location = mv * location;
-					normal = (invMV * Vector4(normal, 0.f)).XYZ().Normalize();
+					return;
 				}
 
-				if (BackFaceCulling(clippedTriangle))
+				ShadingTriangle* triangle = transformedTriangles + (recordIndex - chunkBegin) * Meshlet::CLUSTER_TRIANGLE_NUM;
+				for (ShadingMeshletIterator It(*record.draw->mesh, *record.cluster); It; ++It, ++triangle)
 				{
+					*triangle = It.Assembly();
+					TransformTriangle(*triangle, *record.draw);
+					ProjectTriangle(*triangle, *record.draw);
+				}
+			});
+
+			// Feed the triangles to batched setup in order, the clusters crossing view frustum are clipped here.
+			for (unsigned int recordIndex = chunkBegin; recordIndex < chunkEnd; ++recordIndex)
+			{
+				const ClusterRecord& record = records[recordIndex];
+				const DrawState& draw = *record.draw;
+				if (record.bInsideFrustum)
+				{
+					const ShadingTriangle* triangles = transformedTriangles + (recordIndex - chunkBegin) * Meshlet::CLUSTER_TRIANGLE_NUM;
+					for (unsigned int index = 0; index < record.cluster->indexNum / 3; ++index)
+					{
+						batch.triangles[batch.number] = triangles[index];
+						if (++batch.number == TriangleBatch::capacity)
+						{
+							SetupTriangles(frame);
+						}
+					}
 					continue;
 				}
 
-				clippedTriangle.material = &mesh.materials[0];
-				RasterizeTriangle(clippedTriangle);
+				for (ShadingMeshletIterator It(*draw.mesh, *record.cluster); It; ++It)
+				{
+					// Init triangle in the free slot of batch, the clipped triangles are copied back.
+					ShadingTriangle& triangle = batch.triangles[batch.number];
+					triangle = It.Assembly();
+					TransformTriangle(triangle, draw);
+
+					// Homogeneous clip.
+					int triangleNum = 0;
+					HomogeneousClipping(triangle, clippingVertices, clippingTriangles, triangleNum);
+					while (triangleNum --> 0)
+					{
+						ShadingTriangle& clippedTriangle = clippingTriangles[triangleNum];
+						ProjectTriangle(clippedTriangle, draw);
+
+						// Back face culling is done by batched setup.
+						batch.triangles[batch.number] = clippedTriangle;
+						if (++batch.number == TriangleBatch::capacity)
+						{
+							SetupTriangles(frame);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// The rest of triangles.
+	SetupTriangles(frame);
+
+	for (unsigned int drawIndex = 0; drawIndex < drawNum; ++drawIndex)
+	{
+		const DrawState& draw = draws[drawIndex];
+		statistics.frustumCulledClusterNum += draw.frustumCulledClusterNum;
+		statistics.coneCulledTriangleNum += draw.coneCulledTriangleNum;
+		statistics.occlusionCulledClusterNum += draw.occlusionCulledClusterNum;
+		statistics.occlusionCulledTriangleNum += draw.occlusionCulledTriangleNum;
+	}
+
+	// The visible set of next frame, the cluster rendered by the first phase is dropped if it is hidden in the complete depth.
+	if (bTemporalOcclusion)
+	{
+		BuildDepthOcclusion(frame);
+		Concurrency::parallel_for(0u, reusedRecordNum, [&](const unsigned int& index)
+		{
+			const ClusterRecord& record = reusedRecords[index];
+			SetClusterVisible(*record.draw, *record.cluster, record.clusterIndex, !occlusionBuffer.IsOccluded(record.cluster->bounds, record.draw->mvp));
+		});
+		statistics.reusedClusterNum = reusedRecordNum;
+	}
+
+	// The visibility phase of depth prepass, the depth buffer is complete, so every pixel writes visibility once.
+	if (bDepthPrepass)
+	{
+		for (DeferredTriangleList::Block* block = frame.deferredTriangles.head; block; block = block->next)
+		{
+			for (int index = 0; index < block->number; ++index)
+			{
+				const DeferredTriangleList::Record& record = block->records[index];
+				record.bSmall ?
+					RasterizeSmallTriangle<RasterPass::Visibility>(frame, record.triangle, record.setup) :
+					RasterizeTriangle<RasterPass::Visibility>(frame, record.triangle, record.setup);
 			}
 		}
+		statistics.deferredTriangleNum = frame.deferredTriangles.number;
 	}
 
 	//****************************************************************
 	// stage 2: Triangle setup.
 	//****************************************************************
-	const int count = width * height;
-	for (int i = 0; i < count; ++i)
 	{
-		// Triangle Traversal.
-		if (VBuffer.materialid.GetPixel(i))
+		using namespace Compaction;
+
+		static_assert(WorklistBuffer::chunkSize % SPAN == 0, "[FreezeRender] chunk size must be a multiple of span!");
+
+		const int count = width * height;
+		const int chunkNum = WorklistBuffer::ChunkNum(width, height);
+		const auto& materialidTarget = VBuffer.materialid;
+		const Material* const* materialid = materialidTarget.Begin();
+		unsigned int* chunkOffsets = frameArena.Allocate<unsigned int>(chunkNum + 1);
+		WBuffer.chunkOffsets = chunkOffsets;
+
+		// Count covered pixels of every chunk.
+		Concurrency::parallel_for(0, chunkNum, [=, &materialidTarget](const int& chunk)
 		{
-			WBuffer.Push(VBuffer, i);
+			const int begin = chunk * WorklistBuffer::chunkSize;
+			const int end = std::min(begin + WorklistBuffer::chunkSize, count);
+
+			unsigned int number = 0;
+			for (int span = begin; span < end; span += SPAN)
+			{
+				if (!MaybeCovered(materialidTarget, span))
+				{
+					continue;
+				}
+
+				const int spanEnd = std::min(span + SPAN, end);
+				int i = span;
+				for (; i + 8 <= spanEnd; i += 8)
+				{
+					number += std::popcount(Register8PointerMaskBits((const void* const*)(materialid + i)));
+				}
+				for (; i < spanEnd; ++i)
+				{
+					number += materialid[i] != nullptr;
+				}
+			}
+			chunkOffsets[chunk + 1] = number;
+		});
+
+		// Prefix sum, `chunkOffsets[i]` is the first worklist index of i-th chunk.
+		chunkOffsets[0] = 0;
+		for (int chunk = 1; chunk <= chunkNum; ++chunk)
+		{
+			chunkOffsets[chunk] += chunkOffsets[chunk - 1];
 		}
+		WBuffer.number = chunkOffsets[chunkNum];
+
+		// Scatter the screen index of covered pixels, one more for the speculative write of tail.
+		int* screen = frameArena.Allocate<int>(WBuffer.number + 1ull);
+		WBuffer.screen = screen;
+		Concurrency::parallel_for(0, chunkNum, [=, &materialidTarget](const int& chunk)
+		{
+			const int begin = chunk * WorklistBuffer::chunkSize;
+			const int end = std::min(begin + WorklistBuffer::chunkSize, count);
+
+			int* output = screen + chunkOffsets[chunk];
+			for (int span = begin; span < end; span += SPAN)
+			{
+				if (!MaybeCovered(materialidTarget, span))
+				{
+					continue;
+				}
+
+				const int spanEnd = std::min(span + SPAN, end);
+				int i = span;
+				for (; i + 8 <= spanEnd; i += 8)
+				{
+					output += Compress8(Register8PointerMaskBits((const void* const*)(materialid + i)), i, output);
+				}
+				// The tail only exists in the last span of the last chunk, so the speculative write never lands in another chunk.
+				for (; i < spanEnd; ++i)
+				{
+					*output = i;
+					output += materialid[i] != nullptr;
+				}
+			}
+		});
 	}
 
 	//****************************************************************
 	// stage 3: Generate geometry buffer.
 	//****************************************************************
-	Concurrency::parallel_for(0u, WBuffer.number, [this](const unsigned int& worklistIndex)
+	Concurrency::parallel_for(0u, WBuffer.number, [this, &WBuffer, &GBuffer](const unsigned int& worklistIndex)
 	{
-		const int& screenIndex = WBuffer.screen.GetPixel(worklistIndex);
-		auto& interpolation = WBuffer.interpolation.GetPixel(worklistIndex);
+		const int& screenIndex = WBuffer.screen[worklistIndex];
+		auto& interpolation = VBuffer.interpolation.GetPixel(screenIndex);
 
 		R256 result;
-		const R256 attr1 = Register8LoadAligned(&WBuffer.vertex1.GetPixel(worklistIndex));
-		const R256 attr2 = Register8LoadAligned(&WBuffer.vertex2.GetPixel(worklistIndex));
-		const R256 attr3 = Register8LoadAligned(&WBuffer.vertex3.GetPixel(worklistIndex));
+		const R256 attr1 = Register8LoadAligned(&VBuffer.vertex1.GetPixel(screenIndex));
+		const R256 attr2 = Register8LoadAligned(&VBuffer.vertex2.GetPixel(screenIndex));
+		const R256 attr3 = Register8LoadAligned(&VBuffer.vertex3.GetPixel(screenIndex));
 		const R256 depth = MakeRegister8(1.f / interpolation.oneOverDepth);
 		const R256 alpha = MakeRegister8(interpolation.alpha);
 		const R256 beta = MakeRegister8(interpolation.beta);
@@ -276,312 +1211,338 @@ void ParallelRasterizer::PrePass()
 		ShadingPoint point;
 		Register8StoreAligned(result, &point);
 
-		const Color diffuseColor = WBuffer.materialid.GetPixel(worklistIndex)->Diffuse()->Sample(point.uv);
-		GBuffer.position.SetPixel(screenIndex, { point.position, 0.f });
-		GBuffer.normal.SetPixel(screenIndex, { point.normal, 0.f });
+		const Material* material = VBuffer.materialid.GetPixel(screenIndex);
+		const MaterialParameters& parameters = material->Parameters();
+		const Color diffuseColor = material->Diffuse()->Sample(point.uv);
+		GBuffer.position.SetPixel(screenIndex, { point.position, parameters.metallic });
+		GBuffer.normal.SetPixel(screenIndex, { point.normal, parameters.roughness });
 		GBuffer.diffuse.SetPixel(screenIndex, diffuseColor);
 	});
 }
 
-void ParallelRasterizer::BasePass()
+template<typename DepthTraits>
+void ParallelRasterizer<DepthTraits>::BasePass(FrameContext& frame)
 {
 	//****************************************************************
 	// stage 4: Parallel shading.
 	//****************************************************************
-	Concurrency::parallel_for(0u, WBuffer.number, [this](const unsigned int& worklistIndex)
+	const auto start = std::chrono::steady_clock::now();
+	frame.shadowRayNum = 0;
+
+	// The ambient visibility is gathered from the geometry buffer before any pixel is shaded.
+	frame.ambientOcclusionTime = 0.f;
+	if (frame.bAmbientOcclusion)
+	{
+		const Depth::Codec<DepthTraits> codec(frame);
+		frame.ambientOcclusion.Render(frame.GBuffer.depth, [&codec](const auto& depth) -> float
+		{
+			return codec.Decode(depth);
+		}, frame.GBuffer.position, frame.viewState.projection);
+		frame.ambientOcclusionTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+	// The geometry buffer is in view space, the lights are moved to view space for shading,
+	// the shadow rays are traced, the shadow maps and the environment are sampled in world space.
+	const Matrix inverseView = frame.viewState.view.Inverse();
+	std::vector<PointLight> viewPointLights = frame.pointLights;
+	for (PointLight& perLight : viewPointLights)
+	{
+		perLight.location = (frame.viewState.view * Vector4(perLight.location, 1.f)).XYZ();
+	}
+
+	// The worklist is in scanline order, every 4 adjacent covered pixels are shaded in SIMD and trace one shadow packet per light.
+	const bool bShadows = frame.shadowMode != ShadowMode::Disabled && !frame.pointLights.empty();
+	const unsigned int tileNum = (frame.WBuffer.number + SHADING_TILE_SIZE - 1) / SHADING_TILE_SIZE;
+	std::atomic<unsigned long long> shadowRayNum = 0;
+	Concurrency::parallel_for(0u, tileNum, [this, &frame, &inverseView, &viewPointLights, &bShadows, &shadowRayNum](const unsigned int& tile)
 	{
-		const int& screenIndex = WBuffer.screen.GetPixel(worklistIndex);
-		Shader::DeferredFragmentPayload payload;
+		const GeometryBuffer& GBuffer = frame.GBuffer;
+		const unsigned int begin = tile * SHADING_TILE_SIZE;
+		const unsigned int end = std::min(begin + SHADING_TILE_SIZE, frame.WBuffer.number);
+		const int lightNum = static_cast<int>(std::min<size_t>(frame.pointLights.size(), ShadowMap::LIGHT_NUM));
+		unsigned long long rayNum = 0;
+
+		for (unsigned int worklistIndex = begin; worklistIndex < end; worklistIndex += 4)
+		{
+			Shader::DeferredFragmentPayload payloads[4];
+			Vector3 points[4], normals[4];
+			float visibility[4][ShadowMap::LIGHT_NUM];
+			int bits = 0;
+			for (int lane = 0; lane < 4 && worklistIndex + lane < end; ++lane)
+			{
+				const int& screenIndex = frame.WBuffer.screen[worklistIndex + lane];
+				const Vector4& position = GBuffer.position.GetPixel(screenIndex);
+				const Vector4& normal = GBuffer.normal.GetPixel(screenIndex);
+				Shader::DeferredFragmentPayload& payload = payloads[lane];
+				payload.pointlights = &viewPointLights;
+				payload.viewpoint = Vector3::Zero;
+				payload.shadingpoint = position.XYZRef();
+				payload.normal = normal.XYZRef();
+				payload.diffuse = GBuffer.diffuse.GetPixel(screenIndex);
+				payload.metallic = position.w;
+				payload.roughness = normal.w;
+				payload.ambientOcclusion = frame.bAmbientOcclusion ? frame.ambientOcclusion.GetVisibility(screenIndex) : 1.f;
+				payload.environment = frame.environment.get();
+				payload.environmentTransform = &inverseView;
+				bits |= 1 << lane;
+
+				if (bShadows)
+				{
+					points[lane] = (inverseView * Vector4(payload.shadingpoint, 1.f)).XYZ();
+					normals[lane] = (inverseView * Vector4(payload.normal, 0.f)).XYZ();
+				}
+				if (bShadows && frame.shadowMode == ShadowMode::ShadowMaps)
+				{
+					for (int lightIndex = 0; lightIndex < lightNum; ++lightIndex)
+					{
+						visibility[lane][lightIndex] = frame.shadowMap.SampleVisibility(lightIndex, points[lane], normals[lane]);
+					}
+					payload.lightVisibility = visibility[lane];
+				}
+			}
 
-		payload.pointlights = &pointLightBuffer;
-		payload.viewpoint = viewStateBuffer.location;
-		payload.shadingpoint = GBuffer.position.GetPixel(screenIndex).XYZRef();
-		payload.normal = GBuffer.normal.GetPixel(screenIndex).XYZRef();
-		payload.diffuse = GBuffer.diffuse.GetPixel(screenIndex);
+			if (bShadows && frame.shadowMode == ShadowMode::RayTraced)
+			{
+				unsigned int shadowMasks[4];
+				rayNum += frame.sceneBvh.OccludedLights(points, normals, bits, frame.pointLights, shadowMasks);
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					payloads[lane].shadowMask = bits & (1 << lane) ? shadowMasks[lane] : 0;
+				}
+			}
 
-		// execute fragment shader.
-		scene.SetPixel(screenIndex, fragmentShader(payload));
+			// execute fragment shader.
+			Color colors[4];
+			fragmentShader(payloads, bits, colors);
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				if (bits & (1 << lane))
+				{
+					frame.scene.SetPixel(frame.WBuffer.screen[worklistIndex + lane], colors[lane]);
+				}
+			}
+		}
+		shadowRayNum += rayNum;
 	});
+	frame.shadowRayNum = shadowRayNum.load();
+	frame.shadingTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
-void ParallelRasterizer::RasterizeTriangle(const ShadingTriangle& triangle)
+template<typename DepthTraits>
+template<RasterPass pass>
+struct ParallelRasterizer<DepthTraits>::RasterTarget
 {
-	// [ Mileff P, Nehz K, Dudra J. 2015, "Accelerated Half-Space Triangle Rasterization" ]
-    // Detail see http://acta.uni-obuda.hu//Mileff_Nehez_Dudra_63.pdf
-	enum class Strategy : unsigned char
+	ParallelRasterizer& rasterizer;
+	GeometryBuffer& GBuffer;
+	const Depth::Codec<DepthTraits> codec;
+	const ShadingTriangle& triangle;
+	const R128 i;
+	const R128 invZ;
+
+	// [ 0, d(1 / depth) / dx, 2 * d(1 / depth) / dx, 3 * d(1 / depth) / dx ]
+	const R128 zInverseStep4;
+
+	RasterTarget(ParallelRasterizer& rasterizer, FrameContext& frame, const ShadingTriangle& triangle, const TriangleSetup& setup)
+		: rasterizer(rasterizer)
+		, GBuffer(frame.GBuffer)
+		, codec(frame)
+		, triangle(triangle)
+		, i(setup.i)
+		, invZ(setup.invZ)
+		, zInverseStep4(RegisterMultiply(RegisterReplicate(setup.i, 0), MakeRegister(0.f, 1.f, 2.f, 3.f)))
 	{
-		HalfSpace,      // half-space rasterization
-		BlockHalfSpace, // Block-base half-space rasterization.
-	};
-
-	constexpr static const R128 R_HALF_SPACE_EPSILON = Number::MakeRegister(-1e-4f);
-
-	const auto&& [ v1, v2, v3 ] = triangle.ScreenspacePosition();
-	const auto&& [ l1, l2, l3 ] = triangle.ViewspacePosition();
-	const auto&& [ n1, n2, n3 ] = triangle.ViewspaceNormal();
-	const auto&& [ uv1, uv2, uv3 ] = triangle.LocalspaceUV();
-
-	const auto&& [ minx, maxx, miny, maxy ] = triangle.BoundingBox(width, height);
-	R128 startx = MakeRegister(minx + 0.5f);
-	R128 starty = MakeRegister(miny + 0.5f);
-
-	R128 v123x = MakeRegister(1.f, v1.x, v2.x, v3.x);
-	R128 v123y = MakeRegister(1.f, v1.y, v2.y, v3.y);
-	R128 v231x = RegisterSwizzle(v123x, 0, 2, 3, 1);
-	R128 v231y = RegisterSwizzle(v123y, 0, 2, 3, 1);
-	R128 v312w = MakeRegister(1.f, v3.w, v1.w, v2.w);
-
-	R128 i = RegisterSubtract(v123y, v231y);
-	R128 j = RegisterSubtract(v231x, v123x);
-	R128 k = RegisterSubtract(RegisterMultiply(v123x, v231y), RegisterMultiply(v123y, v231x));
+	}
 
-	// iteration-based (2 * area / depth).
+	// The rows of render targets are top to bottom.
+	force_inline int Row(const int& y) const
 	{
-		R128 i0 = RegisterSum4(RegisterDivide(i, v312w));
-		R128 j0 = RegisterSum4(RegisterDivide(j, v312w));
-		R128 k0 = RegisterSum4(RegisterDivide(k, v312w));
+		return (rasterizer.height - y - 1) * rasterizer.width;
+	}
 
-		i = RegisterSelect(Number::R_XMASK, i0, i);
-		j = RegisterSelect(Number::R_XMASK, j0, j);
-		k = RegisterSelect(Number::R_XMASK, k0, k);
+	force_inline void TouchPixels(const int& first, const int& last)
+	{
+		GBuffer.depth.TouchRange(first, last);
+		if constexpr (pass != RasterPass::DepthOnly)
+		{
+			rasterizer.VBuffer.materialid.TouchRange(first, last);
+		}
 	}
 
-	// iterator.
-	const R128 invZ = MakeRegister(1.f, 1.f / v3.w, 1.f / v1.w, 1.f / v2.w);
-	R128 f = RegisterAdd(RegisterMultiplyAddMultiply(i, startx, j, starty), k);
+	force_inline bool TestPixel(const int& index, const R128& zInverseAndInterpolation)
 	{
-		const R128 invArea2 = RegisterDivide(Number::R_ONE, MakeRegister(RegisterSum(RegisterSetX0(f))));
-		
-		// [ 1 / depth, gamma, alpha, beta ]
-		f = RegisterMultiply(f, invArea2);
+		// (1 / depth, gamma, alpha, beta )
+		const auto depth = codec.Encode(zInverseAndInterpolation);
 
-		// f[ d(1 / depth) / dx, d(gamma) / dx, d(alpha) / dx, d(beta) / dx ]
-		i = RegisterMultiply(i, invArea2);
+		// Equal depth testing, the first triangle wins the tie as the depth test of single pass does.
+		if constexpr (pass == RasterPass::Visibility)
+		{
+			if (GBuffer.depth.GetTouchedPixel(index) != depth || rasterizer.VBuffer.materialid.GetTouchedPixel(index) != nullptr)
+			{
+				return false;
+			}
+			rasterizer.VBuffer.SetPixel(index, triangle, RegisterMultiply(zInverseAndInterpolation, invZ));
+			return true;
+		}
 
-		// [ d(1 / depth) / dy, d(gamma) / dy, d(alpha) / dy, d(beta) / dy ]
-		j = RegisterMultiply(j, invArea2);
+		// Z-depth testing.
+		auto& depthData = GBuffer.depth.GetTouchedPixel(index);
+		if (!(depthData < depth))
+		{
+			return false;
+		}
+
+		depthData = depth;
+		if constexpr (pass == RasterPass::DepthAndVisibility)
+		{
+			rasterizer.VBuffer.SetPixel(index, triangle, RegisterMultiply(zInverseAndInterpolation, invZ));
+		}
+		return true;
 	}
 
-	if constexpr (Config::bEnableAdaptiveHalfSpaceRaster)
+	force_inline bool TestPixels4(const int& index, const R128& zInverseAndInterpolation, const int& covered = 0xf)
 	{
-		constexpr static const int block = 4;
-		const int boxX = (maxx - minx);
-		const int boxY = (maxy - miny);
-		const float cost = boxX * 1.f / boxY;
-
-		const bool adapt = cost > 0.40f && cost < 1.60f;
-		const bool small = boxX < block && boxY < block;
+		auto* depthData = &GBuffer.depth.GetTouchedPixel(index);
+		bool bVisible = false;
 
-		Strategy strategy = false ? Strategy::HalfSpace : Strategy::BlockHalfSpace;
-		if (strategy == Strategy::HalfSpace)
+		const R128 depth = codec.Encode4(RegisterAdd(RegisterReplicate(zInverseAndInterpolation, 0), zInverseStep4));
+		const R128 oldDepth = codec.Load4(depthData);
+		int mask = 0;
+		if constexpr (pass == RasterPass::Visibility)
 		{
-			R128 cy = f;
-			for (int y = miny; y <= maxy; ++y)
+			// The depth is computed in the same way as the depth-only phase, the equal one is the closest.
+			mask = RegisterMaskBits(RegisterEQ(oldDepth, depth)) & covered;
+		}
+		else
+		{
+			const R128 closer = RegisterAnd(RegisterLT(oldDepth, depth), HalfSpaceRaster::MakeLaneMask(covered));
+			mask = RegisterMaskBits(closer);
+			if (mask)
 			{
-				R128 cx = cy;
-				for (int x = minx; x <= maxx; ++x)
-				{
-					// if cx[1] > 0 and cx[2] > 0 and cx[3] > 0
-					if ((RegisterMaskBits(RegisterGE(cx, R_HALF_SPACE_EPSILON)) & 0x0E) == 0x0E)
-					{
-						// (1 / depth, gamma, alpha, beta )
-						const R128& zInverseAndInterpolation = cx;
-						const float depth = 1.f / RegisterGetX(zInverseAndInterpolation);
-						const int index = (height - y - 1) * width + x;
-
-						// Z-depth testing.
-						if (GBuffer.depth.GetPixel(index) < depth)
-						{
-							GBuffer.depth.SetPixel(index, depth);
-							VBuffer.SetPixel(index, triangle, RegisterMultiply(zInverseAndInterpolation, invZ));
-						}
-					}
-					cx = RegisterAdd(cx, i);
-				}
-				cy = RegisterAdd(cy, j);
+				codec.Store4(depthData, RegisterSelect(closer, depth, oldDepth));
+				bVisible = true;
 			}
 		}
-		else
+
+		if constexpr (pass != RasterPass::DepthOnly)
 		{
-			constexpr static const R128 R_OFFSET_X = Number::MakeRegister(0.f, block - 1.f, 0.f, block - 1.f);
-			constexpr static const R128 R_OFFSET_Y = Number::MakeRegister(0.f, 0.f, block - 1.f, block - 1.f);
-			constexpr static const R128 R_MOVE_STEP4 = Number::MakeRegister((float)block);
-
-			const R128 repi1 = RegisterReplicate(i, 1);
-			const R128 repi2 = RegisterReplicate(i, 2);
-			const R128 repi3 = RegisterReplicate(i, 3);
-
-			const R128 repj1 = RegisterReplicate(j, 1);
-			const R128 repj2 = RegisterReplicate(j, 2);
-			const R128 repj3 = RegisterReplicate(j, 3);
-
-			const R128 offsetx1 = RegisterMultiply(repi1, R_OFFSET_X);
-			const R128 offsety1 = RegisterMultiply(repj1, R_OFFSET_Y);
-			const R128 offsetx2 = RegisterMultiply(repi2, R_OFFSET_X);
-			const R128 offsety2 = RegisterMultiply(repj2, R_OFFSET_Y);
-			const R128 offsetx3 = RegisterMultiply(repi3, R_OFFSET_X);
-			const R128 offsety3 = RegisterMultiply(repj3, R_OFFSET_Y);
-
-			const R128 movex = RegisterMultiply(i, R_MOVE_STEP4);
-			const R128 movey = RegisterMultiply(j, R_MOVE_STEP4);
-			const R128 movex1 = RegisterMultiply(repi1, R_MOVE_STEP4);
-			const R128 movey1 = RegisterMultiply(repj1, R_MOVE_STEP4);
-			const R128 movex2 = RegisterMultiply(repi2, R_MOVE_STEP4);
-			const R128 movey2 = RegisterMultiply(repj2, R_MOVE_STEP4);
-			const R128 movex3 = RegisterMultiply(repi3, R_MOVE_STEP4);
-			const R128 movey3 = RegisterMultiply(repj3, R_MOVE_STEP4);
-
-			R128 cy = f;
-			R128 cy1 = RegisterAdd(RegisterReplicate(f, 1), RegisterAdd(offsetx1, offsety1));
-			R128 cy2 = RegisterAdd(RegisterReplicate(f, 2), RegisterAdd(offsetx2, offsety2));
-			R128 cy3 = RegisterAdd(RegisterReplicate(f, 3), RegisterAdd(offsetx3, offsety3));
-
-			for (int y = miny; y <= maxy; y += block)
-			{
-				R128 cx = cy;
-				R128 cx1 = cy1;
-				R128 cx2 = cy2;
-				R128 cx3 = cy3;
-				for (int x = minx; x <= maxx; x += block)
+			for (; mask; mask &= mask - 1)
+			{
+				const int lane = std::countr_zero(static_cast<unsigned int>(mask));
+				if constexpr (pass == RasterPass::Visibility)
 				{
-					const int checkw = RegisterMaskBits(RegisterGE(cx1, R_HALF_SPACE_EPSILON));
-					const int checku = RegisterMaskBits(RegisterGE(cx2, R_HALF_SPACE_EPSILON));
-					const int checkv = RegisterMaskBits(RegisterGE(cx3, R_HALF_SPACE_EPSILON));
-
-					// Fully outside.
-					if (checkw == 0x0 || checku == 0x0 || checkv == 0x0)
+					// The first triangle wins the tie, as the depth test of single pass does.
+					if (rasterizer.VBuffer.materialid.GetTouchedPixel(index + lane) != nullptr)
 					{
-						cx = RegisterAdd(cx, movex);
-						cx1 = RegisterAdd(cx1, movex1);
-						cx2 = RegisterAdd(cx2, movex2);
-						cx3 = RegisterAdd(cx3, movex3);
 						continue;
 					}
-
-					// Fully covered blocks.
-					if (checkw == 0xF && checku == 0xF && checkv == 0xF)
-					{
-						R128 cyb = cx;
-						for (int by = 0; by < block; ++by)
-						{
-							R128 cxb = cyb;
-							for (int bx = 0; bx < block; ++bx)
-							{
-								// (1 / depth, gamma, alpha, beta )
-								const R128& zInverseAndInterpolation = cxb;
-								const float depth = 1.f / RegisterGetX(zInverseAndInterpolation);
-								const int index = (height - (y + by) - 1) * width + (x + bx);
-
-								// Z-depth testing.
-								if (GBuffer.depth.GetPixel(index) < depth)
-								{
-									GBuffer.depth.SetPixel(index, depth);
-									VBuffer.SetPixel(index, triangle, RegisterMultiply(zInverseAndInterpolation, invZ));
-								}
-								cxb = RegisterAdd(cxb, i);
-							}
-							cyb = RegisterAdd(cyb, j);
-						}
-					}
-
-					// Partially covered blocks.
-					else
-					{
-						R128 cyb = cx;
-						for (int by = 0; by < block; ++by)
-						{
-							R128 cxb = cyb;
-							for (int bx = 0; bx < block; ++bx)
-							{
-								// if cx[1] > 0 and cx[2] > 0 and cx[3] > 0
-								if ((RegisterMaskBits(RegisterGE(cxb, R_HALF_SPACE_EPSILON)) & 0x0E) == 0x0E)
-								{
-									// (1 / depth, gamma, alpha, beta )
-									const R128& zInverseAndInterpolation = cxb;
-									const float depth = 1.f / RegisterGetX(zInverseAndInterpolation);
-									const int index = (height - (y + by) - 1) * width + (x + bx);
-
-									// Z-depth testing.
-									if (GBuffer.depth.GetPixel(index) < depth)
-									{
-										GBuffer.depth.SetPixel(index, depth);
-										VBuffer.SetPixel(index, triangle, RegisterMultiply(zInverseAndInterpolation, invZ));
-									}
-								}
-								cxb = RegisterAdd(cxb, i);
-							}
-							cyb = RegisterAdd(cyb, j);
-						}
-					}
-
-					cx = RegisterAdd(cx, movex);
-					cx1 = RegisterAdd(cx1, movex1);
-					cx2 = RegisterAdd(cx2, movex2);
-					cx3 = RegisterAdd(cx3, movex3);
+					bVisible = true;
 				}
 
-				cy = RegisterAdd(cy, movey);
-				cy1 = RegisterAdd(cy1, movey1);
-				cy2 = RegisterAdd(cy2, movey2);
-				cy3 = RegisterAdd(cy3, movey3);
+				const R128 lanePosition = RegisterAdd(zInverseAndInterpolation, RegisterMultiply(i, MakeRegister((float)lane)));
+				rasterizer.VBuffer.SetPixel(index + lane, triangle, RegisterMultiply(lanePosition, invZ));
 			}
 		}
+		return bVisible;
 	}
-	else
+};
+
+template<typename DepthTraits>
+template<RasterPass pass>
+bool ParallelRasterizer<DepthTraits>::RasterizeTriangle(FrameContext& frame, const ShadingTriangle& triangle, const TriangleSetup& setup)
+{
+	RasterTarget<pass> target(*this, frame, triangle, setup);
+	return HalfSpaceRaster::RasterizeTriangle<Config::bEnableAdaptiveHalfSpaceRaster>(target, setup);
+}
+
+template<typename DepthTraits>
+bool ParallelRasterizer<DepthTraits>::RasterizeOccluders(const Matrix& vp)
+{
+	occlusionBuffer.Clear();
+	for (const auto& mesh : meshBuffer)
 	{
-		R128 cy = f;
-		for (int y = miny; y <= maxy; ++y)
+		if (!mesh.bOccluder || !mesh.IsValid())
 		{
-			R128 cx = cy;
-			for (int x = minx; x <= maxx; ++x)
-			{
-				// if cx[1] > 0 and cx[2] > 0 and cx[3] > 0
-				if ((RegisterMaskBits(RegisterGE(cx, R_HALF_SPACE_EPSILON)) & 0x0E) == 0x0E)
-				{
-					// (1 / depth, gamma, alpha, beta )
-					const R128& zInverseAndInterpolation = cx;
-					const float depth = 1.f / RegisterGetX(zInverseAndInterpolation);
-					const int index = (height - y - 1) * width + x;
+			continue;
+		}
 
-					// Z-depth testing.
-					if (GBuffer.depth.GetPixel(index) < depth)
-					{
-						GBuffer.depth.SetPixel(index, depth);
-
-						// update VBuffer.
-						Register8Copy(&triangle.vertices[0], &VBuffer.vertex1.GetPixel(index));
-						Register8Copy(&triangle.vertices[1], &VBuffer.vertex2.GetPixel(index));
-						Register8Copy(&triangle.vertices[2], &VBuffer.vertex3.GetPixel(index));
-						RegisterStoreAligned(RegisterMultiply(zInverseAndInterpolation, invZ), &VBuffer.interpolation.GetPixel(index));
-						VBuffer.materialid.SetPixel(index, triangle.material);
-					}
-				}
-				cx = RegisterAdd(cx, i);
+		for (unsigned int instance = 0; instance < mesh.GetInstanceNum(); ++instance)
+		{
+			// The bounding volume is not built yet if the mesh is not created by loader.
+			const Matrix mvp = vp * mesh.GetInstanceTransform(instance);
+			if (mesh.clusters.empty() || Frustum::FromMatrix(mvp).Test(mesh.bounds) != Frustum::Containment::Outside)
+			{
+				occlusionBuffer.RasterizeOccluder(mesh, mvp);
 			}
-			cy = RegisterAdd(cy, j);
 		}
 	}
+
+	if (occlusionBuffer.GetTriangleNum() == 0)
+	{
+		return false;
+	}
+	occlusionBuffer.BuildHierarchy();
+	return true;
 }
 
-bool ParallelRasterizer::BackFaceCulling(const ShadingTriangle& triangle)
+template<typename DepthTraits>
+void ParallelRasterizer<DepthTraits>::BuildDepthOcclusion(FrameContext& frame)
 {
-	// Disable culling during compilation.
-	if constexpr (!Config::bEnableBackFaceCulling)
+	const Depth::Codec<DepthTraits> codec(frame);
+	occlusionBuffer.Downsample(frame.GBuffer.depth, [&codec](const auto& depth) -> float
 	{
-		return false;
+		return codec.Decode(depth);
+	});
+	occlusionBuffer.BuildHierarchy();
+}
+
+template<typename DepthTraits>
+void ParallelRasterizer<DepthTraits>::SetupTriangles(FrameContext& frame)
+{
+	TriangleBatch& batch = frame.triangles;
+	static_assert(TriangleBatch::capacity == HalfSpaceRaster::SETUP_LANE_NUM, "[FreezeRender] one triangle per lane of R256!");
+
+	R128 positions[3][TriangleBatch::capacity];
+	for (int lane = 0; lane < batch.number; ++lane)
+	{
+		for (int vertex = 0; vertex < 3; ++vertex)
+		{
+			positions[vertex][lane] = RegisterLoadAligned(&batch.triangles[lane].vertices[vertex].screenspace.position);
+		}
 	}
 
-	// Back face culling in screen space.
-	const Vector4& a = triangle.vertices[0].screenspace.position;
-	const Vector4& b = triangle.vertices[1].screenspace.position;
-	const Vector4& c = triangle.vertices[2].screenspace.position;
+	// The accepted triangles are sent to raster kernels in lane order.
+	auto Emit = [this, &frame, &batch](const int& lane, const TriangleSetup& setup, const bool& bSmallBox)
+	{
+		const ShadingTriangle& triangle = batch.triangles[lane];
+		const bool bSmall = Config::bEnableSmallTriangleRaster && bSmallBox;
+		if (!bDepthPrepass)
+		{
+			bSmall ? RasterizeSmallTriangle<RasterPass::DepthAndVisibility>(frame, triangle, setup) : RasterizeTriangle<RasterPass::DepthAndVisibility>(frame, triangle, setup);
+			return;
+		}
+
+		// The triangle failing all depth tests is hidden by the closer one, it never writes visibility.
+		if (bSmall ? RasterizeSmallTriangle<RasterPass::DepthOnly>(frame, triangle, setup) : RasterizeTriangle<RasterPass::DepthOnly>(frame, triangle, setup))
+		{
+			DeferredTriangleList::Record& record = frame.deferredTriangles.Append(frame.frameArena);
+			record.setup = setup;
+			record.triangle = triangle;
+			record.bSmall = bSmall;
+		}
+	};
+	HalfSpaceRaster::SetupTriangles<Config::bEnableBackFaceCulling, false>(positions, batch.number, width, height, Emit);
+	batch.number = 0;
+}
 
-	const Vector2 ab = b.XY() - a.XY();
-	const Vector2 ac = c.XY() - a.XY();
-	return (ab ^ ac) < 0;
+template<typename DepthTraits>
+template<RasterPass pass>
+bool ParallelRasterizer<DepthTraits>::RasterizeSmallTriangle(FrameContext& frame, const ShadingTriangle& triangle, const TriangleSetup& setup)
+{
+	RasterTarget<pass> target(*this, frame, triangle, setup);
+	return HalfSpaceRaster::RasterizeSmallTriangle(target, setup);
 }
 
-void ParallelRasterizer::HomogeneousClipping(const ShadingTriangle& triangle, ShadingTriangle* outTriangles, int& triangleNum)
+template<typename DepthTraits>
+void ParallelRasterizer<DepthTraits>::HomogeneousClipping(const ShadingTriangle& triangle, ShadingVertex* clippingVertices, ShadingTriangle* outTriangles, int& triangleNum)
 {
 	// refer to https://fabiensanglard.net/polygon_codec/
 	using namespace Clipping;
@@ -594,19 +1555,9 @@ void ParallelRasterizer::HomogeneousClipping(const ShadingTriangle& triangle, Sh
 		return;
 	}
 
-	// The function that determines whether triangle is in the canonical view volume,
-	// call it before perspective division.
-	auto PolygonVisible = [](const ShadingTriangle& triangle) -> bool
-	{
-		const Vector4& v1 = triangle.vertices[0].screenspace.position;
-		const Vector4& v2 = triangle.vertices[1].screenspace.position;
-		const Vector4& v3 = triangle.vertices[2].screenspace.position;
-
-		return
-			std::fabs(v1.x) <= -v1.w && std::fabs(v1.y) <= -v1.w && std::fabs(v1.z) <= -v1.w &&
-			std::fabs(v2.x) <= -v2.w && std::fabs(v2.y) <= -v2.w && std::fabs(v2.z) <= -v2.w &&
-			std::fabs(v3.x) <= -v3.w && std::fabs(v3.y) <= -v3.w && std::fabs(v3.z) <= -v3.w;
-	};
+	// The guard band in NDC, at least the viewport.
+	const float guardX = Config::bEnableGuardBandClipping ? std::max(1.f, 2.f * GUARD_BAND_LIMIT / width - 1.f) : 1.f;
+	const float guardY = Config::bEnableGuardBandClipping ? std::max(1.f, 2.f * GUARD_BAND_LIMIT / height - 1.f) : 1.f;
 
 	// The function that clip polygon in the `Axis-W` plane.
 	auto ClipPolygonForAxisW = [](int& inOutVertexNum, ShadingVertex* inVertices, ShadingVertex* outVertices) -> void
@@ -645,10 +1596,11 @@ void ParallelRasterizer::HomogeneousClipping(const ShadingTriangle& triangle, Sh
 
 	// The function that clip polygon in the `Axis` plane.
 	enum ClipAxis : unsigned int { X = 0, Y = 1, Z = 2, w = 3 };
-	auto ClipPolygonForAxis = [](ClipAxis&& axis, int&& sign, int& inOutVertexNum, ShadingVertex* inVertices, ShadingVertex* outVertices) -> void
+	auto ClipPolygonForAxis = [](ClipAxis&& axis, int&& sign, const float& scale, int& inOutVertexNum, ShadingVertex* inVertices, ShadingVertex* outVertices) -> void
 	{
 		// Clip against first plane if sign == 1
 		// Clip against opposite plane if sign == -1
+		// The plane is moved to guard band if scale > 1
 		if (inOutVertexNum <= 2) return;
 
 		int newVertexNum = 0;
@@ -660,8 +1612,8 @@ void ParallelRasterizer::HomogeneousClipping(const ShadingTriangle& triangle, Sh
 			const Vector4& position1 = vertex1->screenspace.position;
 			const Vector4& position2 = vertex2->screenspace.position;
 
-			const float& axis1W = position1.w;
-			const float& axis2W = position2.w;
+			const float axis1W = position1.w * scale;
+			const float axis2W = position2.w * scale;
 			const float& axis1 = *(&position1.x + axis) * sign;
 			const float& axis2 = *(&position2.x + axis) * sign;
 
@@ -687,18 +1639,41 @@ void ParallelRasterizer::HomogeneousClipping(const ShadingTriangle& triangle, Sh
 	};
 
 
+	const int outcode1 = ComputeOutcode(triangle.vertices[0].screenspace.position, guardX, guardY);
+	const int outcode2 = ComputeOutcode(triangle.vertices[1].screenspace.position, guardX, guardY);
+	const int outcode3 = ComputeOutcode(triangle.vertices[2].screenspace.position, guardX, guardY);
+	const int outcodeAny = outcode1 | outcode2 | outcode3;
+
+	// The planes producing new vertices, x and y inside the guard band are left to the bounding box and the edge tests.
+	constexpr static const int clipPlanes = Config::bEnableGuardBandClipping
+		? OUT_W | OUT_NEAR | (Config::bEnableFarPlaneClipping ? OUT_FAR : 0) | OUT_GUARD_BAND
+		: OUT_VIEWPORT;
+
 	// start to clip
-	if (PolygonVisible(triangle))
+	if ((outcodeAny & OUT_VIEWPORT) == 0)
 	{
 		// The triangle is in the canonical view volume completely.
 		outTriangles[0] = triangle;
 		triangleNum = 1;
 	}
+	else if ((outcode1 & outcode2 & outcode3) & OUT_VIEWPORT)
+	{
+		// All vertices are outside the same plane.
+		triangleNum = 0;
+	}
+	else if ((outcodeAny & clipPlanes) == 0)
+	{
+		// The triangle crosses the viewport but stays in the guard band.
+		outTriangles[0] = triangle;
+		triangleNum = 1;
+		++statistics.guardBandTriangleNum;
+	}
 	else
 	{
 		// Clip triangle.
-		ShadingVertex* vertices1 = gClippingVertexBuffer;
-		ShadingVertex* vertices2 = gClippingVertexBuffer + (sizeof(gClippingVertexBuffer) / sizeof(ShadingVertex) / 2);
+		++statistics.clippedTriangleNum;
+		ShadingVertex* vertices1 = clippingVertices;
+		ShadingVertex* vertices2 = clippingVertices + CLIPPING_VERTEX_NUM / 2;
 		int vertexNum = 0;
 
 		vertices1[vertexNum++] = triangle.vertices[0];
@@ -707,14 +1682,21 @@ void ParallelRasterizer::HomogeneousClipping(const ShadingTriangle& triangle, Sh
 
 		ClipPolygonForAxisW(vertexNum, vertices1, vertices2);
 
-		ClipPolygonForAxis(ClipAxis::X, +1, vertexNum, vertices2, vertices1);
-		ClipPolygonForAxis(ClipAxis::X, -1, vertexNum, vertices1, vertices2);
+		ClipPolygonForAxis(ClipAxis::X, +1, guardX, vertexNum, vertices2, vertices1);
+		ClipPolygonForAxis(ClipAxis::X, -1, guardX, vertexNum, vertices1, vertices2);
 
-		ClipPolygonForAxis(ClipAxis::Y, +1, vertexNum, vertices2, vertices1);
-		ClipPolygonForAxis(ClipAxis::Y, -1, vertexNum, vertices1, vertices2);
+		ClipPolygonForAxis(ClipAxis::Y, +1, guardY, vertexNum, vertices2, vertices1);
+		ClipPolygonForAxis(ClipAxis::Y, -1, guardY, vertexNum, vertices1, vertices2);
 
-		ClipPolygonForAxis(ClipAxis::Z, +1, vertexNum, vertices2, vertices1);
-		ClipPolygonForAxis(ClipAxis::Z, -1, vertexNum, vertices1, vertices2);
+		ClipPolygonForAxis(ClipAxis::Z, +1, 1.f, vertexNum, vertices2, vertices1);
+		if (Config::bEnableFarPlaneClipping || !Config::bEnableGuardBandClipping)
+		{
+			ClipPolygonForAxis(ClipAxis::Z, -1, 1.f, vertexNum, vertices1, vertices2);
+		}
+		else
+		{
+			std::swap(vertices1, vertices2);
+		}
 
 		// triangle assembly.
 		if (vertexNum >= 3)
@@ -730,4 +1712,10 @@ void ParallelRasterizer::HomogeneousClipping(const ShadingTriangle& triangle, Sh
 			triangleNum = 0;
 		}
 	}
-}
\ No newline at end of file
+}
+
+
+
+template class ParallelRasterizer<DepthPixelTraits>;
+template class ParallelRasterizer<ReverseDepthPixelTraits>;
+template class ParallelRasterizer<Depth16PixelTraits>;
\ No newline at end of file
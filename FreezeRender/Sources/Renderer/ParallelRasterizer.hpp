@@ -8,7 +8,29 @@
 #include <Core/Shadingon.hpp>
 #include <Shader/VertexShader.hpp>
 #include <Shader/FragmentShader.hpp>
+#include <Shader/EnvironmentLighting.hpp>
+#include <Renderer/OcclusionBuffer.hpp>
+#include <Renderer/SceneBvh.hpp>
+#include <Renderer/ShadowMap.hpp>
+#include <Renderer/AmbientOcclusion.hpp>
+#include <Renderer/HalfSpaceRaster.hpp>
+#include <Container/FrameArena.hpp>
 #include <vector>
+#include <memory>
+
+
+
+/**
+ * @brief The render targets cleared every frame.
+ *        A tagged render target is cleared lazily by epoch, a plain one is cleared by the background task.
+ */
+using VisibilityMaterialIdRenderTarget = TaggedMaterialIdBufferRenderTarget;
+
+// Never cleared, only valid where the material id is set.
+using VisibilityInstanceIdRenderTarget = InstanceIdBufferRenderTarget;
+template<typename DepthTraits>
+using GeometryDepthRenderTarget = TaggedRenderTarget<DepthTraits>;
+using SceneRenderTarget = ColorRenderTarget;
 
 
 
@@ -21,8 +43,8 @@ struct VisibilityBuffer
 	ShadingPointBufferRenderTarget vertex2;
 	ShadingPointBufferRenderTarget vertex3;
 	InterpolationBufferRenderTarget interpolation;
-	MaterialIdBufferRenderTarget materialid;
-	// TODO: MaterialID, InstanceID
+	VisibilityMaterialIdRenderTarget materialid;
+	VisibilityInstanceIdRenderTarget instanceid;
 
 	VisibilityBuffer(int width, int height)
 		: vertex1(width, height)
@@ -30,6 +52,7 @@ struct VisibilityBuffer
 		, vertex3(width, height)
 		, interpolation(width, height)
 		, materialid(width, height)
+		, instanceid(width, height)
 	{}
 
 	void Resize(int width, int height)
@@ -39,66 +62,69 @@ struct VisibilityBuffer
 		vertex3.Resize(width, height);
 		interpolation.Resize(width, height);
 		materialid.Resize(width, height);
+		instanceid.Resize(width, height);
 	}
 
+	// The span of material id is touched by the rasterizer before.
 	force_inline void SetPixel(const int& index, const ShadingTriangle& triangle, const R128& zInverseAndInterpolation)
 	{
 		Register8Copy(&triangle.vertices[0], &vertex1.GetPixel(index));
 		Register8Copy(&triangle.vertices[1], &vertex2.GetPixel(index));
 		Register8Copy(&triangle.vertices[2], &vertex3.GetPixel(index));
 		RegisterStoreAligned(zInverseAndInterpolation, &interpolation.GetPixel(index));
-		materialid.SetPixel(index, triangle.material);
+		materialid.GetTouchedPixel(index) = const_cast<Material*>(triangle.material);
+		instanceid.SetPixel(index, triangle.instance);
 	}
 };
 
 
 
 /**
- * @brief Worklist buffer structure.
+ * @brief Worklist buffer structure, only records the screen index of covered pixels.
+ *        The arrays are allocated from frame arena, they are valid until the end of frame.
  */
-struct WorklistBuffer : VisibilityBuffer
+struct WorklistBuffer
 {
-	IntRenderTarget screen;
-	unsigned int number;
+	// The number of pixels processed by one compaction task, must be a multiple of 8.
+	static constexpr const int chunkSize = 4096;
 
-	WorklistBuffer(int width, int height)
-		: VisibilityBuffer(width, height)
-		, screen(width, height)
-		, number(0)
-	{}
+	// The screen index of covered pixels.
+	int* screen = nullptr;
 
-	void Resize(int width, int height)
-	{
-		VisibilityBuffer::Resize(width, height);
-		screen.Resize(width, height);
-		number = 0;
-	}
+	// The first worklist index of every chunk, the last one is `number`.
+	unsigned int* chunkOffsets = nullptr;
+
+	// The number of covered pixels.
+	unsigned int number = 0;
 
 	void Clear()
 	{
+		screen = nullptr;
+		chunkOffsets = nullptr;
 		number = 0;
 	}
 
-	void Push(const VisibilityBuffer& buffer, const int& index)
+	static int ChunkNum(int width, int height)
 	{
-		vertex1.SetPixel(number, buffer.vertex1.GetPixel(index));
-		vertex2.SetPixel(number, buffer.vertex2.GetPixel(index));
-		vertex3.SetPixel(number, buffer.vertex3.GetPixel(index));
-		interpolation.SetPixel(number, buffer.interpolation.GetPixel(index));
-		materialid.SetPixel(number, buffer.materialid.GetPixel(index));
-		screen.SetPixel(number, index);
-		number++;
+		return (width * height + chunkSize - 1) / chunkSize;
 	}
 };
 
 /**
- * @brief Geometry buffer structure.
+ * @brief Geometry buffer structure, the format of depth is given by `DepthTraits`.
  */
+template<typename DepthTraits>
 struct GeometryBuffer
 {
-	DepthRenderTarget depth;
+	GeometryDepthRenderTarget<DepthTraits> depth;
+
+	// [ position, metallic ], the position is in view space.
 	Float4RenderTarget position;
+
+	// [ normal, roughness ], the normal is in view space.
 	Float4RenderTarget normal;
+
+	// The base color.
 	ColorRenderTarget diffuse;
 
 	GeometryBuffer(int width, int height)
@@ -117,32 +143,319 @@ struct GeometryBuffer
 	}
 };
 
+/**
+ * @brief The outputs of one raster pass.
+ */
+enum class RasterPass : unsigned char
+{
+	DepthAndVisibility, // Depth test, and write visibility of the closer pixel.
+	DepthOnly,          // Depth test only, the first phase of depth prepass mode.
+	Visibility,         // Equal depth test, and write visibility once per pixel, the second phase of depth prepass mode.
+};
+
+/**
+ * @brief The source of occlusion culling.
+ */
+enum class OcclusionMode : unsigned char
+{
+	Disabled,
+	Occluders, // Test against the occluder meshes rasterized in low resolution.
+	Temporal,  // Render the clusters visible in last frame, then test the others against their depth.
+};
+
+/**
+ * @brief The shadows of point lights in the shading pass.
+ */
+enum class ShadowMode : unsigned char
+{
+	Disabled,
+	RayTraced,  // Trace shadow rays from the geometry buffer against the scene hierarchy.
+	ShadowMaps, // Sample the cube shadow maps, rendered again only when the lights or the geometry move.
+};
+
+/**
+ * @brief The triangles waiting for batched setup, one triangle per SIMD lane.
+ */
+struct TriangleBatch
+{
+	// The number of triangles set up together.
+	static constexpr const int capacity = 8;
+
+	ShadingTriangle triangles[capacity];
+
+	int number = 0;
+};
+
+/**
+ * @brief The triangles passing the depth-only phase, rasterized again to write visibility in depth prepass mode.
+ *        The records are allocated from frame arena block by block, they are valid until the end of frame.
+ */
+struct DeferredTriangleList
+{
+	struct Record
+	{
+		TriangleSetup setup;
+
+		ShadingTriangle triangle;
+
+		// Rasterized by small triangle path.
+		bool bSmall = false;
+	};
+
+	struct Block
+	{
+		// The number of records in one block.
+		static constexpr const int capacity = 1024;
+
+		Record records[capacity];
+
+		int number = 0;
+
+		Block* next = nullptr;
+	};
+
+	Block* head = nullptr;
+
+	Block* tail = nullptr;
+
+	// The number of records.
+	unsigned int number = 0;
+
+	void Clear()
+	{
+		head = nullptr;
+		tail = nullptr;
+		number = 0;
+	}
+
+	Record& Append(FrameArena& frameArena)
+	{
+		if (tail == nullptr || tail->number == Block::capacity)
+		{
+			// Only the header is initialized, every record is written before read.
+			Block* block = static_cast<Block*>(frameArena.Allocate(sizeof(Block), alignof(Block)));
+			block->number = 0;
+			block->next = nullptr;
+			(tail ? tail->next : head) = block;
+			tail = block;
+		}
+		++number;
+		return tail->records[tail->number++];
+	}
+};
+
+/**
+ * @brief The resources of one frame in flight.
+ *        In pipelined mode, the shading of a frame overlaps the geometry process of the next frame.
+ */
+template<typename DepthTraits>
+struct FrameContext
+{
+	// Worklist-Buffer.
+	WorklistBuffer WBuffer;
+
+	// Geometry-Buffer.
+	GeometryBuffer<DepthTraits> GBuffer;
+
+	// Final output.
+	SceneRenderTarget scene;
+
+	// The ambient visibility in half resolution, rendered from the geometry buffer before shading.
+	AmbientOcclusion ambientOcclusion;
+
+	// The transient data of the frame.
+	FrameArena frameArena;
+
+	// The triangles waiting for setup, flushed at the end of geometry process.
+	TriangleBatch triangles;
+
+	// The triangles to be rasterized by the visibility phase of depth prepass mode.
+	DeferredTriangleList deferredTriangles;
+
+	// The snapshot of camera status.
+	ViewState viewState;
+
+	// The scale and bias mapping interpolated 1 / w to the value stored in depth buffer, only used by the unorm depth.
+	float depthScale = 1.f;
+	float depthBias = 0.f;
+
+	// The snapshot of point lights.
+	std::vector<PointLight> pointLights;
+
+	// The snapshot of environment lighting, held until the shading of this frame finishes.
+	std::shared_ptr<const Shader::EnvironmentLighting> environment;
+
+	// The shadows in the shading pass of this frame.
+	ShadowMode shadowMode = ShadowMode::Disabled;
+
+	// The snapshot of scene hierarchy for the shadow rays of this frame, taken only in ray-traced mode.
+	// The copy shares the top level and the hierarchies of meshes, so the next frame updates the scene without waiting for this one.
+	SceneBvh sceneBvh;
+
+	// The snapshot of shadow maps sampled by this frame, released when the frame is retired.
+	ShadowMap shadowMap;
+
+	// Occlude the ambient light by screen-space ambient occlusion in this frame.
+	bool bAmbientOcclusion = false;
+
+	// The statistics of shading pass, reported when the frame is presented.
+	float shadingTime = 0.f;
+	float ambientOcclusionTime = 0.f;
+	unsigned long long shadowRayNum = 0;
+
+	// The shading task running in background.
+	Concurrency::task_group shading;
+
+	FrameContext(int width, int height)
+		: GBuffer(width, height)
+		, scene(width, height)
+		, ambientOcclusion(width, height)
+	{}
+
+	void Resize(int width, int height)
+	{
+		GBuffer.Resize(width, height);
+		scene.Resize(width, height);
+		ambientOcclusion.Resize(width, height);
+	}
+};
+
+/**
+ * @brief The statistics of last frame.
+ */
+struct RasterStatistics
+{
+	// The number of chunks requested from system by frame arena, zero in steady state.
+	unsigned long long arenaSystemAllocations = 0;
+
+	// The total bytes reserved by frame arena.
+	unsigned long long arenaReservedBytes = 0;
+
+	// The number of submitted instances, the mesh without instances counts as one.
+	unsigned int instanceNum = 0;
+
+	// The number of instances culled by view frustum.
+	unsigned int frustumCulledInstanceNum = 0;
+
+	// The time of rebuilding or refitting the scene hierarchy in milliseconds.
+	float sceneUpdateTime = 0.f;
+
+	// The number of instances whose transform changed and refitted into the scene hierarchy, all of them if rebuilt.
+	unsigned int sceneRefittedInstanceNum = 0;
+
+	// The number of submitted clusters in the selected levels of detail.
+	unsigned int clusterNum = 0;
+
+	// The number of clusters culled by view frustum.
+	unsigned int frustumCulledClusterNum = 0;
+
+	// The number of submitted triangles in full detail.
+	unsigned int triangleNum = 0;
+
+	// The number of triangles in the selected levels of detail, rendered instead of the submitted ones.
+	unsigned int lodTriangleNum = 0;
+
+	// The number of triangles culled by cluster normal cone.
+	unsigned int coneCulledTriangleNum = 0;
+
+	// The number of clusters hidden behind occluders.
+	unsigned int occlusionCulledClusterNum = 0;
+
+	// The number of triangles hidden behind occluders.
+	unsigned int occlusionCulledTriangleNum = 0;
+
+	// The number of occluder triangles rasterized into occlusion buffer.
+	unsigned int occluderTriangleNum = 0;
+
+	// The number of clusters visible in last frame and rendered before the occlusion test, in temporal mode.
+	unsigned int reusedClusterNum = 0;
+
+	// The number of triangles clipped into polygon.
+	unsigned int clippedTriangleNum = 0;
+
+	// The number of triangles crossing the viewport but accepted by guard band without clipping.
+	unsigned int guardBandTriangleNum = 0;
+
+	// The number of triangles passing the depth-only phase and rasterized again, zero if depth prepass is disabled.
+	unsigned int deferredTriangleNum = 0;
+
+	// The time of shading pass in milliseconds, including the shadow rays and the ambient occlusion.
+	float shadingTime = 0.f;
+
+	// The time of screen-space ambient occlusion in milliseconds, zero if it is disabled.
+	float ambientOcclusionTime = 0.f;
+
+	// The number of rays from the geometry buffer to the point lights, zero if ray traced shadows are disabled.
+	unsigned long long shadowRayNum = 0;
+
+	// The time of rendering shadow maps in milliseconds, zero if every map is cached.
+	float shadowMapTime = 0.f;
+
+	// The number of shadow map faces rendered in this frame.
+	unsigned int shadowMapFaceNum = 0;
+};
+
 /**
  * @brief The core of multi-thread raster rendering.
+ *        `DepthTraits` selects the format of depth buffer, every format keeps the closer pixel with greater value.
+ *         - DepthPixelTraits:        w in float, takes a reciprocal of interpolated 1 / w per pixel.
+ *         - ReverseDepthPixelTraits: -1 / w in float, the interpolated value is stored directly.
+ *         - Depth16PixelTraits:      -1 / w in 16-bits unorm, half of the bandwidth, the precision drops with square of distance.
  */
+template<typename DepthTraits = DepthPixelTraits>
 class ParallelRasterizer
 {
+	using FrameContext = ::FrameContext<DepthTraits>;
+	using GeometryBuffer = ::GeometryBuffer<DepthTraits>;
+
 	// The target render size.
 	int width, height;
 
 	// Visibility-Buffer.
 	VisibilityBuffer VBuffer;
 
-	// Worklist-Buffer.
-	WorklistBuffer WBuffer;
+	// The frames in flight, only one if pipelined mode is disabled.
+	std::vector<std::unique_ptr<FrameContext>> frames;
 
-	// Geometry-Buffer.
-	GeometryBuffer GBuffer;
+	// The index of frame to be submitted.
+	unsigned int frameIndex;
 
-	// Final output.
-	ColorRenderTarget scene;
+	// The index of frame presented by last `Draw()`.
+	unsigned int presentIndex;
+
+	// The statistics of last frame.
+	RasterStatistics statistics;
+
+	// Rasterize depth only at first, then write visibility once per pixel.
+	bool bDepthPrepass = false;
 
-	// A set of model object for rendering in every frame.
+	// The low resolution depth of occluders, or the depth rendered so far in temporal mode.
+	OcclusionBuffer occlusionBuffer;
+
+	// Cull the clusters hidden behind occluders before geometry process.
+	OcclusionMode occlusionMode = OcclusionMode::Occluders;
+
+	// The shadows of point lights in the shading pass.
+	ShadowMode shadowMode = ShadowMode::Disabled;
+
+	// Occlude the ambient light by screen-space ambient occlusion.
+	bool bAmbientOcclusion = true;
+
+	// A set of model object for rendering in every frame, each one is drawn once per instance.
 	std::vector<Meshlet> meshBuffer;
 
+	// The bounding volume hierarchy over the instances of mesh buffer, updated in every frame.
+	SceneBvh sceneBvh;
+
+	// The cube shadow maps of point lights, cached across frames, every frame in flight samples its own snapshot.
+	ShadowMap shadowMap;
+
 	// A set of point light for rendering in every frame.
 	std::vector<PointLight> pointLightBuffer;
 
+	// The ambient light of prefiltered environment, the ambient light is uniform if null.
+	std::shared_ptr<const Shader::EnvironmentLighting> environment;
+
 	// The camera status for rendering.
 	ViewState viewStateBuffer;
 
@@ -153,22 +466,84 @@ class ParallelRasterizer
 	Shader::DeferredFragmentShader fragmentShader;
 
 public:
+	// The maximum number of frames in flight.
+	static constexpr const int MAX_FRAMES_IN_FLIGHT = 3;
+
+	// The number of covered pixels shaded by one task, a multiple of 4.
+	static constexpr const unsigned int SHADING_TILE_SIZE = 256;
+
 	void UpdateViewState(const ViewState& viewState) { viewStateBuffer = viewState; }
 
 	auto& GetMeshBuffer() { return meshBuffer; }
 
 	auto& GetPointLightBuffer() { return pointLightBuffer; }
 
+	const RasterStatistics& GetStatistics() const { return statistics; }
+
+	/**
+	 * @brief The scene hierarchy of last frame for ray queries, e.g. picking and shadow rays.
+	 */
+	const SceneBvh& GetSceneBvh() const { return sceneBvh; }
+
 	/**
 	 * @brief Construct rasterizer with specific screen size.
 	 */
 	ParallelRasterizer(int inWidth, int inHeight);
 
+	~ParallelRasterizer();
+
 	/**
 	 * @brief Resize render target.
 	 */
 	void Resize(int inWidth, int inHeight);
 
+	/**
+	 * @brief Set the number of frames in flight, pipelined mode is enabled when the number is 2 or 3.
+	 *        In pipelined mode, `Draw()` returns the frame submitted `number - 1` calls ago.
+	 */
+	void SetFramesInFlight(int number);
+
+	int GetFramesInFlight() const { return static_cast<int>(frames.size()); }
+
+	/**
+	 * @brief Enable the two-phase depth prepass mode, reduces the visibility buffer writes of overdraw.
+	 */
+	void SetDepthPrepass(bool bEnable) { bDepthPrepass = bEnable; }
+
+	bool IsDepthPrepassEnabled() const { return bDepthPrepass; }
+
+	/**
+	 * @brief Set the source of occlusion culling, the occluders mode only takes effect if any mesh is marked as occluder.
+	 *        The temporal mode keeps the visible set of clusters across frames.
+	 */
+	void SetOcclusionMode(OcclusionMode mode) { occlusionMode = mode; }
+
+	OcclusionMode GetOcclusionMode() const { return occlusionMode; }
+
+	/**
+	 * @brief Set the shadows of point lights, traced against the scene hierarchy or sampled from the cube shadow maps.
+	 *        Only the first 32 lights cast shadows. Every frame in flight keeps a snapshot of the scene hierarchy
+	 *        and the shadow maps, so the next frame updates them without waiting.
+	 */
+	void SetShadowMode(ShadowMode mode) { shadowMode = mode; }
+
+	ShadowMode GetShadowMode() const { return shadowMode; }
+
+	/**
+	 * @brief Enable the screen-space ambient occlusion, rendered in half resolution from the geometry buffer.
+	 */
+	void SetAmbientOcclusion(bool bEnable) { bAmbientOcclusion = bEnable; }
+
+	bool IsAmbientOcclusionEnabled() const { return bAmbientOcclusion; }
+
+	/**
+	 * @brief Set the environment lighting the ambient term, null for the uniform ambient light.
+	 *        The frames in flight keep the previous one until they are shaded.
+	 */
+	void SetEnvironment(std::shared_ptr<const Shader::EnvironmentLighting> inEnvironment) { environment = std::move(inEnvironment); }
+
+	const std::shared_ptr<const Shader::EnvironmentLighting>& GetEnvironment() const { return environment; }
+
 	/**
 	 * @brief The root entry for rendering in every frame.
 	 */
@@ -178,27 +553,62 @@ protected:
 	/**
 	 * @brief Early pass including z-depth testing, etc. without shading.
 	 */
-	void PrePass();
+	void PrePass(FrameContext& frame);
 
 	/**
 	 * @brief Shading pass, rasterize triangles in parallel.
 	 */
-	void BasePass();
+	void BasePass(FrameContext& frame);
 
 private:
 	/**
-	 * @brief The process of rasterize a triangle.
+	 * @brief Wait for the shading of all frames in flight.
+	 */
+	void WaitFramesInFlight();
+
+	/**
+	 * @brief Release the transient data of a finished frame.
+	 */
+	void RetireFrame(FrameContext& frame);
+
+	/**
+	 * @brief Rasterize occluders into occlusion buffer and build its hierarchy, returns false if there is no visible occluder.
+	 */
+	bool RasterizeOccluders(const Matrix& vp);
+
+	/**
+	 * @brief Build occlusion buffer and its hierarchy from the depth rendered so far.
+	 */
+	void BuildDepthOcclusion(FrameContext& frame);
+
+	/**
+	 * @brief Set up the batched triangles at once, one triangle per SIMD lane.
+	 *        The back facing, zero area and off-screen triangles are rejected here, the rest are sent to raster kernels.
+	 */
+	void SetupTriangles(FrameContext& frame);
+
+	/**
+	 * @brief The process of rasterize a triangle, returns true if any pixel passes the depth test.
+	 */
+	template<RasterPass pass>
+	bool RasterizeTriangle(FrameContext& frame, const ShadingTriangle& payload, const TriangleSetup& setup);
+
+	/**
+	 * @brief Rasterize the triangle covering at most 4x4 pixels, all pixels are tested at once.
 	 */
-	void RasterizeTriangle(const ShadingTriangle& payload);
+	template<RasterPass pass>
+	bool RasterizeSmallTriangle(FrameContext& frame, const ShadingTriangle& payload, const TriangleSetup& setup);
 
 	/**
-	 * @brief The process by which polygons that are not facing the camera are removed from the rendering pipeline.
+	 * @brief The target of raster kernels in `pass`, the depth test of geometry buffer and the writes of visibility buffer for one triangle.
+	 *        The tags of lazily cleared targets are checked once per run of pixels, the pixels are tested without tag check.
 	 */
-	bool BackFaceCulling(const ShadingTriangle& triangle);
+	template<RasterPass pass>
+	struct RasterTarget;
 
 	/**
 	 * @brief The process by which polygons that are at homogeneous coordinates are clipped for rendering
 	 *        it is positioned in the pipeline just after view coordinates (MVP) and just before normalized device coordinates (NDC).
 	 */
-	void HomogeneousClipping(const ShadingTriangle& inTriangle, ShadingTriangle* outTriangles, int& triangleNum);
+	void HomogeneousClipping(const ShadingTriangle& inTriangle, ShadingVertex* clippingVertices, ShadingTriangle* outTriangles, int& triangleNum);
 };
\ No newline at end of file
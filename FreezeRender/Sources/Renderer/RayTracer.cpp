@@ -0,0 +1,194 @@
+#include "RayTracer.hpp"
+#include <Shader/BrdfLut.hpp>
+#include <chrono>
+#include <atomic>
+#include <ppl.h>
+
+
+
+namespace
+{
+	/**
+	 * @brief Expand the mask bits of lanes to a register mask.
+	 */
+	force_inline R128 LaneMask(const int& bits)
+	{
+		return Number::MakeRegister(bits & 1 ? ~0u : 0u, bits & 2 ? ~0u : 0u, bits & 4 ? ~0u : 0u, bits & 8 ? ~0u : 0u);
+	}
+}
+
+
+
+RayTracer::RayTracer(int inWidth, int inHeight, std::vector<Meshlet>& inMeshBuffer, std::vector<PointLight>& inPointLightBuffer)
+	: sceneBuffer(inWidth, inHeight)
+	, width(inWidth)
+	, height(inHeight)
+	, meshBuffer(inMeshBuffer)
+	, pointLightBuffer(inPointLightBuffer)
+{
+	// Integrated in parallel before the first frame, not lazily by a tracing task.
+	Shader::BrdfLut::Instance();
+}
+
+void RayTracer::Resize(int inWidth, int inHeight)
+{
+	sceneBuffer.Resize(inWidth, inHeight);
+	width = inWidth;
+	height = inHeight;
+}
+
+ColorRenderTarget& RayTracer::Draw()
+{
+	const auto start = std::chrono::steady_clock::now();
+	for (auto& mesh : meshBuffer)
+	{
+		// The mesh which is not created by loader.
+		if (mesh.IsValid() && mesh.clusters.empty())
+		{
+			mesh.BuildClusters();
+		}
+	}
+	sceneBvh.Update(meshBuffer);
+	sceneBvh.BuildMeshHierarchies();
+	const auto traceStart = std::chrono::steady_clock::now();
+
+	// The points of pixel centers on a plane of constant depth are affine in screen space, so are the camera rays.
+	const Matrix inverseViewProjection = (viewStateBuffer.projection * viewStateBuffer.view).Inverse();
+	auto Unproject = [this, &inverseViewProjection](const float& x, const float& y)
+	{
+		const Vector4 point = inverseViewProjection * Vector4(2.f * x / width - 1.f, 2.f * y / height - 1.f, 0.f, 1.f);
+		return point.XYZ() / point.w - viewStateBuffer.location;
+	};
+	const Vector3 corner = Unproject(0.5f, 0.5f);
+	const Vector3 stepX = Unproject(1.5f, 0.5f) - corner;
+	const Vector3 stepY = Unproject(0.5f, 1.5f) - corner;
+
+	const int tileNumX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	const int tileNumY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	std::atomic<unsigned long long> shadowRayNum = 0;
+	Concurrency::parallel_for(0, tileNumX * tileNumY, [&](const int& tile)
+	{
+		shadowRayNum += TraceTile(tile % tileNumX, tile / tileNumX, corner, stepX, stepY);
+	});
+
+	const auto end = std::chrono::steady_clock::now();
+	statistics.primaryRayNum = static_cast<unsigned long long>(width) * height;
+	statistics.shadowRayNum = shadowRayNum.load();
+	statistics.sceneUpdateTime = std::chrono::duration<float, std::milli>(traceStart - start).count();
+	statistics.traceTime = std::chrono::duration<float, std::milli>(end - traceStart).count();
+	statistics.megaRaysPerSecond = (statistics.primaryRayNum + statistics.shadowRayNum) / std::max(statistics.traceTime, 1e-3f) * 1e-3f;
+	return sceneBuffer;
+}
+
+unsigned long long RayTracer::TraceTile(const int& tileX, const int& tileY, const Vector3& corner, const Vector3& stepX, const Vector3& stepY)
+{
+	const Vector3& eye = viewStateBuffer.location;
+	const bool bTraceShadows = bShadows && !pointLightBuffer.empty();
+	const int x0 = tileX * TILE_SIZE;
+	const int y0 = tileY * TILE_SIZE;
+	const int x1 = std::min(x0 + TILE_SIZE, width);
+	const int y1 = std::min(y0 + TILE_SIZE, height);
+	unsigned long long shadowRayNum = 0;
+
+	for (int y = y0; y < y1; y += 2)
+	{
+		for (int x = x0; x < x1; x += 2)
+		{
+			// The 2 x 2 pixels of packet, the lanes outside the screen are inactive.
+			const int pixelX[4] = { x, x + 1, x, x + 1 };
+			const int pixelY[4] = { y, y, y + 1, y + 1 };
+			alignas(16) float directionX[4], directionY[4], directionZ[4];
+			int activeBits = 0;
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				const Vector3 direction = corner + stepX * static_cast<float>(pixelX[lane]) + stepY * static_cast<float>(pixelY[lane]);
+				directionX[lane] = direction.x;
+				directionY[lane] = direction.y;
+				directionZ[lane] = direction.z;
+				activeBits |= (pixelX[lane] < x1 && pixelY[lane] < y1) << lane;
+			}
+
+			RayPacket packet;
+			packet.originX = MakeRegister(eye.x);
+			packet.originY = MakeRegister(eye.y);
+			packet.originZ = MakeRegister(eye.z);
+			packet.directionX = RegisterLoadAligned(directionX);
+			packet.directionY = RegisterLoadAligned(directionY);
+			packet.directionZ = RegisterLoadAligned(directionZ);
+			packet.maxDistance = MakeRegister(Number::FLOAT_INF);
+			packet.active = LaneMask(activeBits);
+
+			RayPacketHit hit;
+			const int hitBits = sceneBvh.IntersectPacket(packet, hit);
+
+			// Interpolate the attributes of hit points in world space.
+			Shader::DeferredFragmentPayload payloads[4];
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				if (!(hitBits & (1 << lane)))
+				{
+					continue;
+				}
+
+				const unsigned int primitive = hit.primitive[lane];
+				const Meshlet& mesh = meshBuffer[sceneBvh.GetPrimitives()[primitive].mesh];
+				const Vertex& a = *mesh.indices[hit.firstIndex[lane] + 0].ptr;
+				const Vertex& b = *mesh.indices[hit.firstIndex[lane] + 1].ptr;
+				const Vertex& c = *mesh.indices[hit.firstIndex[lane] + 2].ptr;
+				const float alpha = hit.alpha.m128_f32[lane];
+				const float beta = hit.beta.m128_f32[lane];
+				const float gamma = 1.f - alpha - beta;
+				const Vector2 uv = a.uv * gamma + b.uv * alpha + c.uv * beta;
+				const Vector3 normal = a.normal * gamma + b.normal * alpha + c.normal * beta;
+
+				// The normal is transformed by the inverse transpose, and faces the camera.
+				const Matrix& inverse = sceneBvh.GetInverseTransform(primitive);
+				const Vector3 direction = { directionX[lane], directionY[lane], directionZ[lane] };
+				Vector3 worldNormal = Vector3(
+					inverse.m[0][0] * normal.x + inverse.m[1][0] * normal.y + inverse.m[2][0] * normal.z,
+					inverse.m[0][1] * normal.x + inverse.m[1][1] * normal.y + inverse.m[2][1] * normal.z,
+					inverse.m[0][2] * normal.x + inverse.m[1][2] * normal.y + inverse.m[2][2] * normal.z).Normalize();
+				worldNormal = (worldNormal | direction) > 0.f ? worldNormal * -1.f : worldNormal;
+
+				Shader::DeferredFragmentPayload& payload = payloads[lane];
+				payload.pointlights = &pointLightBuffer;
+				payload.viewpoint = eye;
+				payload.shadingpoint = eye + direction * hit.distance.m128_f32[lane];
+				payload.normal = worldNormal;
+				payload.diffuse = mesh.materials[0].Diffuse()->Sample(uv);
+				payload.metallic = mesh.materials[0].Parameters().metallic;
+				payload.roughness = mesh.materials[0].Parameters().roughness;
+				payload.environment = environment.get();
+			}
+
+			// One shadow packet per light.
+			if (bTraceShadows && hitBits)
+			{
+				Vector3 points[4], normals[4];
+				unsigned int shadowMasks[4];
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					points[lane] = payloads[lane].shadingpoint;
+					normals[lane] = payloads[lane].normal;
+				}
+				shadowRayNum += sceneBvh.OccludedLights(points, normals, hitBits, pointLightBuffer, shadowMasks);
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					payloads[lane].shadowMask = shadowMasks[lane];
+				}
+			}
+
+			Color colors[4];
+			fragmentShader(payloads, hitBits, colors);
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				if (activeBits & (1 << lane))
+				{
+					const int screenIndex = (height - pixelY[lane] - 1) * width + pixelX[lane];
+					sceneBuffer.SetPixel(screenIndex, hitBits & (1 << lane) ? colors[lane] : sceneBuffer.GetDefaultPixel());
+				}
+			}
+		}
+	}
+	return shadowRayNum;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <Core/Meshlet.hpp>
+#include <Core/Light.hpp>
+#include <Core/Camera.hpp>
+#include <Core/Matrix.hpp>
+#include <Core/RenderTarget.hpp>
+#include <Shader/FragmentShader.hpp>
+#include <Shader/EnvironmentLighting.hpp>
+#include <Renderer/SceneBvh.hpp>
+#include <vector>
+#include <memory>
+
+
+
+/**
+ * @brief The statistics of last frame of ray tracing.
+ */
+struct RayTracingStatistics
+{
+	// The number of camera rays, one per pixel.
+	unsigned long long primaryRayNum = 0;
+
+	// The number of rays from the hit points to the point lights.
+	unsigned long long shadowRayNum = 0;
+
+	// The time of updating the scene hierarchy in milliseconds.
+	float sceneUpdateTime = 0.f;
+
+	// The time of tracing and shading in milliseconds.
+	float traceTime = 0.f;
+
+	// The million rays traced per second, both primary and shadow rays.
+	float megaRaysPerSecond = 0.f;
+};
+
+
+
+/**
+ * @brief The core of ray tracing rendering, draws the mesh and light buffers owned by a rasterizer, so the scene is loaded once.
+ *        The screen is split into tiles traced in parallel, every 2 x 2 pixels are traced as one packet,
+ *        then the hit points are shaded by the deferred fragment shader with the lights occluded by shadow rays.
+ */
+class RayTracer
+{
+public:
+	// The size of tile traced by one task, a multiple of 2.
+	static constexpr const int TILE_SIZE = 16;
+
+private:
+	// The target render size.
+	int width, height;
+
+	// The final render output buffer.
+	ColorRenderTarget sceneBuffer;
+
+	// A set of model object for rendering in every frame, each one is drawn once per instance. Shared, not owned.
+	std::vector<Meshlet>& meshBuffer;
+
+	// A set of point light for rendering in every frame, the first 32 lights cast shadows. Shared, not owned.
+	std::vector<PointLight>& pointLightBuffer;
+
+	// The ambient light of prefiltered environment, the ambient light is uniform if null.
+	std::shared_ptr<const Shader::EnvironmentLighting> environment;
+
+	// The camera status for rendering.
+	ViewState viewStateBuffer;
+
+	// The bounding volume hierarchy over the instances of mesh buffer, updated in every frame.
+	SceneBvh sceneBvh;
+
+	// Trace shadow rays towards every light.
+	bool bShadows = true;
+
+	// The statistics of last frame.
+	RayTracingStatistics statistics;
+
+	// The entry of fragment shader.
+	Shader::DeferredFragmentShader fragmentShader;
+
+public:
+	void UpdateViewState(const ViewState& viewState) { viewStateBuffer = viewState; }
+
+	auto& GetMeshBuffer() { return meshBuffer; }
+
+	auto& GetPointLightBuffer() { return pointLightBuffer; }
+
+	const RayTracingStatistics& GetStatistics() const { return statistics; }
+
+	void SetShadows(const bool& bEnable) { bShadows = bEnable; }
+
+	bool IsShadowsEnabled() const { return bShadows; }
+
+	void SetEnvironment(std::shared_ptr<const Shader::EnvironmentLighting> inEnvironment) { environment = std::move(inEnvironment); }
+
+	/**
+	 * @brief Construct ray tracer with specific screen size, drawing the mesh and light buffers of others, e.g. the rasterizer.
+	 *        The buffers must outlive the ray tracer, `Draw()` is never called while others are updating them.
+	 */
+	RayTracer(int inWidth, int inHeight, std::vector<Meshlet>& inMeshBuffer, std::vector<PointLight>& inPointLightBuffer);
+
+	/**
+	 * @brief Resize render target.
+	 */
+	void Resize(int inWidth, int inHeight);
+
+	/**
+	 * @brief The root entry for rendering in every frame.
+	 */
+	ColorRenderTarget& Draw();
+
+private:
+	/**
+	 * @brief Trace and shade the pixels of a tile, returns the number of shadow rays.
+	 *        `corner` is the direction of camera ray through the center of the bottom left pixel,
+	 *        `stepX` and `stepY` are the differences of direction between neighbouring pixels.
+	 */
+	unsigned long long TraceTile(const int& tileX, const int& tileY, const Vector3& corner, const Vector3& stepX, const Vector3& stepY);
+};
@@ -0,0 +1,702 @@
+#include "SceneBvh.hpp"
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <bit>
+#include <ppl.h>
+
+
+
+namespace
+{
+	// The number of primitives reduced by one task in parallel binning.
+	constexpr const static unsigned int BINNING_CHUNK_SIZE = 1024;
+
+	force_inline float Component(const Vector3& vector, const int& axis)
+	{
+		return axis == 0 ? vector.x : (axis == 1 ? vector.y : vector.z);
+	}
+
+	force_inline Vector3 ComponentMin(const Vector3& a, const Vector3& b)
+	{
+		return { std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z) };
+	}
+
+	force_inline Vector3 ComponentMax(const Vector3& a, const Vector3& b)
+	{
+		return { std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z) };
+	}
+
+	/**
+	 * @brief Half of the surface area of box, zero for the empty box.
+	 */
+	force_inline float HalfArea(const Vector3& minimum, const Vector3& maximum)
+	{
+		const Vector3 extent = maximum - minimum;
+		return extent.x < 0.f ? 0.f : extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	/**
+	 * @brief Slab test of 4 rays against box within [0, maxDistance], returns the mask of lanes hit and their entry distances.
+	 */
+	force_inline R128 IntersectBox(const Vector3& minimum, const Vector3& maximum, const RayPacket& packet, const R128 (&invDirection)[3], const R128& maxDistance, R128& entry)
+	{
+		const R128 x0 = RegisterMultiply(RegisterSubtract(MakeRegister(minimum.x), packet.originX), invDirection[0]);
+		const R128 x1 = RegisterMultiply(RegisterSubtract(MakeRegister(maximum.x), packet.originX), invDirection[0]);
+		const R128 y0 = RegisterMultiply(RegisterSubtract(MakeRegister(minimum.y), packet.originY), invDirection[1]);
+		const R128 y1 = RegisterMultiply(RegisterSubtract(MakeRegister(maximum.y), packet.originY), invDirection[1]);
+		const R128 z0 = RegisterMultiply(RegisterSubtract(MakeRegister(minimum.z), packet.originZ), invDirection[2]);
+		const R128 z1 = RegisterMultiply(RegisterSubtract(MakeRegister(maximum.z), packet.originZ), invDirection[2]);
+		entry = RegisterMax(RegisterMax(RegisterMin(x0, x1), RegisterMin(y0, y1)), RegisterMax(RegisterMin(z0, z1), Number::R_ZERO));
+		const R128 exit = RegisterMin(RegisterMin(RegisterMax(x0, x1), RegisterMax(y0, y1)), RegisterMin(RegisterMax(z0, z1), maxDistance));
+		return RegisterLE(entry, exit);
+	}
+
+	/**
+	 * @brief The nearest entry distance of the lanes in mask, infinity if none.
+	 */
+	force_inline float NearestEntry(const R128& mask, const R128& entry)
+	{
+		R128 result = RegisterSelect(mask, entry, MakeRegister(Number::FLOAT_INF));
+		result = RegisterMin(result, RegisterSwizzle(result, 1, 0, 3, 2));
+		return RegisterGetX(RegisterMin(result, RegisterSwizzle(result, 2, 3, 0, 1)));
+	}
+
+	/**
+	 * @brief The farthest hit distance of the lanes in mask, negative infinity if none.
+	 */
+	force_inline float FarthestDistance(const R128& mask, const R128& distance)
+	{
+		R128 result = RegisterSelect(mask, distance, MakeRegister(Number::FLOAT_NEG_INF));
+		result = RegisterMax(result, RegisterSwizzle(result, 1, 0, 3, 2));
+		return RegisterGetX(RegisterMax(result, RegisterSwizzle(result, 2, 3, 0, 1)));
+	}
+
+	/**
+	 * @brief Expand the mask bits of lanes to a register mask.
+	 */
+	force_inline R128 LaneMask(const int& bits)
+	{
+		return Number::MakeRegister(bits & 1 ? ~0u : 0u, bits & 2 ? ~0u : 0u, bits & 4 ? ~0u : 0u, bits & 8 ? ~0u : 0u);
+	}
+
+	/**
+	 * @brief The packet tracing the ray in its first lane only.
+	 */
+	force_inline RayPacket SingleRayPacket(const Ray& ray)
+	{
+		RayPacket packet;
+		packet.originX = MakeRegister(ray.origin.x);
+		packet.originY = MakeRegister(ray.origin.y);
+		packet.originZ = MakeRegister(ray.origin.z);
+		packet.directionX = MakeRegister(ray.direction.x);
+		packet.directionY = MakeRegister(ray.direction.y);
+		packet.directionZ = MakeRegister(ray.direction.z);
+		packet.maxDistance = MakeRegister(ray.maxDistance);
+		packet.active = LaneMask(1);
+		return packet;
+	}
+
+	/**
+	 * @brief The box of primitives and the box of their centroids.
+	 */
+	struct Bounds
+	{
+		Vector3 minimum = Number::FLOAT_INF;
+		Vector3 maximum = Number::FLOAT_NEG_INF;
+		Vector3 centroidMinimum = Number::FLOAT_INF;
+		Vector3 centroidMaximum = Number::FLOAT_NEG_INF;
+	};
+
+	/**
+	 * @brief The primitives falling into one bin.
+	 */
+	struct Bin
+	{
+		Vector3 minimum = Number::FLOAT_INF;
+		Vector3 maximum = Number::FLOAT_NEG_INF;
+		unsigned int count = 0;
+	};
+
+	/**
+	 * @brief Reduce `[begin, end)` by `reduce(first, last, result)`, in parallel chunks if the range is large.
+	 */
+	template<typename Result, typename Reduce, typename Merge>
+	force_inline Result ParallelReduce(const unsigned int& begin, const unsigned int& end, const bool& bParallel, const Reduce& reduce, const Merge& merge)
+	{
+		Result result;
+		if (!bParallel)
+		{
+			reduce(begin, end, result);
+			return result;
+		}
+
+		Concurrency::combinable<Result> partials;
+		const unsigned int chunkNum = (end - begin + BINNING_CHUNK_SIZE - 1) / BINNING_CHUNK_SIZE;
+		Concurrency::parallel_for(0u, chunkNum, [&](const unsigned int& chunk)
+		{
+			const unsigned int first = begin + chunk * BINNING_CHUNK_SIZE;
+			reduce(first, std::min(first + BINNING_CHUNK_SIZE, end), partials.local());
+		});
+		partials.combine_each([&](const Result& partial) { merge(result, partial); });
+		return result;
+	}
+}
+
+
+
+void SceneBvh::Update(const std::vector<Meshlet>& inMeshes)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	// The primitives in the order of draws.
+	unsigned int primitiveNum = 0;
+	for (const auto& mesh : inMeshes)
+	{
+		primitiveNum += mesh.IsValid() ? mesh.GetInstanceNum() : 0;
+	}
+
+	const std::vector<Primitive>& primitives = topLevel->primitives;
+	bool bChanged = meshes != &inMeshes || primitiveNum != primitives.size();
+	for (unsigned int meshIndex = 0, index = 0; !bChanged && meshIndex < inMeshes.size(); ++meshIndex)
+	{
+		const Meshlet& mesh = inMeshes[meshIndex];
+		const unsigned int instanceNum = mesh.IsValid() ? mesh.GetInstanceNum() : 0;
+		bChanged = instanceNum > 0 && (primitives[index].mesh != meshIndex || primitives[index + instanceNum - 1].instance != instanceNum - 1);
+		index += instanceNum;
+	}
+
+	bRebuilt = bChanged;
+	if (bChanged)
+	{
+		Build(inMeshes);
+	}
+	else
+	{
+		Refit();
+	}
+	updateTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void SceneBvh::Build(const std::vector<Meshlet>& inMeshes)
+{
+	meshes = &inMeshes;
+	std::shared_ptr<TopLevel> level = std::make_shared<TopLevel>();
+	for (unsigned int meshIndex = 0; meshIndex < inMeshes.size(); ++meshIndex)
+	{
+		const Meshlet& mesh = inMeshes[meshIndex];
+		const unsigned int instanceNum = mesh.IsValid() ? mesh.GetInstanceNum() : 0;
+		for (unsigned int instance = 0; instance < instanceNum; ++instance)
+		{
+			level->primitives.push_back({ meshIndex, instance });
+		}
+	}
+
+	const unsigned int primitiveNum = static_cast<unsigned int>(level->primitives.size());
+	level->transforms.resize(primitiveNum);
+	level->inverseTransforms.resize(primitiveNum);
+	level->geometryVersions.resize(primitiveNum);
+	level->minimums.resize(primitiveNum);
+	level->maximums.resize(primitiveNum);
+	level->order.resize(primitiveNum);
+	std::iota(level->order.begin(), level->order.end(), 0u);
+	refittedPrimitiveNum = primitiveNum;
+
+	Concurrency::parallel_for(0u, primitiveNum, [this, &level](const unsigned int& index)
+	{
+		UpdatePrimitive(*level, index);
+	});
+
+	// A binary tree with one primitive per leaf at most.
+	if (primitiveNum > 0)
+	{
+		level->nodes.resize(primitiveNum * 2 - 1);
+		std::atomic<unsigned int> nodeNum = 1;
+		BuildNode(*level, 0, 0, primitiveNum, 0, nodeNum);
+		level->nodes.resize(nodeNum.load());
+	}
+	topLevel = std::move(level);
+}
+
+void SceneBvh::Refit()
+{
+	const unsigned int primitiveNum = static_cast<unsigned int>(topLevel->primitives.size());
+	std::vector<unsigned char> changed(primitiveNum);
+	Concurrency::parallel_for(0u, primitiveNum, [this, &changed](const unsigned int& index)
+	{
+		changed[index] = IsPrimitiveStale(index) ? 1 : 0;
+	});
+
+	refittedPrimitiveNum = static_cast<unsigned int>(std::count(changed.begin(), changed.end(), 1));
+	if (refittedPrimitiveNum == 0)
+	{
+		return;
+	}
+
+	// The top level held by a snapshot is copied, otherwise it is refitted in place.
+	std::shared_ptr<TopLevel> level = topLevel.use_count() == 1 ? std::const_pointer_cast<TopLevel>(topLevel) : std::make_shared<TopLevel>(*topLevel);
+	Concurrency::parallel_for(0u, primitiveNum, [this, &changed, &level](const unsigned int& index)
+	{
+		if (changed[index])
+		{
+			UpdatePrimitive(*level, index);
+		}
+	});
+
+	// The children are stored after their parent, so the nodes are refitted from back to front.
+	std::vector<Node>& nodes = level->nodes;
+	std::vector<unsigned char> dirty(nodes.size());
+	for (size_t nodeIndex = nodes.size(); nodeIndex --> 0;)
+	{
+		Node& node = nodes[nodeIndex];
+		if (node.count == 0)
+		{
+			if (dirty[node.first] || dirty[node.first + 1])
+			{
+				node.minimum = ComponentMin(nodes[node.first].minimum, nodes[node.first + 1].minimum);
+				node.maximum = ComponentMax(nodes[node.first].maximum, nodes[node.first + 1].maximum);
+				dirty[nodeIndex] = 1;
+			}
+			continue;
+		}
+
+		bool bDirty = false;
+		for (unsigned int index = node.first; index < node.first + node.count; ++index)
+		{
+			bDirty |= changed[level->order[index]] != 0;
+		}
+		if (bDirty)
+		{
+			node.minimum = Number::FLOAT_INF;
+			node.maximum = Number::FLOAT_NEG_INF;
+			for (unsigned int index = node.first; index < node.first + node.count; ++index)
+			{
+				node.minimum = ComponentMin(node.minimum, level->minimums[level->order[index]]);
+				node.maximum = ComponentMax(node.maximum, level->maximums[level->order[index]]);
+			}
+			dirty[nodeIndex] = 1;
+		}
+	}
+	topLevel = std::move(level);
+}
+
+void SceneBvh::BuildMeshHierarchies()
+{
+	if (meshes == nullptr)
+	{
+		return;
+	}
+
+	meshHierarchies.resize(meshes->size());
+	Concurrency::parallel_for(size_t(0), meshes->size(), [this](const size_t& meshIndex)
+	{
+		const Meshlet& mesh = (*meshes)[meshIndex];
+		std::shared_ptr<const WideBvh>& hierarchy = meshHierarchies[meshIndex];
+		if (!mesh.IsValid())
+		{
+			hierarchy.reset();
+		}
+		else if (!hierarchy || !hierarchy->IsBuiltFrom(mesh))
+		{
+			std::shared_ptr<WideBvh> built = std::make_shared<WideBvh>();
+			built->Build(mesh);
+			hierarchy = std::move(built);
+		}
+	});
+}
+
+bool SceneBvh::IsPrimitiveStale(const unsigned int& index) const
+{
+	const Primitive& primitive = topLevel->primitives[index];
+	const Meshlet& mesh = (*meshes)[primitive.mesh];
+	const Matrix transform = mesh.GetInstanceTransform(primitive.instance);
+	return std::memcmp(&transform, &topLevel->transforms[index], sizeof(Matrix)) != 0 || topLevel->geometryVersions[index] != mesh.GetGeometryVersion();
+}
+
+void SceneBvh::UpdatePrimitive(TopLevel& level, const unsigned int& index) const
+{
+	const Primitive& primitive = level.primitives[index];
+	const Meshlet& mesh = (*meshes)[primitive.mesh];
+	const Matrix transform = mesh.GetInstanceTransform(primitive.instance);
+	level.transforms[index] = transform;
+	level.inverseTransforms[index] = transform.Inverse();
+	level.geometryVersions[index] = mesh.GetGeometryVersion();
+
+	// The world box of the transformed local box.
+	Vector3 minimum = Number::FLOAT_INF;
+	Vector3 maximum = Number::FLOAT_NEG_INF;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const Vector4 point = transform * Vector4(
+			corner & 1 ? mesh.bounds.maximum.x : mesh.bounds.minimum.x,
+			corner & 2 ? mesh.bounds.maximum.y : mesh.bounds.minimum.y,
+			corner & 4 ? mesh.bounds.maximum.z : mesh.bounds.minimum.z,
+			1.f);
+		minimum = ComponentMin(minimum, point.XYZ());
+		maximum = ComponentMax(maximum, point.XYZ());
+	}
+	level.minimums[index] = minimum;
+	level.maximums[index] = maximum;
+}
+
+void SceneBvh::BuildNode(TopLevel& level, const unsigned int& nodeIndex, const unsigned int& begin, const unsigned int& end, const int& depth, std::atomic<unsigned int>& nodeNum)
+{
+	Node& node = level.nodes[nodeIndex];
+	const unsigned int count = end - begin;
+	const bool bParallel = count >= PARALLEL_PRIMITIVE_NUM;
+
+	const Bounds bounds = ParallelReduce<Bounds>(begin, end, bParallel,
+		[&level](const unsigned int& first, const unsigned int& last, Bounds& result)
+		{
+			for (unsigned int index = first; index < last; ++index)
+			{
+				const unsigned int primitive = level.order[index];
+				const Vector3 centroid = level.minimums[primitive] + level.maximums[primitive];
+				result.minimum = ComponentMin(result.minimum, level.minimums[primitive]);
+				result.maximum = ComponentMax(result.maximum, level.maximums[primitive]);
+				result.centroidMinimum = ComponentMin(result.centroidMinimum, centroid);
+				result.centroidMaximum = ComponentMax(result.centroidMaximum, centroid);
+			}
+		},
+		[](Bounds& result, const Bounds& partial)
+		{
+			result.minimum = ComponentMin(result.minimum, partial.minimum);
+			result.maximum = ComponentMax(result.maximum, partial.maximum);
+			result.centroidMinimum = ComponentMin(result.centroidMinimum, partial.centroidMinimum);
+			result.centroidMaximum = ComponentMax(result.centroidMaximum, partial.centroidMaximum);
+		});
+
+	node.minimum = bounds.minimum;
+	node.maximum = bounds.maximum;
+
+	// Split along the widest axis of centroids.
+	const Vector3 extent = bounds.centroidMaximum - bounds.centroidMinimum;
+	const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	const float axisMinimum = Component(bounds.centroidMinimum, axis);
+	const float axisExtent = Component(extent, axis);
+	if (count <= LEAF_PRIMITIVE_NUM || depth >= MAX_DEPTH || !(axisExtent > 0.f))
+	{
+		node.first = begin;
+		node.count = count;
+		return;
+	}
+
+	const float scale = BIN_NUM / axisExtent;
+	auto BinIndex = [&level, axis, axisMinimum, scale](const unsigned int& primitive) -> int
+	{
+		const float centroid = Component(level.minimums[primitive] + level.maximums[primitive], axis);
+		return std::min(static_cast<int>((centroid - axisMinimum) * scale), BIN_NUM - 1);
+	};
+
+	struct Bins
+	{
+		Bin bins[BIN_NUM];
+	};
+	const Bins bins = ParallelReduce<Bins>(begin, end, bParallel,
+		[&level, &BinIndex](const unsigned int& first, const unsigned int& last, Bins& result)
+		{
+			for (unsigned int index = first; index < last; ++index)
+			{
+				const unsigned int primitive = level.order[index];
+				Bin& bin = result.bins[BinIndex(primitive)];
+				bin.minimum = ComponentMin(bin.minimum, level.minimums[primitive]);
+				bin.maximum = ComponentMax(bin.maximum, level.maximums[primitive]);
+				++bin.count;
+			}
+		},
+		[](Bins& result, const Bins& partial)
+		{
+			for (int index = 0; index < BIN_NUM; ++index)
+			{
+				result.bins[index].minimum = ComponentMin(result.bins[index].minimum, partial.bins[index].minimum);
+				result.bins[index].maximum = ComponentMax(result.bins[index].maximum, partial.bins[index].maximum);
+				result.bins[index].count += partial.bins[index].count;
+			}
+		});
+
+	// The cost of splitting after every bin, swept from both sides.
+	float rightCosts[BIN_NUM];
+	{
+		Vector3 minimum = Number::FLOAT_INF, maximum = Number::FLOAT_NEG_INF;
+		unsigned int number = 0;
+		for (int index = BIN_NUM - 1; index > 0; --index)
+		{
+			minimum = ComponentMin(minimum, bins.bins[index].minimum);
+			maximum = ComponentMax(maximum, bins.bins[index].maximum);
+			number += bins.bins[index].count;
+			rightCosts[index - 1] = HalfArea(minimum, maximum) * number;
+		}
+	}
+
+	int split = 0;
+	float bestCost = Number::FLOAT_INF;
+	{
+		Vector3 minimum = Number::FLOAT_INF, maximum = Number::FLOAT_NEG_INF;
+		unsigned int number = 0;
+		for (int index = 0; index < BIN_NUM - 1; ++index)
+		{
+			minimum = ComponentMin(minimum, bins.bins[index].minimum);
+			maximum = ComponentMax(maximum, bins.bins[index].maximum);
+			number += bins.bins[index].count;
+			const float cost = HalfArea(minimum, maximum) * number + rightCosts[index];
+			if (number > 0 && number < count && cost < bestCost)
+			{
+				bestCost = cost;
+				split = index;
+			}
+		}
+	}
+
+	unsigned int* const first = level.order.data() + begin;
+	unsigned int* middle = std::partition(first, level.order.data() + end, [&BinIndex, split](const unsigned int& primitive)
+	{
+		return BinIndex(primitive) <= split;
+	});
+
+	// All centroids fall into one bin, split by the median.
+	if (middle == first || middle == level.order.data() + end)
+	{
+		middle = first + count / 2;
+		std::nth_element(first, middle, level.order.data() + end, [&level, axis](const unsigned int& lhs, const unsigned int& rhs)
+		{
+			return Component(level.minimums[lhs] + level.maximums[lhs], axis) < Component(level.minimums[rhs] + level.maximums[rhs], axis);
+		});
+	}
+
+	const unsigned int children = nodeNum.fetch_add(2);
+	const unsigned int center = static_cast<unsigned int>(middle - level.order.data());
+	node.first = children;
+	node.count = 0;
+	if (bParallel)
+	{
+		Concurrency::parallel_invoke(
+			[&]() { BuildNode(level, children + 0, begin, center, depth + 1, nodeNum); },
+			[&]() { BuildNode(level, children + 1, center, end, depth + 1, nodeNum); });
+	}
+	else
+	{
+		BuildNode(level, children + 0, begin, center, depth + 1, nodeNum);
+		BuildNode(level, children + 1, center, end, depth + 1, nodeNum);
+	}
+}
+
+bool SceneBvh::Intersect(const Ray& ray, RayHit& hit) const
+{
+	RayPacketHit packetHit;
+	if (!(IntersectPacket(SingleRayPacket(ray), packetHit) & 1))
+	{
+		return false;
+	}
+
+	const Primitive& primitive = topLevel->primitives[packetHit.primitive[0]];
+	hit.distance = RegisterGetX(packetHit.distance);
+	hit.mesh = primitive.mesh;
+	hit.instance = primitive.instance;
+	hit.firstIndex = packetHit.firstIndex[0];
+	hit.alpha = RegisterGetX(packetHit.alpha);
+	hit.beta = RegisterGetX(packetHit.beta);
+	return true;
+}
+
+bool SceneBvh::IsOccluded(const Ray& ray) const
+{
+	return OccludedPacket(SingleRayPacket(ray)) & 1;
+}
+
+int SceneBvh::IntersectPacket(const RayPacket& packet, RayPacketHit& hit) const
+{
+	hit.distance = packet.maxDistance;
+	hit.alpha = Number::R_ZERO;
+	hit.beta = Number::R_ZERO;
+	return TraversePacket<false>(packet, hit);
+}
+
+int SceneBvh::OccludedPacket(const RayPacket& packet) const
+{
+	RayPacketHit hit;
+	hit.distance = packet.maxDistance;
+	hit.alpha = Number::R_ZERO;
+	hit.beta = Number::R_ZERO;
+	return TraversePacket<true>(packet, hit);
+}
+
+unsigned int SceneBvh::OccludedLights(const Vector3 (&points)[4], const Vector3 (&normals)[4], const int& bits, const std::vector<PointLight>& lights, unsigned int (&shadowMasks)[4]) const
+{
+	const int lightNum = static_cast<int>(std::min<size_t>(lights.size(), SHADOW_LIGHT_NUM));
+	unsigned int rayNum = 0;
+
+	// The origins are offset along the normal, so the ray does not hit the surface it starts from.
+	alignas(16) float origins[3][4] = {};
+	for (int lane = 0; lane < 4; ++lane)
+	{
+		shadowMasks[lane] = 0;
+		if (bits & (1 << lane))
+		{
+			const Vector3& point = points[lane];
+			const float bias = SHADOW_RAY_BIAS * (1.f + std::max({ std::fabs(point.x), std::fabs(point.y), std::fabs(point.z) }));
+			const Vector3 origin = point + normals[lane] * bias;
+			origins[0][lane] = origin.x;
+			origins[1][lane] = origin.y;
+			origins[2][lane] = origin.z;
+		}
+	}
+
+	for (int lightIndex = 0; lightIndex < lightNum && bits; ++lightIndex)
+	{
+		const Vector3& location = lights[lightIndex].location;
+		alignas(16) float directions[3][4] = {};
+		int rayBits = 0;
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			if (!(bits & (1 << lane)))
+			{
+				continue;
+			}
+
+			// The light behind the surface needs no ray.
+			const Vector3 direction = location - Vector3(origins[0][lane], origins[1][lane], origins[2][lane]);
+			if ((direction | normals[lane]) <= 0.f)
+			{
+				shadowMasks[lane] |= 1u << lightIndex;
+				continue;
+			}
+			directions[0][lane] = direction.x;
+			directions[1][lane] = direction.y;
+			directions[2][lane] = direction.z;
+			rayBits |= 1 << lane;
+		}
+		if (!rayBits)
+		{
+			continue;
+		}
+
+		// The light is at the end of direction.
+		RayPacket packet;
+		packet.originX = RegisterLoadAligned(origins[0]);
+		packet.originY = RegisterLoadAligned(origins[1]);
+		packet.originZ = RegisterLoadAligned(origins[2]);
+		packet.directionX = RegisterLoadAligned(directions[0]);
+		packet.directionY = RegisterLoadAligned(directions[1]);
+		packet.directionZ = RegisterLoadAligned(directions[2]);
+		packet.maxDistance = Number::R_ONE;
+		packet.active = LaneMask(rayBits);
+
+		const int occludedBits = OccludedPacket(packet);
+		rayNum += std::popcount(static_cast<unsigned int>(rayBits));
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			shadowMasks[lane] |= ((occludedBits >> lane) & 1u) << lightIndex;
+		}
+	}
+	return rayNum;
+}
+
+template<bool bAnyHit>
+int SceneBvh::TraversePacket(const RayPacket& packet, RayPacketHit& hit) const
+{
+	const TopLevel& level = *topLevel;
+	if (level.nodes.empty())
+	{
+		return 0;
+	}
+
+	struct Entry
+	{
+		unsigned int node;
+		float distance;
+	};
+
+	const R128 invDirection[3] =
+	{
+		RegisterDivide(Number::R_ONE, packet.directionX),
+		RegisterDivide(Number::R_ONE, packet.directionY),
+		RegisterDivide(Number::R_ONE, packet.directionZ)
+	};
+	R128 active = packet.active;
+	int hitMask = 0;
+
+	Entry stack[MAX_DEPTH + 4];
+	int stackSize = 0;
+	{
+		R128 entry;
+		const R128 mask = RegisterAnd(IntersectBox(level.nodes[0].minimum, level.nodes[0].maximum, packet, invDirection, hit.distance, entry), active);
+		if (RegisterMaskBits(mask))
+		{
+			stack[stackSize++] = { 0, NearestEntry(mask, entry) };
+		}
+	}
+
+	while (stackSize > 0)
+	{
+		const auto [nodeIndex, distance] = stack[--stackSize];
+		if (distance > FarthestDistance(active, hit.distance))
+		{
+			continue;
+		}
+
+		const Node& node = level.nodes[nodeIndex];
+		if (node.count == 0)
+		{
+			// Visit the nearer child first.
+			R128 leftEntry, rightEntry;
+			const R128 leftMask = RegisterAnd(IntersectBox(level.nodes[node.first].minimum, level.nodes[node.first].maximum, packet, invDirection, hit.distance, leftEntry), active);
+			const R128 rightMask = RegisterAnd(IntersectBox(level.nodes[node.first + 1].minimum, level.nodes[node.first + 1].maximum, packet, invDirection, hit.distance, rightEntry), active);
+			const Entry left = { node.first, NearestEntry(leftMask, leftEntry) };
+			const Entry right = { node.first + 1, NearestEntry(rightMask, rightEntry) };
+			const bool bLeftFirst = left.distance <= right.distance;
+			const Entry& nearer = bLeftFirst ? left : right;
+			const Entry& farther = bLeftFirst ? right : left;
+			if (farther.distance != Number::FLOAT_INF)
+			{
+				stack[stackSize++] = farther;
+			}
+			if (nearer.distance != Number::FLOAT_INF)
+			{
+				stack[stackSize++] = nearer;
+			}
+			continue;
+		}
+
+		for (unsigned int index = node.first; index < node.first + node.count; ++index)
+		{
+			const unsigned int primitive = level.order[index];
+			const unsigned int mesh = level.primitives[primitive].mesh;
+			if (mesh >= meshHierarchies.size() || !meshHierarchies[mesh])
+			{
+				continue;
+			}
+
+			// The world box of primitive is tested before the packet is transformed into local space.
+			R128 entry;
+			const R128 mask = RegisterAnd(IntersectBox(level.minimums[primitive], level.maximums[primitive], packet, invDirection, hit.distance, entry), active);
+			if (!RegisterMaskBits(mask))
+			{
+				continue;
+			}
+
+			RayPacket local = packet.Transform(level.inverseTransforms[primitive]);
+			local.active = active;
+			const int bits = meshHierarchies[mesh]->Intersect<bAnyHit>(local, hit);
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				if (bits & (1 << lane))
+				{
+					hit.primitive[lane] = primitive;
+				}
+			}
+			hitMask |= bits;
+
+			if constexpr (bAnyHit)
+			{
+				active = RegisterAndNot(LaneMask(bits), active);
+				if (!RegisterMaskBits(active))
+				{
+					return hitMask;
+				}
+			}
+		}
+	}
+	return hitMask;
+}
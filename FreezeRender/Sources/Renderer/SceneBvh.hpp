@@ -0,0 +1,296 @@
+#pragma once
+
+#include <Core/Meshlet.hpp>
+#include <Core/Matrix.hpp>
+#include <Core/BoundingVolume.hpp>
+#include <Core/Light.hpp>
+#include <Renderer/WideBvh.hpp>
+#include <vector>
+#include <atomic>
+#include <memory>
+
+
+
+/**
+ * @brief The ray in world space, the hit distance is measured in the length of `direction`.
+ */
+struct Ray
+{
+	Vector3 origin;
+
+	Vector3 direction;
+
+	// The hit farther than it is ignored, e.g. the distance to light for shadow ray.
+	float maxDistance = Number::FLOAT_INF;
+};
+
+
+
+/**
+ * @brief The closest hit of a ray.
+ */
+struct RayHit
+{
+	// The distance in the length of ray direction.
+	float distance = Number::FLOAT_INF;
+
+	// The index of mesh in mesh buffer.
+	unsigned int mesh = 0;
+
+	// The index of instance in mesh, zero if the mesh has no instances.
+	unsigned int instance = 0;
+
+	// The first index of the hit triangle in index buffer of mesh.
+	unsigned int firstIndex = 0;
+
+	// The barycentric weights of the second and third vertices.
+	float alpha = 0.f;
+	float beta = 0.f;
+};
+
+
+
+/**
+ * @brief The bounding volume hierarchy over mesh instances in world space, built by binned SAH and refitted when transforms change.
+ *        The primitives follow the order of draws, every valid mesh contributes one primitive per instance.
+ *        Ray queries traverse the 4-ary hierarchy of every mesh built by `BuildMeshHierarchies()`, a single ray is traced as a packet of one lane.
+ *        A copy is a snapshot for the ray queries of a frame in flight, it shares the top level and the hierarchies of meshes without copying them.
+ */
+class SceneBvh
+{
+public:
+	// The number of bins along the widest axis of centroids.
+	static constexpr const int BIN_NUM = 16;
+
+	// The leaf is not split if it has no more primitives.
+	static constexpr const unsigned int LEAF_PRIMITIVE_NUM = 4;
+
+	// The node with more primitives is binned and split in parallel.
+	static constexpr const unsigned int PARALLEL_PRIMITIVE_NUM = 4096;
+
+	// The deeper node is always a leaf, bounds the traversal stack.
+	static constexpr const int MAX_DEPTH = 60;
+
+	// The offset of shadow ray along the surface normal, relative to the magnitude of the surface point.
+	// It is large enough to hide the self shadowing of interpolated normals on coarse meshes.
+	static constexpr const float SHADOW_RAY_BIAS = 3e-3f;
+
+	// The number of lights a shadow mask holds.
+	static constexpr const int SHADOW_LIGHT_NUM = 32;
+
+	/**
+	 * @brief The node of hierarchy, the children of an interior node are adjacent and always stored after it.
+	 */
+	struct Node
+	{
+		Vector3 minimum;
+
+		// The first child of an interior node, or the first entry of `order` of a leaf.
+		unsigned int first = 0;
+
+		Vector3 maximum;
+
+		// The number of primitives of a leaf, zero for an interior node.
+		unsigned int count = 0;
+	};
+
+	/**
+	 * @brief One instance of a mesh.
+	 */
+	struct Primitive
+	{
+		unsigned int mesh;
+		unsigned int instance;
+	};
+
+	/**
+	 * @brief The hierarchy over primitives with their transforms and boxes.
+	 */
+	struct TopLevel
+	{
+		std::vector<Node> nodes;
+
+		// Indexed by the order of draws.
+		std::vector<Primitive> primitives;
+		std::vector<Matrix> transforms;
+		std::vector<Matrix> inverseTransforms;
+		std::vector<unsigned long long> geometryVersions;
+		std::vector<Vector3> minimums;
+		std::vector<Vector3> maximums;
+
+		// The primitives in the order of leaves.
+		std::vector<unsigned int> order;
+	};
+
+private:
+	// Never changed while a snapshot shares it, a rebuild replaces it and a refit copies it first.
+	std::shared_ptr<const TopLevel> topLevel = std::make_shared<const TopLevel>();
+
+	// The hierarchies over triangles of meshes in local space, indexed by mesh, null for the invalid mesh.
+	// A stale one is replaced rather than rebuilt in place, so the snapshots keep theirs.
+	std::vector<std::shared_ptr<const WideBvh>> meshHierarchies;
+
+	// The scene of last update, ray queries are valid until the mesh buffer changes.
+	const std::vector<Meshlet>* meshes = nullptr;
+
+	// The time of last update in milliseconds.
+	float updateTime = 0.f;
+
+	// The number of primitives whose transform changed in last refit.
+	unsigned int refittedPrimitiveNum = 0;
+
+	bool bRebuilt = false;
+
+public:
+	const std::vector<Node>& GetNodes() const { return topLevel->nodes; }
+
+	const std::vector<Primitive>& GetPrimitives() const { return topLevel->primitives; }
+
+	float GetUpdateTime() const { return updateTime; }
+
+	unsigned int GetRefittedPrimitiveNum() const { return refittedPrimitiveNum; }
+
+	bool IsRebuilt() const { return bRebuilt; }
+
+	const Matrix& GetTransform(const unsigned int& primitive) const { return topLevel->transforms[primitive]; }
+
+	const Matrix& GetInverseTransform(const unsigned int& primitive) const { return topLevel->inverseTransforms[primitive]; }
+
+	/**
+	 * @brief Rebuild the hierarchy if any mesh or instance is added or removed, otherwise refit the primitives whose transform or geometry changed.
+	 *        Call it after the clusters of meshes are built.
+	 */
+	void Update(const std::vector<Meshlet>& inMeshes);
+
+	/**
+	 * @brief Build the hierarchy from scratch.
+	 */
+	void Build(const std::vector<Meshlet>& inMeshes);
+
+	/**
+	 * @brief Update the boxes of primitives whose transform or geometry changed, then only their ancestors are refitted.
+	 */
+	void Refit();
+
+	/**
+	 * @brief Build the hierarchies of meshes that are missing or stale in parallel, call it after `Update()` before ray queries.
+	 */
+	void BuildMeshHierarchies();
+
+	/**
+	 * @brief Visit the primitives not outside the frustum in world space, `visitor(primitive, containment)`.
+	 *        The subtree inside the frustum is visited without further tests.
+	 */
+	template<typename Visitor>
+	void CullFrustum(const Frustum& frustum, Visitor&& visitor) const;
+
+	/**
+	 * @brief Find the closest hit of ray, returns false if nothing is hit.
+	 *        The meshes without hierarchy are not hit.
+	 */
+	warn_nodiscard bool Intersect(const Ray& ray, RayHit& hit) const;
+
+	/**
+	 * @brief Determines whether anything is hit by the ray, stops at the first hit.
+	 */
+	warn_nodiscard bool IsOccluded(const Ray& ray) const;
+
+	/**
+	 * @brief Find the closest hits of the active lanes of packet, returns the mask bits of lanes hit.
+	 */
+	int IntersectPacket(const RayPacket& packet, RayPacketHit& hit) const;
+
+	/**
+	 * @brief Determines whether anything is hit by the active lanes of packet, returns the mask bits of lanes occluded.
+	 *        A lane stops at its first hit, and the packet stops once every lane is occluded.
+	 */
+	warn_nodiscard int OccludedPacket(const RayPacket& packet) const;
+
+	/**
+	 * @brief Trace shadow rays from up to 4 surface points in world space to the first 32 lights, one packet per light.
+	 *        Only the lanes set in `bits` are traced, the bit of light is set in `shadowMasks` if it is occluded or behind the surface.
+	 *        Returns the number of shadow rays traced.
+	 */
+	unsigned int OccludedLights(const Vector3 (&points)[4], const Vector3 (&normals)[4], const int& bits, const std::vector<PointLight>& lights, unsigned int (&shadowMasks)[4]) const;
+
+private:
+	/**
+	 * @brief Determines whether the transform or the geometry of mesh changed since the primitive was updated.
+	 */
+	warn_nodiscard bool IsPrimitiveStale(const unsigned int& index) const;
+
+	/**
+	 * @brief Update the transform and world box of primitive in the top level.
+	 */
+	void UpdatePrimitive(TopLevel& level, const unsigned int& index) const;
+
+	/**
+	 * @brief Build the subtree of node from the primitives `order[begin, end)`.
+	 */
+	static void BuildNode(TopLevel& level, const unsigned int& nodeIndex, const unsigned int& begin, const unsigned int& end, const int& depth, std::atomic<unsigned int>& nodeNum);
+
+	/**
+	 * @brief Traverse the nodes hit by any active lane of packet, the leaves transform the packet into the local space of meshes.
+	 */
+	template<bool bAnyHit>
+	int TraversePacket(const RayPacket& packet, RayPacketHit& hit) const;
+};
+
+
+
+#ifndef SCENEBVH_HPP_SCENEBVH_IMPL
+#define SCENEBVH_HPP_SCENEBVH_IMPL
+
+	template<typename Visitor>
+	void SceneBvh::CullFrustum(const Frustum& frustum, Visitor&& visitor) const
+	{
+		const std::vector<Node>& nodes = topLevel->nodes;
+		if (nodes.empty())
+		{
+			return;
+		}
+
+		struct Entry
+		{
+			unsigned int node;
+			bool bInside;
+		};
+		Entry stack[64];
+		int stackSize = 0;
+		stack[stackSize++] = { 0, false };
+		while (stackSize > 0)
+		{
+			const auto [nodeIndex, bParentInside] = stack[--stackSize];
+			const Node& node = nodes[nodeIndex];
+
+			Frustum::Containment containment = Frustum::Containment::Inside;
+			if (!bParentInside)
+			{
+				BoundingVolume volume;
+				volume.minimum = node.minimum;
+				volume.maximum = node.maximum;
+				volume.UpdateCenter();
+				volume.radius = ((node.maximum - node.minimum) * 0.5f).Length();
+				containment = frustum.Test(volume);
+				if (containment == Frustum::Containment::Outside)
+				{
+					continue;
+				}
+			}
+
+			const bool bInside = containment == Frustum::Containment::Inside;
+			if (node.count == 0)
+			{
+				stack[stackSize++] = { node.first + 1, bInside };
+				stack[stackSize++] = { node.first, bInside };
+				continue;
+			}
+
+			for (unsigned int index = node.first; index < node.first + node.count; ++index)
+			{
+				visitor(topLevel->order[index], containment);
+			}
+		}
+	}
+
+#endif // !SCENEBVH_HPP_SCENEBVH_IMPL
@@ -0,0 +1,358 @@
+#include "ShadowMap.hpp"
+#include "HalfSpaceRaster.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ppl.h>
+
+
+
+namespace
+{
+	/**
+	 * @brief The axes of a cube face, the face looks along `forward`.
+	 */
+	struct FaceBasis
+	{
+		Vector3 right;
+		Vector3 up;
+		Vector3 forward;
+	};
+
+	// [ +x, -x, +y, -y, +z, -z ]
+	static const FaceBasis FACE_BASES[ShadowMap::FACE_NUM] =
+	{
+		{ {  0.f, 0.f, -1.f }, { 0.f, 1.f,  0.f }, {  1.f,  0.f,  0.f } },
+		{ {  0.f, 0.f,  1.f }, { 0.f, 1.f,  0.f }, { -1.f,  0.f,  0.f } },
+		{ {  1.f, 0.f,  0.f }, { 0.f, 0.f, -1.f }, {  0.f,  1.f,  0.f } },
+		{ {  1.f, 0.f,  0.f }, { 0.f, 0.f,  1.f }, {  0.f, -1.f,  0.f } },
+		{ {  1.f, 0.f,  0.f }, { 0.f, 1.f,  0.f }, {  0.f,  0.f,  1.f } },
+		{ { -1.f, 0.f,  0.f }, { 0.f, 1.f,  0.f }, {  0.f,  0.f, -1.f } },
+	};
+
+	/**
+	 * @brief The transform from world space to the face space of light, [ right, up, forward ].
+	 */
+	force_inline Matrix MakeFaceView(const FaceBasis& basis, const Vector3& location)
+	{
+		Matrix view = Matrix::Identity;
+		const Vector3* axes[3] = { &basis.right, &basis.up, &basis.forward };
+		for (int row = 0; row < 3; ++row)
+		{
+			view.m[row][0] = axes[row]->x;
+			view.m[row][1] = axes[row]->y;
+			view.m[row][2] = axes[row]->z;
+			view.m[row][3] = -(*axes[row] | location);
+		}
+		return view;
+	}
+
+	/**
+	 * @brief The clip matrix of face for frustum culling, the same convention as camera, which looks at -z with negative w.
+	 */
+	force_inline Matrix MakeFaceClip(const Matrix& view, const float& farPlane)
+	{
+		const float& n = ShadowMap::NEAR_PLANE;
+		const float& f = farPlane;
+		Matrix clip = view;
+		for (int column = 0; column < 4; ++column)
+		{
+			clip.m[2][column] = view.m[2][column] * (f + n) / (f - n);
+			clip.m[3][column] = -view.m[2][column];
+		}
+		clip.m[2][3] -= 2.f * f * n / (f - n);
+		return clip;
+	}
+
+	/**
+	 * @brief The guard band of face, the point is kept if |x| and |y| are at most this times its distance.
+	 *        It keeps the projected vertex inside the range of fixed point rasterization.
+	 */
+	constexpr const static float GUARD_BAND = 2.f * HalfSpaceRaster::GUARD_BAND_LIMIT / ShadowMap::RESOLUTION - 1.f;
+
+	// The near plane and the 4 planes of guard band.
+	constexpr const static int CLIPPING_PLANE_NUM = 5;
+
+	/**
+	 * @brief The signed distance of face space point to the clipping plane, the inside is non-negative.
+	 */
+	force_inline float ClippingDistance(const Vector4& position, const int& plane)
+	{
+		switch (plane)
+		{
+		case 0: return position.z - ShadowMap::NEAR_PLANE;
+		case 1: return position.z * GUARD_BAND - position.x;
+		case 2: return position.z * GUARD_BAND + position.x;
+		case 3: return position.z * GUARD_BAND - position.y;
+		default: return position.z * GUARD_BAND + position.y;
+		}
+	}
+
+	/**
+	 * @brief From face space to the texel space, [ x, y, unused, distance ], so that the interpolated 1 / w is 1 / distance.
+	 */
+	force_inline Vector4 Project(const Vector4& position)
+	{
+		const float invDistance = 1.f / position.z;
+		return {
+			(position.x * invDistance * 0.5f + 0.5f) * ShadowMap::RESOLUTION,
+			(position.y * invDistance * 0.5f + 0.5f) * ShadowMap::RESOLUTION,
+			0.f,
+			position.z
+		};
+	}
+
+	/**
+	 * @brief The vertex of face, transformed once and shared by its triangles.
+	 */
+	struct FaceVertex
+	{
+		// In the face space.
+		Vector4 position;
+
+		// In the texel space, valid if the vertex is inside all planes.
+		Vector4 projected;
+
+		// The bit of every clipping plane outside.
+		int outcode;
+	};
+
+	force_inline FaceVertex MakeFaceVertex(const Vector4& position)
+	{
+		FaceVertex vertex = { position, {}, 0 };
+		for (int plane = 0; plane < CLIPPING_PLANE_NUM; ++plane)
+		{
+			vertex.outcode |= (ClippingDistance(position, plane) < 0.f) << plane;
+		}
+		if (vertex.outcode == 0)
+		{
+			vertex.projected = Project(position);
+		}
+		return vertex;
+	}
+}
+
+
+
+void ShadowMap::Invalidate()
+{
+	cubes.clear();
+}
+
+void ShadowMap::Update(const std::vector<Meshlet>& meshes, const SceneBvh& sceneBvh, const std::vector<PointLight>& lights, const bool& bGeometryChanged)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	// The lights moved or not rendered yet.
+	const int lightNum = static_cast<int>(std::min<size_t>(lights.size(), LIGHT_NUM));
+	cubes.resize(lightNum);
+	Cube* dirtyCubes[LIGHT_NUM];
+	int dirtyNum = 0;
+	for (int lightIndex = 0; lightIndex < lightNum; ++lightIndex)
+	{
+		std::shared_ptr<const Cube>& cached = cubes[lightIndex];
+		const Vector3& location = lights[lightIndex].location;
+		if (!bGeometryChanged && cached && std::memcmp(&cached->location, &location, sizeof(Vector3)) == 0)
+		{
+			continue;
+		}
+
+		// The map only held here is rendered in place, the one shared with a snapshot of frame in flight is left to it.
+		std::shared_ptr<Cube> cube = cached.use_count() == 1 ? std::const_pointer_cast<Cube>(cached) : std::make_shared<Cube>();
+		cube->location = location;
+		for (int face = 0; face < FACE_NUM; ++face)
+		{
+			cube->views[face] = MakeFaceView(FACE_BASES[face], location);
+		}
+		dirtyCubes[dirtyNum++] = cube.get();
+		cached = std::move(cube);
+	}
+
+	Concurrency::parallel_for(0, dirtyNum * FACE_NUM, [&](const int& task)
+	{
+		RenderFace(*dirtyCubes[task / FACE_NUM], task % FACE_NUM, meshes, sceneBvh);
+	});
+
+	renderedFaceNum = dirtyNum * FACE_NUM;
+	updateTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+float ShadowMap::SampleVisibility(const int& lightIndex, const Vector3& point, const Vector3& normal) const
+{
+	if (lightIndex >= static_cast<int>(cubes.size()) || !cubes[lightIndex])
+	{
+		return 1.f;
+	}
+
+	// The face of the major axis, the receiver is offset by the size of texels at its distance.
+	const Cube& cube = *cubes[lightIndex];
+	const Vector3 direction = point - cube.location;
+	const float x = std::fabs(direction.x), y = std::fabs(direction.y), z = std::fabs(direction.z);
+	const int face =
+		x >= y && x >= z ? (direction.x > 0.f ? 0 : 1) :
+		y >= z ? (direction.y > 0.f ? 2 : 3) : (direction.z > 0.f ? 4 : 5);
+	const float major = x >= y && x >= z ? x : (y >= z ? y : z);
+	const Vector3 receiver = direction + normal * (NORMAL_OFFSET * 2.f / RESOLUTION * major);
+
+	// The face space is an axis permutation of world space, no need of the full transform.
+	const FaceBasis& basis = FACE_BASES[face];
+	const float forward = basis.forward | receiver;
+	if (forward <= NEAR_PLANE)
+	{
+		return 1.f;
+	}
+	const float invDistance = 1.f / forward;
+	const float scale = invDistance * (0.5f * RESOLUTION);
+
+	// The 4 x 4 texels around the point, the bilinear weights of 3 x 3 taps are [ 1 - f, 1, 1, f ] on both axes.
+	const float u = (basis.right | receiver) * scale + (0.5f * RESOLUTION - 0.5f);
+	const float v = (basis.up | receiver) * scale + (0.5f * RESOLUTION - 0.5f);
+	const float floorU = std::floor(u);
+	const float floorV = std::floor(v);
+	const float fractionU = u - floorU;
+	const float fractionV = v - floorV;
+	const int x0 = std::clamp(static_cast<int>(floorU) - 1, 0, RESOLUTION - 4);
+	const int y0 = std::clamp(static_cast<int>(floorV) - 1, 0, RESOLUTION - 4);
+
+	// Lit if the caster is not closer, the greater value is closer.
+	const R128 reference = MakeRegister(invDistance * (1.f + DEPTH_BIAS));
+	const R128 weightX = MakeRegister(1.f - fractionU, 1.f, 1.f, fractionU);
+	const float weightY[4] = { 1.f - fractionV, 1.f, 1.f, fractionV };
+
+	const float* depth = cube.faces[face].data() + y0 * RESOLUTION + x0;
+	R128 lit = Number::R_ZERO;
+	for (int row = 0; row < 4; ++row)
+	{
+		const R128 mask = RegisterLE(RegisterLoad(depth + row * RESOLUTION), reference);
+		lit = RegisterMultiplyAdd(RegisterAnd(mask, weightX), MakeRegister(weightY[row]), lit);
+	}
+	return RegisterSum(lit) / 9.f;
+}
+
+void ShadowMap::RenderFace(Cube& cube, const int& face, const std::vector<Meshlet>& meshes, const SceneBvh& sceneBvh)
+{
+	std::vector<float>& depth = cube.faces[face];
+	depth.assign(RESOLUTION * RESOLUTION, 0.f);
+
+	const auto& nodes = sceneBvh.GetNodes();
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	// The far plane reaches the farthest corner of scene.
+	float farPlane = 2.f * NEAR_PLANE;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const Vector3 point = {
+			corner & 1 ? nodes[0].maximum.x : nodes[0].minimum.x,
+			corner & 2 ? nodes[0].maximum.y : nodes[0].minimum.y,
+			corner & 4 ? nodes[0].maximum.z : nodes[0].minimum.z };
+		farPlane = std::max(farPlane, (point - cube.location).Length());
+	}
+
+	const Matrix& view = cube.views[face];
+	const Matrix clip = MakeFaceClip(view, farPlane);
+
+	// The part of triangle inside the near plane and the guard band, each plane adds at most one vertex.
+	HalfSpaceRaster::DepthBatch<false> batch(depth.data(), RESOLUTION, RESOLUTION);
+	auto DrawTriangle = [&batch](const FaceVertex& a, const FaceVertex& b, const FaceVertex& c)
+	{
+		if (a.outcode & b.outcode & c.outcode)
+		{
+			return;
+		}
+		const int crossed = a.outcode | b.outcode | c.outcode;
+		if (crossed == 0)
+		{
+			batch.Append(a.projected, b.projected, c.projected);
+			return;
+		}
+
+		// Clip against the crossed planes, two buffers are used alternately.
+		Vector4 buffers[2][3 + CLIPPING_PLANE_NUM] = { { a.position, b.position, c.position } };
+		Vector4* polygon = buffers[0];
+		Vector4* clipped = buffers[1];
+		int vertexNum = 3;
+		for (int plane = 0; plane < CLIPPING_PLANE_NUM; ++plane)
+		{
+			if (!(crossed & (1 << plane)))
+			{
+				continue;
+			}
+
+			int clippedNum = 0;
+			for (int vertex = 0; vertex < vertexNum; ++vertex)
+			{
+				const Vector4& v1 = polygon[vertex];
+				const Vector4& v2 = polygon[vertex + 1 == vertexNum ? 0 : vertex + 1];
+				const float d1 = ClippingDistance(v1, plane);
+				const float d2 = ClippingDistance(v2, plane);
+				if (d1 >= 0.f)
+				{
+					clipped[clippedNum++] = v1;
+				}
+				if ((d1 < 0.f) != (d2 < 0.f))
+				{
+					clipped[clippedNum++] = v1 + (v2 - v1) * (d1 / (d1 - d2));
+				}
+			}
+			std::swap(polygon, clipped);
+			vertexNum = clippedNum;
+			if (vertexNum < 3)
+			{
+				return;
+			}
+		}
+
+		const Vector4 first = Project(polygon[0]);
+		for (int vertex = 2; vertex < vertexNum; ++vertex)
+		{
+			batch.Append(first, Project(polygon[vertex - 1]), Project(polygon[vertex]));
+		}
+	};
+
+	// The vertices of face, reused by instances.
+	std::vector<FaceVertex> vertices;
+	sceneBvh.CullFrustum(Frustum::FromMatrix(clip), [&](const unsigned int& primitive, const Frustum::Containment& containment)
+	{
+		const Meshlet& mesh = meshes[sceneBvh.GetPrimitives()[primitive].mesh];
+		const Matrix& transform = sceneBvh.GetTransform(primitive);
+		const Matrix local = view * transform;
+		vertices.resize(mesh.vertices.size());
+		for (size_t index = 0; index < mesh.vertices.size(); ++index)
+		{
+			vertices[index] = MakeFaceVertex(local * Vector4(mesh.vertices[index].position, 1.f));
+		}
+
+		// The clusters of full detail level outside the face are skipped.
+		const Frustum frustum = Frustum::FromMatrix(clip * transform);
+		auto DrawRange = [&](const unsigned int& firstIndex, const unsigned int& indexNum)
+		{
+			for (unsigned int index = firstIndex; index < firstIndex + indexNum; index += 3)
+			{
+				DrawTriangle(
+					vertices[mesh.indices[index + 0].index],
+					vertices[mesh.indices[index + 1].index],
+					vertices[mesh.indices[index + 2].index]);
+			}
+		};
+
+		if (mesh.lods.empty())
+		{
+			DrawRange(0, mesh.GetIndexNum());
+			return;
+		}
+		const MeshletLod& lod = mesh.lods[0];
+		for (unsigned int clusterIndex = lod.firstCluster; clusterIndex < lod.firstCluster + lod.clusterNum; ++clusterIndex)
+		{
+			const MeshletCluster& cluster = mesh.clusters[clusterIndex];
+			if (containment == Frustum::Containment::Inside || frustum.Test(cluster.bounds) != Frustum::Containment::Outside)
+			{
+				DrawRange(cluster.firstIndex, cluster.indexNum);
+			}
+		}
+	});
+	batch.Flush();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Core/Meshlet.hpp>
+#include <Core/Matrix.hpp>
+#include <Core/Light.hpp>
+#include <Core/BoundingVolume.hpp>
+#include <Renderer/SceneBvh.hpp>
+#include <vector>
+#include <memory>
+
+
+
+/**
+ * @brief The cube shadow maps of point lights, rendered by the fixed point half-space rasterizer of the raster passes.
+ *        Every face looks along one axis with 90 degrees field of view, the texel keeps 1 / distance along the axis,
+ *        so the closer one is greater and the empty texel is zero. The rows are stored from bottom to top.
+ *        The maps are cached, a light is rendered again only if it moved or the geometry changed.
+ *        A copy is a snapshot sharing the maps, the map still referenced by a snapshot is never rendered in place.
+ */
+class ShadowMap
+{
+public:
+	// The resolution of every face, in texels.
+	static constexpr const int RESOLUTION = 512;
+
+	// The number of faces of a cube.
+	static constexpr const int FACE_NUM = 6;
+
+	// The distance of near plane from light, the closer part of triangle is clipped.
+	static constexpr const float NEAR_PLANE = 0.05f;
+
+	// The number of lights casting shadows, the same as the shadow masks of the deferred shader.
+	static constexpr const int LIGHT_NUM = SceneBvh::SHADOW_LIGHT_NUM;
+
+	// The relative depth bias of comparison, the receiver is lit if it is not farther than the caster by this fraction.
+	static constexpr const float DEPTH_BIAS = 0.01f;
+
+	// The offset of receiver along the surface normal, in texels at its distance.
+	static constexpr const float NORMAL_OFFSET = 1.f;
+
+	/**
+	 * @brief The shadow map of one light.
+	 */
+	struct Cube
+	{
+		// The location of light when rendered.
+		Vector3 location;
+
+		// From world space to the face space, [ right, up, forward ] along the face.
+		Matrix views[FACE_NUM];
+
+		// The depth of faces, `RESOLUTION * RESOLUTION` texels per face.
+		std::vector<float> faces[FACE_NUM];
+	};
+
+private:
+	// Null if the light is not rendered yet.
+	std::vector<std::shared_ptr<const Cube>> cubes;
+
+	// The time of last update in milliseconds.
+	float updateTime = 0.f;
+
+	// The number of faces rendered in last update, zero if every map is cached.
+	unsigned int renderedFaceNum = 0;
+
+public:
+	float GetUpdateTime() const { return updateTime; }
+
+	unsigned int GetRenderedFaceNum() const { return renderedFaceNum; }
+
+	/**
+	 * @brief Drop the cached maps, every light is rendered in next update.
+	 */
+	void Invalidate();
+
+	/**
+	 * @brief Render the maps of lights which moved, or all of them if `bGeometryChanged`, the faces are rendered in parallel.
+	 *        `sceneBvh` is updated from `meshes`, its instances are culled by the frustum of every face.
+	 *        The map shared with a snapshot is rendered into a new one, the snapshot keeps the old one.
+	 */
+	void Update(const std::vector<Meshlet>& meshes, const SceneBvh& sceneBvh, const std::vector<PointLight>& lights, const bool& bGeometryChanged);
+
+	/**
+	 * @brief The fraction of light reaching the point in world space, filtered by 3 x 3 bilinear PCF.
+	 *        The 4 x 4 texels of filter are compared 4 at a time, `normal` offsets the point to avoid self shadowing.
+	 */
+	warn_nodiscard float SampleVisibility(const int& lightIndex, const Vector3& point, const Vector3& normal) const;
+
+private:
+	/**
+	 * @brief Render the triangles of instances inside the frustum of face, the far plane reaches the farthest corner of scene.
+	 */
+	void RenderFace(Cube& cube, const int& face, const std::vector<Meshlet>& meshes, const SceneBvh& sceneBvh);
+};
@@ -0,0 +1,396 @@
+#include "WideBvh.hpp"
+#include <algorithm>
+#include <numeric>
+
+
+
+namespace
+{
+	force_inline float Component(const Vector3& vector, const int& axis)
+	{
+		return axis == 0 ? vector.x : (axis == 1 ? vector.y : vector.z);
+	}
+
+	force_inline Vector3 ComponentMin(const Vector3& a, const Vector3& b)
+	{
+		return { std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z) };
+	}
+
+	force_inline Vector3 ComponentMax(const Vector3& a, const Vector3& b)
+	{
+		return { std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z) };
+	}
+
+	force_inline float HalfArea(const Vector3& minimum, const Vector3& maximum)
+	{
+		const Vector3 extent = maximum - minimum;
+		return extent.x < 0.f ? 0.f : extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	force_inline float HorizontalMin(const R128& reg)
+	{
+		const R128 result = RegisterMin(reg, RegisterSwizzle(reg, 1, 0, 3, 2));
+		return RegisterGetX(RegisterMin(result, RegisterSwizzle(result, 2, 3, 0, 1)));
+	}
+
+	force_inline float HorizontalMax(const R128& reg)
+	{
+		const R128 result = RegisterMax(reg, RegisterSwizzle(reg, 1, 0, 3, 2));
+		return RegisterGetX(RegisterMax(result, RegisterSwizzle(result, 2, 3, 0, 1)));
+	}
+}
+
+
+
+struct WideBvh::BuildContext
+{
+	std::vector<unsigned int> order;
+	std::vector<Vector3> minimums;
+	std::vector<Vector3> maximums;
+	std::vector<Vector3> centroids;
+};
+
+void WideBvh::Build(const Meshlet& mesh)
+{
+	sourceIndices = mesh.indices.data();
+	sourceIndexNum = mesh.GetIndexNum();
+	sourceVersion = mesh.GetGeometryVersion();
+
+	const unsigned int triangleNum = sourceIndexNum / 3;
+	std::vector<Triangle> source(triangleNum);
+	BuildContext context;
+	context.order.resize(triangleNum);
+	context.minimums.resize(triangleNum);
+	context.maximums.resize(triangleNum);
+	context.centroids.resize(triangleNum);
+	std::iota(context.order.begin(), context.order.end(), 0u);
+	for (unsigned int index = 0; index < triangleNum; ++index)
+	{
+		const Vector3& a = mesh.indices[index * 3 + 0].ptr->position;
+		const Vector3& b = mesh.indices[index * 3 + 1].ptr->position;
+		const Vector3& c = mesh.indices[index * 3 + 2].ptr->position;
+		source[index] = { a, b - a, c - a, index * 3 };
+		context.minimums[index] = ComponentMin(ComponentMin(a, b), c);
+		context.maximums[index] = ComponentMax(ComponentMax(a, b), c);
+		context.centroids[index] = context.minimums[index] + context.maximums[index];
+	}
+
+	nodes.clear();
+	triangles.clear();
+	if (triangleNum == 0)
+	{
+		return;
+	}
+
+	nodes.reserve(triangleNum / 2 + 1);
+	BuildNode(context, 0, triangleNum, 0);
+
+	// The leaves refer to the triangles by the order of build.
+	triangles.resize(triangleNum);
+	for (unsigned int index = 0; index < triangleNum; ++index)
+	{
+		triangles[index] = source[context.order[index]];
+	}
+}
+
+unsigned int WideBvh::BuildNode(BuildContext& context, const unsigned int& begin, const unsigned int& end, const int& depth)
+{
+	struct Range
+	{
+		unsigned int begin;
+		unsigned int end;
+	};
+
+	// Split the largest range until the node is full.
+	Range ranges[WIDTH] = { { begin, end } };
+	int rangeNum = 1;
+	while (rangeNum < WIDTH)
+	{
+		int largest = -1;
+		for (int index = 0; index < rangeNum; ++index)
+		{
+			const unsigned int count = ranges[index].end - ranges[index].begin;
+			if (count > LEAF_TRIANGLE_NUM && (largest < 0 || count > ranges[largest].end - ranges[largest].begin))
+			{
+				largest = index;
+			}
+		}
+		if (largest < 0)
+		{
+			break;
+		}
+
+		const unsigned int middle = SplitRange(context, ranges[largest].begin, ranges[largest].end, depth);
+		ranges[rangeNum++] = { middle, ranges[largest].end };
+		ranges[largest].end = middle;
+	}
+
+	const unsigned int nodeIndex = static_cast<unsigned int>(nodes.size());
+	nodes.emplace_back();
+	for (int slot = 0; slot < WIDTH; ++slot)
+	{
+		if (slot >= rangeNum)
+		{
+			Node& node = nodes[nodeIndex];
+			node.minimumX[slot] = node.minimumY[slot] = node.minimumZ[slot] = Number::FLOAT_INF;
+			node.maximumX[slot] = node.maximumY[slot] = node.maximumZ[slot] = Number::FLOAT_NEG_INF;
+			node.first[slot] = EMPTY_SLOT;
+			node.count[slot] = 0;
+			continue;
+		}
+
+		const Range& range = ranges[slot];
+		Vector3 minimum = Number::FLOAT_INF;
+		Vector3 maximum = Number::FLOAT_NEG_INF;
+		for (unsigned int index = range.begin; index < range.end; ++index)
+		{
+			minimum = ComponentMin(minimum, context.minimums[context.order[index]]);
+			maximum = ComponentMax(maximum, context.maximums[context.order[index]]);
+		}
+
+		const unsigned int count = range.end - range.begin;
+		const unsigned int child = count > LEAF_TRIANGLE_NUM ? BuildNode(context, range.begin, range.end, depth + 1) : range.begin;
+
+		// The child is built before, so the node is fetched again after the buffer grows.
+		Node& node = nodes[nodeIndex];
+		node.minimumX[slot] = minimum.x;
+		node.minimumY[slot] = minimum.y;
+		node.minimumZ[slot] = minimum.z;
+		node.maximumX[slot] = maximum.x;
+		node.maximumY[slot] = maximum.y;
+		node.maximumZ[slot] = maximum.z;
+		node.first[slot] = child;
+		node.count[slot] = count > LEAF_TRIANGLE_NUM ? 0 : count;
+	}
+	return nodeIndex;
+}
+
+unsigned int WideBvh::SplitRange(BuildContext& context, const unsigned int& begin, const unsigned int& end, const int& depth)
+{
+	Vector3 centroidMinimum = Number::FLOAT_INF;
+	Vector3 centroidMaximum = Number::FLOAT_NEG_INF;
+	for (unsigned int index = begin; index < end; ++index)
+	{
+		centroidMinimum = ComponentMin(centroidMinimum, context.centroids[context.order[index]]);
+		centroidMaximum = ComponentMax(centroidMaximum, context.centroids[context.order[index]]);
+	}
+
+	const Vector3 extent = centroidMaximum - centroidMinimum;
+	const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	const float axisMinimum = Component(centroidMinimum, axis);
+	const float axisExtent = Component(extent, axis);
+	unsigned int* const first = context.order.data() + begin;
+	unsigned int* const last = context.order.data() + end;
+
+	if (depth < MAX_SAH_DEPTH && axisExtent > 0.f)
+	{
+		const float scale = BIN_NUM / axisExtent;
+		auto BinIndex = [&context, axis, axisMinimum, scale](const unsigned int& triangle)
+		{
+			return std::min(static_cast<int>((Component(context.centroids[triangle], axis) - axisMinimum) * scale), BIN_NUM - 1);
+		};
+
+		Vector3 binMinimums[BIN_NUM], binMaximums[BIN_NUM];
+		unsigned int binCounts[BIN_NUM] = {};
+		std::fill(binMinimums, binMinimums + BIN_NUM, Vector3(Number::FLOAT_INF));
+		std::fill(binMaximums, binMaximums + BIN_NUM, Vector3(Number::FLOAT_NEG_INF));
+		for (unsigned int index = begin; index < end; ++index)
+		{
+			const unsigned int triangle = context.order[index];
+			const int bin = BinIndex(triangle);
+			binMinimums[bin] = ComponentMin(binMinimums[bin], context.minimums[triangle]);
+			binMaximums[bin] = ComponentMax(binMaximums[bin], context.maximums[triangle]);
+			++binCounts[bin];
+		}
+
+		// The cost of splitting after every bin, swept from both sides.
+		float rightCosts[BIN_NUM];
+		{
+			Vector3 minimum = Number::FLOAT_INF, maximum = Number::FLOAT_NEG_INF;
+			unsigned int number = 0;
+			for (int bin = BIN_NUM - 1; bin > 0; --bin)
+			{
+				minimum = ComponentMin(minimum, binMinimums[bin]);
+				maximum = ComponentMax(maximum, binMaximums[bin]);
+				number += binCounts[bin];
+				rightCosts[bin - 1] = HalfArea(minimum, maximum) * number;
+			}
+		}
+
+		int split = -1;
+		float bestCost = Number::FLOAT_INF;
+		{
+			Vector3 minimum = Number::FLOAT_INF, maximum = Number::FLOAT_NEG_INF;
+			unsigned int number = 0;
+			for (int bin = 0; bin < BIN_NUM - 1; ++bin)
+			{
+				minimum = ComponentMin(minimum, binMinimums[bin]);
+				maximum = ComponentMax(maximum, binMaximums[bin]);
+				number += binCounts[bin];
+				const float cost = HalfArea(minimum, maximum) * number + rightCosts[bin];
+				if (number > 0 && number < end - begin && cost < bestCost)
+				{
+					bestCost = cost;
+					split = bin;
+				}
+			}
+		}
+
+		if (split >= 0)
+		{
+			unsigned int* const middle = std::partition(first, last, [&BinIndex, split](const unsigned int& triangle)
+			{
+				return BinIndex(triangle) <= split;
+			});
+			return static_cast<unsigned int>(middle - context.order.data());
+		}
+	}
+
+	unsigned int* const middle = first + (end - begin) / 2;
+	std::nth_element(first, middle, last, [&context, axis](const unsigned int& lhs, const unsigned int& rhs)
+	{
+		return Component(context.centroids[lhs], axis) < Component(context.centroids[rhs], axis);
+	});
+	return static_cast<unsigned int>(middle - context.order.data());
+}
+
+template<bool bAnyHit>
+int WideBvh::Intersect(const RayPacket& packet, RayPacketHit& hit) const
+{
+	if (nodes.empty())
+	{
+		return 0;
+	}
+
+	const R128 invDirectionX = RegisterDivide(Number::R_ONE, packet.directionX);
+	const R128 invDirectionY = RegisterDivide(Number::R_ONE, packet.directionY);
+	const R128 invDirectionZ = RegisterDivide(Number::R_ONE, packet.directionZ);
+	R128 active = packet.active;
+	int hitMask = 0;
+
+	struct Entry
+	{
+		unsigned int node;
+		float distance;
+	};
+	Entry stack[STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, 0.f };
+
+	while (stackSize > 0)
+	{
+		const Entry entry = stack[--stackSize];
+
+		// Every active lane has hit something closer.
+		if (entry.distance > HorizontalMax(RegisterSelect(active, hit.distance, MakeRegister(Number::FLOAT_NEG_INF))))
+		{
+			continue;
+		}
+
+		const Node& node = nodes[entry.node];
+		Entry children[WIDTH];
+		int childNum = 0;
+		for (int slot = 0; slot < WIDTH; ++slot)
+		{
+			if (node.first[slot] == EMPTY_SLOT)
+			{
+				continue;
+			}
+
+			// Slab test of 4 rays against the child box.
+			const R128 x0 = RegisterMultiply(RegisterSubtract(MakeRegister(node.minimumX[slot]), packet.originX), invDirectionX);
+			const R128 x1 = RegisterMultiply(RegisterSubtract(MakeRegister(node.maximumX[slot]), packet.originX), invDirectionX);
+			const R128 y0 = RegisterMultiply(RegisterSubtract(MakeRegister(node.minimumY[slot]), packet.originY), invDirectionY);
+			const R128 y1 = RegisterMultiply(RegisterSubtract(MakeRegister(node.maximumY[slot]), packet.originY), invDirectionY);
+			const R128 z0 = RegisterMultiply(RegisterSubtract(MakeRegister(node.minimumZ[slot]), packet.originZ), invDirectionZ);
+			const R128 z1 = RegisterMultiply(RegisterSubtract(MakeRegister(node.maximumZ[slot]), packet.originZ), invDirectionZ);
+			const R128 entryDistance = RegisterMax(RegisterMax(RegisterMin(x0, x1), RegisterMin(y0, y1)), RegisterMax(RegisterMin(z0, z1), Number::R_ZERO));
+			const R128 exitDistance = RegisterMin(RegisterMin(RegisterMax(x0, x1), RegisterMax(y0, y1)), RegisterMin(RegisterMax(z0, z1), hit.distance));
+			const R128 mask = RegisterAnd(RegisterLE(entryDistance, exitDistance), active);
+			if (!RegisterMaskBits(mask))
+			{
+				continue;
+			}
+
+			if (node.count[slot] == 0)
+			{
+				children[childNum++] = { node.first[slot], HorizontalMin(RegisterSelect(mask, entryDistance, MakeRegister(Number::FLOAT_INF))) };
+				continue;
+			}
+
+			// [ Moller & Trumbore, "Fast, Minimum Storage Ray/Triangle Intersection" ], both sides are hit.
+			for (unsigned int index = node.first[slot]; index < node.first[slot] + node.count[slot]; ++index)
+			{
+				const Triangle& triangle = triangles[index];
+				const R128 abX = MakeRegister(triangle.ab.x), abY = MakeRegister(triangle.ab.y), abZ = MakeRegister(triangle.ab.z);
+				const R128 acX = MakeRegister(triangle.ac.x), acY = MakeRegister(triangle.ac.y), acZ = MakeRegister(triangle.ac.z);
+
+				const R128 pX = RegisterSubtract(RegisterMultiply(packet.directionY, acZ), RegisterMultiply(packet.directionZ, acY));
+				const R128 pY = RegisterSubtract(RegisterMultiply(packet.directionZ, acX), RegisterMultiply(packet.directionX, acZ));
+				const R128 pZ = RegisterSubtract(RegisterMultiply(packet.directionX, acY), RegisterMultiply(packet.directionY, acX));
+				const R128 invDeterminant = RegisterDivide(Number::R_ONE, RegisterMultiplyAdd(abX, pX, RegisterMultiplyAddMultiply(abY, pY, abZ, pZ)));
+
+				const R128 sX = RegisterSubtract(packet.originX, MakeRegister(triangle.a.x));
+				const R128 sY = RegisterSubtract(packet.originY, MakeRegister(triangle.a.y));
+				const R128 sZ = RegisterSubtract(packet.originZ, MakeRegister(triangle.a.z));
+				const R128 alpha = RegisterMultiply(RegisterMultiplyAdd(sX, pX, RegisterMultiplyAddMultiply(sY, pY, sZ, pZ)), invDeterminant);
+
+				const R128 qX = RegisterSubtract(RegisterMultiply(sY, abZ), RegisterMultiply(sZ, abY));
+				const R128 qY = RegisterSubtract(RegisterMultiply(sZ, abX), RegisterMultiply(sX, abZ));
+				const R128 qZ = RegisterSubtract(RegisterMultiply(sX, abY), RegisterMultiply(sY, abX));
+				const R128 beta = RegisterMultiply(RegisterMultiplyAdd(packet.directionX, qX, RegisterMultiplyAddMultiply(packet.directionY, qY, packet.directionZ, qZ)), invDeterminant);
+				const R128 distance = RegisterMultiply(RegisterMultiplyAdd(acX, qX, RegisterMultiplyAddMultiply(acY, qY, acZ, qZ)), invDeterminant);
+
+				// A degenerated triangle gives NaN, which fails every comparison.
+				R128 accepted = RegisterAnd(RegisterGE(alpha, Number::R_ZERO), RegisterGE(beta, Number::R_ZERO));
+				accepted = RegisterAnd(accepted, RegisterLE(RegisterAdd(alpha, beta), Number::R_ONE));
+				accepted = RegisterAnd(accepted, RegisterAnd(RegisterGT(distance, Number::R_ZERO), RegisterLT(distance, hit.distance)));
+				accepted = RegisterAnd(accepted, active);
+
+				const int acceptedBits = RegisterMaskBits(accepted);
+				if (!acceptedBits)
+				{
+					continue;
+				}
+
+				hitMask |= acceptedBits;
+				if constexpr (bAnyHit)
+				{
+					// The attributes of hit are not needed, the lane is retired.
+					active = RegisterAndNot(accepted, active);
+					if (!RegisterMaskBits(active))
+					{
+						return hitMask;
+					}
+				}
+				else
+				{
+					hit.distance = RegisterSelect(accepted, distance, hit.distance);
+					hit.alpha = RegisterSelect(accepted, alpha, hit.alpha);
+					hit.beta = RegisterSelect(accepted, beta, hit.beta);
+					for (int lane = 0; lane < 4; ++lane)
+					{
+						if (acceptedBits & (1 << lane))
+						{
+							hit.firstIndex[lane] = triangle.firstIndex;
+						}
+					}
+				}
+			}
+		}
+
+		// Visit the nearer children first, any hit stops the lane so the order is not worth sorting.
+		if constexpr (!bAnyHit)
+		{
+			std::sort(children, children + childNum, [](const Entry& lhs, const Entry& rhs) { return lhs.distance > rhs.distance; });
+		}
+		for (int index = 0; index < childNum; ++index)
+		{
+			stack[stackSize++] = children[index];
+		}
+	}
+	return hitMask;
+}
+
+template int WideBvh::Intersect<false>(const RayPacket& packet, RayPacketHit& hit) const;
+template int WideBvh::Intersect<true>(const RayPacket& packet, RayPacketHit& hit) const;
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <Core/Meshlet.hpp>
+#include <Core/Matrix.hpp>
+#include <Utility/SIMD.hpp>
+#include <vector>
+
+
+
+/**
+ * @brief Four rays traced together, one per lane, the directions are not normalized.
+ *        The distances are measured in the length of direction, so they are kept by an affine transform.
+ */
+struct RayPacket
+{
+	R128 originX, originY, originZ;
+
+	R128 directionX, directionY, directionZ;
+
+	// The hit farther than it is ignored.
+	R128 maxDistance;
+
+	// The lanes traced, every bit is set for an active lane.
+	R128 active;
+
+	/**
+	 * @brief Transform every lane by the matrix, the origin is a point and the direction is a vector.
+	 */
+	warn_nodiscard force_inline RayPacket Transform(const Matrix& matrix) const;
+};
+
+
+
+/**
+ * @brief The closest hits of a ray packet.
+ */
+struct RayPacketHit
+{
+	// Initialized to the maximum distance of packet, reduced by every closer hit.
+	R128 distance;
+
+	// The barycentric weights of the second and third vertices.
+	R128 alpha, beta;
+
+	// The primitive of scene hierarchy hit by every lane.
+	unsigned int primitive[4];
+
+	// The first index of the hit triangle in index buffer of mesh.
+	unsigned int firstIndex[4];
+};
+
+
+
+/**
+ * @brief The 4-ary bounding volume hierarchy over the full detail triangles of one mesh in local space.
+ *        A node keeps the boxes of its children in structure of arrays, a packet of 4 rays is tested against one child at a time.
+ */
+class WideBvh
+{
+public:
+	// The number of children of a node.
+	static constexpr const int WIDTH = 4;
+
+	// The number of bins along the widest axis of centroids.
+	static constexpr const int BIN_NUM = 12;
+
+	// The range is not split if it has no more triangles.
+	static constexpr const unsigned int LEAF_TRIANGLE_NUM = 4;
+
+	// The deeper node is split by median, bounds the traversal stack.
+	static constexpr const int MAX_SAH_DEPTH = 24;
+
+	// The maximum number of nodes waiting in traversal stack.
+	static constexpr const int STACK_SIZE = 256;
+
+	// The first of an empty slot.
+	static constexpr const unsigned int EMPTY_SLOT = ~0u;
+
+	/**
+	 * @brief The node of hierarchy, the slots not used are marked by `EMPTY_SLOT`.
+	 */
+	struct alignas(16) Node
+	{
+		float minimumX[WIDTH], minimumY[WIDTH], minimumZ[WIDTH];
+
+		float maximumX[WIDTH], maximumY[WIDTH], maximumZ[WIDTH];
+
+		// The child node of an interior slot, or the first triangle of a leaf slot.
+		unsigned int first[WIDTH];
+
+		// The number of triangles of a leaf slot, zero for an interior slot.
+		unsigned int count[WIDTH];
+	};
+
+	/**
+	 * @brief The triangle stored in the order of leaves, one vertex and two edges.
+	 */
+	struct Triangle
+	{
+		Vector3 a;
+		Vector3 ab;
+		Vector3 ac;
+
+		// The first index of triangle in index buffer of mesh.
+		unsigned int firstIndex;
+	};
+
+private:
+	std::vector<Node> nodes;
+
+	std::vector<Triangle> triangles;
+
+	// The geometry built from, the hierarchy is stale if it changes.
+	const VertexIndex* sourceIndices = nullptr;
+	unsigned int sourceIndexNum = 0;
+	unsigned long long sourceVersion = 0;
+
+public:
+	const std::vector<Node>& GetNodes() const { return nodes; }
+
+	const std::vector<Triangle>& GetTriangles() const { return triangles; }
+
+	/**
+	 * @brief Determines whether the hierarchy is built from the current geometry of mesh.
+	 */
+	warn_nodiscard bool IsBuiltFrom(const Meshlet& mesh) const
+	{
+		return sourceVersion == mesh.GetGeometryVersion() && sourceIndices == mesh.indices.data() && sourceIndexNum == mesh.GetIndexNum();
+	}
+
+	/**
+	 * @brief Build the hierarchy over the full detail triangles of mesh.
+	 */
+	void Build(const Meshlet& mesh);
+
+	/**
+	 * @brief Intersect the active lanes of packet in local space, the closer hits update `hit`.
+	 *        Returns the mask bits of lanes hit, the any-hit query stops the lane at its first hit.
+	 */
+	template<bool bAnyHit>
+	int Intersect(const RayPacket& packet, RayPacketHit& hit) const;
+
+private:
+	// The boxes and centroids of triangles during build.
+	struct BuildContext;
+
+	/**
+	 * @brief Build the node over the triangles `order[begin, end)`, returns its index.
+	 *        Up to `WIDTH` ranges are made by splitting the largest one, each of them becomes a leaf or a child node.
+	 */
+	unsigned int BuildNode(BuildContext& context, const unsigned int& begin, const unsigned int& end, const int& depth);
+
+	/**
+	 * @brief Split the range by binned SAH, or by median if it is too deep or the centroids fall into one bin, returns the middle.
+	 */
+	static unsigned int SplitRange(BuildContext& context, const unsigned int& begin, const unsigned int& end, const int& depth);
+};
+
+
+
+#ifndef WIDEBVH_HPP_RAYPACKET_IMPL
+#define WIDEBVH_HPP_RAYPACKET_IMPL
+
+	force_inline RayPacket RayPacket::Transform(const Matrix& matrix) const
+	{
+		auto Row = [&matrix](const int& row, const R128& x, const R128& y, const R128& z)
+		{
+			return RegisterMultiplyAdd(MakeRegister(matrix.m[row][0]), x, RegisterMultiplyAddMultiply(MakeRegister(matrix.m[row][1]), y, MakeRegister(matrix.m[row][2]), z));
+		};
+
+		RayPacket result = *this;
+		result.originX = RegisterAdd(Row(0, originX, originY, originZ), MakeRegister(matrix.m[0][3]));
+		result.originY = RegisterAdd(Row(1, originX, originY, originZ), MakeRegister(matrix.m[1][3]));
+		result.originZ = RegisterAdd(Row(2, originX, originY, originZ), MakeRegister(matrix.m[2][3]));
+		result.directionX = Row(0, directionX, directionY, directionZ);
+		result.directionY = Row(1, directionX, directionY, directionZ);
+		result.directionZ = Row(2, directionX, directionY, directionZ);
+		return result;
+	}
+
+#endif // !WIDEBVH_HPP_RAYPACKET_IMPL
@@ -0,0 +1,72 @@
+#include "BrdfLut.hpp"
+#include "ImportanceSampling.hpp"
+#include <algorithm>
+#include <cmath>
+#include <ppl.h>
+
+
+
+namespace Shader
+{
+	BrdfLut::BrdfLut(Token)
+		: texels(RESOLUTION * RESOLUTION)
+	{
+		Concurrency::parallel_for(0, RESOLUTION, [this](const int& y)
+		{
+			const float roughness = (y + 0.5f) / RESOLUTION;
+			const float alpha = roughness * roughness;
+
+			// The geometry term of image based lighting, k = alpha / 2.
+			const float k = alpha * 0.5f;
+			for (int x = 0; x < RESOLUTION; ++x)
+			{
+				const float NdotV = (x + 0.5f) / RESOLUTION;
+				const Vector3 view = { std::sqrt(1.f - NdotV * NdotV), 0.f, NdotV };
+				const float visibilityV = NdotV / (NdotV * (1.f - k) + k);
+
+				float scale = 0.f;
+				float bias = 0.f;
+				for (unsigned int i = 0; i < SAMPLE_NUM; ++i)
+				{
+					const Vector3 half = ImportanceSampleGGX(Hammersley(i, SAMPLE_NUM), alpha);
+					const float VdotH = view | half;
+					const Vector3 light = half * (2.f * VdotH) - view;
+					const float NdotL = light.z;
+					if (NdotL <= 0.f)
+					{
+						continue;
+					}
+
+					// The pdf of half vector cancels D, G * VdotH / (NdotH * NdotV) is left.
+					const float NdotH = std::max(half.z, 0.f);
+					const float visibilityL = NdotL / (NdotL * (1.f - k) + k);
+					const float weight = visibilityV * visibilityL * std::max(VdotH, 0.f) / std::max(NdotH * NdotV, 1e-6f);
+					const float fresnel = std::pow(1.f - std::max(VdotH, 0.f), 5.f);
+					scale += (1.f - fresnel) * weight;
+					bias += fresnel * weight;
+				}
+				texels[y * RESOLUTION + x] = { scale / SAMPLE_NUM, bias / SAMPLE_NUM };
+			}
+		});
+	}
+
+	Vector2 BrdfLut::Sample(const float& NdotV, const float& roughness) const
+	{
+		const float u = std::clamp(NdotV * RESOLUTION - 0.5f, 0.f, RESOLUTION - 1.f);
+		const float v = std::clamp(roughness * RESOLUTION - 0.5f, 0.f, RESOLUTION - 1.f);
+		const int x0 = static_cast<int>(u);
+		const int y0 = static_cast<int>(v);
+		const int x1 = std::min(x0 + 1, RESOLUTION - 1);
+		const int y1 = std::min(y0 + 1, RESOLUTION - 1);
+		const float fractionX = u - x0;
+		const float fractionY = v - y0;
+
+		const Vector2& a = texels[y0 * RESOLUTION + x0];
+		const Vector2& b = texels[y0 * RESOLUTION + x1];
+		const Vector2& c = texels[y1 * RESOLUTION + x0];
+		const Vector2& d = texels[y1 * RESOLUTION + x1];
+		const Vector2 top = a + (b - a) * fractionX;
+		const Vector2 bottom = c + (d - c) * fractionX;
+		return top + (bottom - top) * fractionY;
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Core/Matrix.hpp>
+#include <Utility/Singleton.hpp>
+#include <vector>
+
+
+
+namespace Shader
+{
+	/**
+	 * @brief The split-sum integration of the specular BRDF, [ Karis B. 2013, "Real Shading in Unreal Engine 4" ].
+	 *        The texel at ( NdotV, roughness ) keeps the scale and the bias of F0, the specular reflectance of
+	 *        a uniform environment is `F0 * scale + bias`. It is integrated once by importance sampling GGX,
+	 *        the rows are integrated in parallel.
+	 */
+	class BrdfLut final : public Singleton<BrdfLut>
+	{
+	public:
+		// The number of texels along NdotV and along roughness.
+		static constexpr const int RESOLUTION = 32;
+
+		// The number of GGX samples per texel, from Hammersley sequence.
+		static constexpr const int SAMPLE_NUM = 512;
+
+	private:
+		// [ scale, bias ] per texel, the rows are roughness and the columns are NdotV, both sampled at texel centers.
+		std::vector<Vector2> texels;
+
+	public:
+		BrdfLut(Token);
+
+		/**
+		 * @brief The [ scale, bias ] of F0, bilinear filtered and clamped to the edge.
+		 */
+		warn_nodiscard Vector2 Sample(const float& NdotV, const float& roughness) const;
+	};
+}
@@ -0,0 +1,291 @@
+#include "EnvironmentLighting.hpp"
+#include "ImportanceSampling.hpp"
+#include <Core/TextureSampler.hpp>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+
+
+
+namespace
+{
+	/**
+	 * @brief The real spherical harmonics of 3 bands along the unit direction.
+	 */
+	void EvaluateBasis(const Vector3& direction, float (&basis)[Shader::EnvironmentLighting::SH_COEFFICIENT_NUM])
+	{
+		const float& x = direction.x;
+		const float& y = direction.y;
+		const float& z = direction.z;
+		basis[0] = 0.282095f;
+		basis[1] = 0.488603f * y;
+		basis[2] = 0.488603f * z;
+		basis[3] = 0.488603f * x;
+		basis[4] = 1.092548f * x * y;
+		basis[5] = 1.092548f * y * z;
+		basis[6] = 0.315392f * (3.f * z * z - 1.f);
+		basis[7] = 1.092548f * x * z;
+		basis[8] = 0.546274f * (x * x - y * y);
+	}
+
+	/**
+	 * @brief The leading block of cache file, the cache is discarded if any field differs.
+	 */
+	struct CacheHeader
+	{
+		char magic[4] = { 'F', 'R', 'I', 'B' };
+		unsigned int version = Shader::EnvironmentLighting::CACHE_VERSION;
+		unsigned long long hash = 0;
+		int specularSize = Shader::EnvironmentLighting::SPECULAR_SIZE;
+		int specularLevelNum = Shader::EnvironmentLighting::SPECULAR_LEVEL_NUM;
+		int sampleNum = Shader::EnvironmentLighting::SAMPLE_NUM;
+		int coefficientNum = Shader::EnvironmentLighting::SH_COEFFICIENT_NUM;
+	};
+}
+
+
+
+namespace Shader
+{
+	EnvironmentLighting::EnvironmentLighting(Cubemap environment, const std::filesystem::path& cachePath)
+	{
+		const unsigned long long hash = Hash(environment);
+		if (!cachePath.empty() && ReadCache(cachePath, hash))
+		{
+			return;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		if (environment.LevelNum() == 1)
+		{
+			std::vector<Vector4> first = std::move(environment.levels[0]);
+			environment.Resize(environment.size, 0);
+			environment.levels[0] = std::move(first);
+			environment.GenerateMips();
+		}
+		PrefilterSpecular(environment);
+		ProjectDiffuse(environment);
+		prefilterTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if (!cachePath.empty())
+		{
+			WriteCache(cachePath, hash);
+		}
+	}
+
+	Vector3 EnvironmentLighting::Diffuse(const Vector3& normal) const
+	{
+		float basis[SH_COEFFICIENT_NUM];
+		EvaluateBasis(normal, basis);
+
+		Vector3 result = { 0.f, 0.f, 0.f };
+		for (int coefficient = 0; coefficient < SH_COEFFICIENT_NUM; ++coefficient)
+		{
+			result += diffuse[coefficient] * basis[coefficient];
+		}
+
+		// The ringing of 3 bands may go below zero on the dark side of a bright source.
+		return { std::max(result.x, 0.f), std::max(result.y, 0.f), std::max(result.z, 0.f) };
+	}
+
+	Vector3 EnvironmentLighting::Specular(const Vector3& reflection, const float& roughness) const
+	{
+		return TextureSampler::SampleCube(specular, reflection, roughness * (SPECULAR_LEVEL_NUM - 1)).XYZ();
+	}
+
+	void EnvironmentLighting::PrefilterSpecular(const Cubemap& environment)
+	{
+		specular.Resize(SPECULAR_SIZE, SPECULAR_LEVEL_NUM);
+
+		// The solid angle of a texel of the first level of environment.
+		const float texelSolidAngle = 4.f * Number::PI / (Cubemap::FACE_NUM * environment.size * environment.size);
+
+		for (int level = 0; level < specular.LevelNum(); ++level)
+		{
+			const float roughness = static_cast<float>(level) / (SPECULAR_LEVEL_NUM - 1);
+			const float alpha = roughness * roughness;
+			const int size = specular.LevelSize(level);
+
+			// The normal and the view are the reflection, so the samples around it are the same for every texel.
+			// The mip level of every sample matches its solid angle, [ Colbert M, Krivanek J. 2007, "GPU-Based Importance Sampling" ].
+			struct Sample
+			{
+				Vector3 half;
+				float NdotL;
+				float level;
+			};
+			std::vector<Sample> samples;
+			samples.reserve(SAMPLE_NUM);
+			for (unsigned int i = 0; i < SAMPLE_NUM && level > 0; ++i)
+			{
+				const Vector3 half = ImportanceSampleGGX(Hammersley(i, SAMPLE_NUM), alpha);
+				const float NdotL = 2.f * half.z * half.z - 1.f;
+				if (NdotL <= 0.f)
+				{
+					continue;
+				}
+
+				// pdf = D * NdotH / (4 * VdotH) = D / 4.
+				const float pdf = DistributionGGX(half.z, alpha) * 0.25f;
+				const float sampleSolidAngle = 1.f / (SAMPLE_NUM * pdf + 1e-6f);
+				samples.push_back({ half, NdotL, std::max(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.f, 0.f) });
+			}
+
+			// The mirror level is resampled at the mip level matching its texel.
+			const float mirrorLevel = std::max(std::log2(static_cast<float>(environment.size) / size), 0.f);
+
+			Concurrency::parallel_for(0, Cubemap::FACE_NUM * size, [&](const int& row)
+			{
+				const int face = row / size;
+				const int y = row - face * size;
+				const float t = (y + 0.5f) * 2.f / size - 1.f;
+				for (int x = 0; x < size; ++x)
+				{
+					const Vector3 normal = Cubemap::Direction(face, (x + 0.5f) * 2.f / size - 1.f, t);
+					if (level == 0)
+					{
+						specular.Texel(level, face, x, y) = TextureSampler::SampleCube(environment, normal, mirrorLevel);
+						continue;
+					}
+
+					const Vector3 up = std::fabs(normal.z) < 0.999f ? Vector3(0.f, 0.f, 1.f) : Vector3(1.f, 0.f, 0.f);
+					const Vector3 tangentX = (up ^ normal).Normalize();
+					const Vector3 tangentY = normal ^ tangentX;
+
+					Vector4 result = Vector4(0.f);
+					float weight = 0.f;
+					for (const Sample& sample : samples)
+					{
+						const Vector3 half = tangentX * sample.half.x + tangentY * sample.half.y + normal * sample.half.z;
+						const Vector3 light = half * (2.f * sample.half.z) - normal;
+						result += TextureSampler::SampleCube(environment, light, sample.level) * sample.NdotL;
+						weight += sample.NdotL;
+					}
+					specular.Texel(level, face, x, y) = weight > 0.f ? result / weight : result;
+				}
+			});
+			specular.UpdateBorders(level);
+		}
+	}
+
+	void EnvironmentLighting::ProjectDiffuse(const Cubemap& environment)
+	{
+		// The irradiance is smooth, a level of at most 32 x 32 per face is enough.
+		int level = 0;
+		while (level + 1 < environment.LevelNum() && environment.LevelSize(level) > 32)
+		{
+			++level;
+		}
+		const int size = environment.LevelSize(level);
+
+		Vector3 faceSums[Cubemap::FACE_NUM][SH_COEFFICIENT_NUM];
+		Concurrency::parallel_for(0, Cubemap::FACE_NUM, [&](const int& face)
+		{
+			Vector3 (&sums)[SH_COEFFICIENT_NUM] = faceSums[face];
+			for (Vector3& sum : sums)
+			{
+				sum = { 0.f, 0.f, 0.f };
+			}
+
+			float basis[SH_COEFFICIENT_NUM];
+			for (int y = 0; y < size; ++y)
+			{
+				const float t = (y + 0.5f) * 2.f / size - 1.f;
+				for (int x = 0; x < size; ++x)
+				{
+					// The solid angle of texel, its area on the face over the cube of distance.
+					const float s = (x + 0.5f) * 2.f / size - 1.f;
+					const float distanceSquared = 1.f + s * s + t * t;
+					const float solidAngle = 4.f / (size * size * distanceSquared * std::sqrt(distanceSquared));
+
+					EvaluateBasis(Cubemap::Direction(face, s, t), basis);
+					const Vector3 radiance = environment.Texel(level, face, x, y).XYZ() * solidAngle;
+					for (int coefficient = 0; coefficient < SH_COEFFICIENT_NUM; ++coefficient)
+					{
+						sums[coefficient] += radiance * basis[coefficient];
+					}
+				}
+			}
+		});
+
+		// The cosine lobe scales the bands by PI, 2 PI / 3 and PI / 4, the irradiance is divided by PI.
+		static constexpr const float bandScales[SH_COEFFICIENT_NUM] = { 1.f, 2.f / 3.f, 2.f / 3.f, 2.f / 3.f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+		for (int coefficient = 0; coefficient < SH_COEFFICIENT_NUM; ++coefficient)
+		{
+			diffuse[coefficient] = { 0.f, 0.f, 0.f };
+			for (int face = 0; face < Cubemap::FACE_NUM; ++face)
+			{
+				diffuse[coefficient] += faceSums[face][coefficient];
+			}
+			diffuse[coefficient] *= bandScales[coefficient];
+		}
+	}
+
+	unsigned long long EnvironmentLighting::Hash(const Cubemap& environment)
+	{
+		// FNV-1a over the size and the bytes of texels.
+		unsigned long long hash = 14695981039346656037ull;
+		const auto Accumulate = [&hash](const void* data, const size_t& byteNum)
+		{
+			const unsigned char* bytes = static_cast<const unsigned char*>(data);
+			for (size_t i = 0; i < byteNum; ++i)
+			{
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+		};
+
+		Accumulate(&environment.size, sizeof(environment.size));
+		if (environment.LevelNum() > 0)
+		{
+			Accumulate(environment.levels[0].data(), environment.levels[0].size() * sizeof(Vector4));
+		}
+		return hash;
+	}
+
+	bool EnvironmentLighting::ReadCache(const std::filesystem::path& cachePath, const unsigned long long& hash)
+	{
+		std::ifstream file(cachePath, std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+
+		CacheHeader expected;
+		expected.hash = hash;
+		CacheHeader header;
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!file || std::memcmp(&header, &expected, sizeof(header)) != 0)
+		{
+			return false;
+		}
+
+		specular.Resize(SPECULAR_SIZE, SPECULAR_LEVEL_NUM);
+		file.read(reinterpret_cast<char*>(diffuse), sizeof(diffuse));
+		for (std::vector<Vector4>& level : specular.levels)
+		{
+			file.read(reinterpret_cast<char*>(level.data()), level.size() * sizeof(Vector4));
+		}
+		return static_cast<bool>(file);
+	}
+
+	void EnvironmentLighting::WriteCache(const std::filesystem::path& cachePath, const unsigned long long& hash) const
+	{
+		// The cache is optional, a failed write is filtered again in next load.
+		std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			return;
+		}
+
+		CacheHeader header;
+		header.hash = hash;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(diffuse), sizeof(diffuse));
+		for (const std::vector<Vector4>& level : specular.levels)
+		{
+			file.write(reinterpret_cast<const char*>(level.data()), level.size() * sizeof(Vector4));
+		}
+	}
+}
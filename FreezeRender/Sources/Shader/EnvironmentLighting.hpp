@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Core/Cubemap.hpp>
+#include <filesystem>
+
+
+
+namespace Shader
+{
+	/**
+	 * @brief The image based lighting of a distant environment, [ Karis B. 2013, "Real Shading in Unreal Engine 4" ].
+	 *        The specular light is a mip chain of the environment prefiltered by GGX, the roughness grows linearly with the level.
+	 *        The diffuse light is the irradiance projected on 9 spherical harmonics, [ Ramamoorthi R, Hanrahan P. 2001,
+	 *        "An Efficient Representation for Irradiance Environment Maps" ].
+	 *        Both are filtered in parallel when loaded, and cached to disk.
+	 */
+	class EnvironmentLighting
+	{
+	public:
+		// The size of faces of the first specular level, reflects a mirror.
+		static constexpr const int SPECULAR_SIZE = 128;
+
+		// The number of specular levels, the last one is fully rough.
+		static constexpr const int SPECULAR_LEVEL_NUM = 6;
+
+		// The number of GGX samples per texel of rough levels, each sample reads the mip level matching its solid angle.
+		static constexpr const int SAMPLE_NUM = 64;
+
+		// The number of spherical harmonics coefficients, 3 bands.
+		static constexpr const int SH_COEFFICIENT_NUM = 9;
+
+		// The version of cache file, changed with the layout or the filter.
+		static constexpr const unsigned int CACHE_VERSION = 1;
+
+	private:
+		// The prefiltered radiance of environment.
+		Cubemap specular;
+
+		// The diffuse radiance reflected by a white lambertian surface, irradiance / PI, in spherical harmonics.
+		Vector3 diffuse[SH_COEFFICIENT_NUM];
+
+		// The time of filtering in milliseconds, zero if read from cache.
+		float prefilterTime = 0.f;
+
+	public:
+		/**
+		 * @brief Filter `environment`, or read the result from `cachePath` if it was filtered from the same texels.
+		 *        The result is written to `cachePath` otherwise, an empty path disables the cache.
+		 *        The mip chain and the borders of `environment` are generated if it has only one level.
+		 */
+		EnvironmentLighting(Cubemap environment, const std::filesystem::path& cachePath);
+
+		float GetPrefilterTime() const { return prefilterTime; }
+
+		/**
+		 * @brief The diffuse radiance reflected toward any direction by a white lambertian surface of `normal` in world space.
+		 */
+		warn_nodiscard Vector3 Diffuse(const Vector3& normal) const;
+
+		/**
+		 * @brief The specular radiance along the reflection in world space, prefiltered for the roughness.
+		 */
+		warn_nodiscard Vector3 Specular(const Vector3& reflection, const float& roughness) const;
+
+	private:
+		/**
+		 * @brief Filter the specular levels, the rows of every face and level in parallel.
+		 */
+		void PrefilterSpecular(const Cubemap& environment);
+
+		/**
+		 * @brief Project the environment on spherical harmonics and convolve it by the cosine lobe, the faces in parallel.
+		 */
+		void ProjectDiffuse(const Cubemap& environment);
+
+		/**
+		 * @brief The hash of texels of the first level, it tells whether the cache is filtered from the environment.
+		 */
+		static unsigned long long Hash(const Cubemap& environment);
+
+		bool ReadCache(const std::filesystem::path& cachePath, const unsigned long long& hash);
+
+		void WriteCache(const std::filesystem::path& cachePath, const unsigned long long& hash) const;
+	};
+}
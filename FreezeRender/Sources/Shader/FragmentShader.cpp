@@ -1,4 +1,8 @@
 #include "FragmentShader.hpp"
+#include "BrdfLut.hpp"
+#include "EnvironmentLighting.hpp"
+#include <Utility/SIMD.hpp>
+#include <algorithm>
 
 
 
@@ -69,15 +73,25 @@ namespace Shader::DeferredFragment
 		const Vector3& normal = payload.normal;
 		Vector3 result = { 0, 0, 0 };
 
-		for (const PointLight& perLight : *(payload.pointlights))
+		for (size_t lightIndex = 0; lightIndex < payload.pointlights->size(); ++lightIndex)
 		{
+			// Shadow, only ambient.
+			if (lightIndex < 32 && (payload.shadowMask >> lightIndex) & 1)
+			{
+				result += Ka * ambientLightIntensity * payload.ambientOcclusion;
+				continue;
+			}
+
+			const PointLight& perLight = (*payload.pointlights)[lightIndex];
 			const Vector3 lightAt = perLight.location - shadingpoint;
 			const Vector3 viewAt = viewpoint - shadingpoint;
 			const float distance = lightAt.LengthSquared();
 
 			const Vector3 lightDirection = lightAt / std::sqrtf(distance);
 			const Vector3 halfDirection = (lightAt + viewAt).Normalize();
-			const Vector3 intensity = perLight.intensity / distance;
+			const Vector3 intensity = payload.lightVisibility && lightIndex < 32
+				? perLight.intensity * payload.lightVisibility[lightIndex] / distance
+				: perLight.intensity / distance;
 
 			// Diffuse.
 			result += (Kd * intensity) * std::max(0.f, normal | lightDirection);
@@ -86,9 +100,182 @@ namespace Shader::DeferredFragment
 			result += (Ks * intensity) * std::powf(std::max(0.f, normal | halfDirection), P);
 
 			// Ambient.
-			result += Ka * ambientLightIntensity;
+			result += Ka * ambientLightIntensity * payload.ambientOcclusion;
 		}
 
 		return Color::FromLinearVector(result);
 	}
+
+	Color PbrShader(const DeferredFragmentPayload& payload)
+	{
+		const DeferredFragmentPayload payloads[4] = { payload, payload, payload, payload };
+		Color colors[4];
+		PbrQuadShader(payloads, 1, colors);
+		return colors[0];
+	}
+
+	void PbrQuadShader(const DeferredFragmentPayload (&payloads)[4], const int& bits, Color (&colors)[4])
+	{
+		// The reflectance of dielectrics at normal incidence.
+		static constexpr const float dielectricReflectance = 0.04f;
+
+		// The radiance of the uniform environment, used without prefiltered environment.
+		static constexpr const float ambientLightIntensity = 0.1f;
+
+		// The smallest roughness, keeps the highlight of point lights wider than a texel.
+		static constexpr const float minRoughness = 0.045f;
+
+		if ((bits & 0xF) == 0)
+		{
+			return;
+		}
+
+		// The lanes not set in `bits` repeat a set one, every lane is a valid surface.
+		const int firstLane = bits & 1 ? 0 : bits & 2 ? 1 : bits & 4 ? 2 : 3;
+		const BrdfLut& brdfLut = *BrdfLut::Instance();
+		const std::vector<PointLight>& pointlights = *payloads[firstLane].pointlights;
+		alignas(16) float pointX[4], pointY[4], pointZ[4];
+		alignas(16) float normalX[4], normalY[4], normalZ[4];
+		alignas(16) float viewX[4], viewY[4], viewZ[4], NdotV[4];
+		alignas(16) float diffuseR[4], diffuseG[4], diffuseB[4];
+		alignas(16) float specularR[4], specularG[4], specularB[4];
+		alignas(16) float alphaSquared[4];
+		alignas(16) float resultR[4], resultG[4], resultB[4];
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			const DeferredFragmentPayload& payload = payloads[bits & (1 << lane) ? lane : firstLane];
+			const Vector3 normal = payload.normal.Normalize();
+			const Vector3 view = (payload.viewpoint - payload.shadingpoint).Normalize();
+			const float metallic = std::clamp(payload.metallic, 0.f, 1.f);
+			const float roughness = std::clamp(payload.roughness, minRoughness, 1.f);
+			const float alpha = roughness * roughness;
+			const Vector3 baseColor = Vector3(payload.diffuse.r, payload.diffuse.g, payload.diffuse.b) / 255.f;
+
+			// Metals have no diffuse, their base color is the reflectance at normal incidence.
+			const Vector3 diffuse = baseColor * (1.f - metallic);
+			const Vector3 specular = Vector3(dielectricReflectance * (1.f - metallic)) + baseColor * metallic;
+
+			pointX[lane] = payload.shadingpoint.x;
+			pointY[lane] = payload.shadingpoint.y;
+			pointZ[lane] = payload.shadingpoint.z;
+			normalX[lane] = normal.x;
+			normalY[lane] = normal.y;
+			normalZ[lane] = normal.z;
+			viewX[lane] = view.x;
+			viewY[lane] = view.y;
+			viewZ[lane] = view.z;
+			NdotV[lane] = std::clamp(normal | view, 1e-4f, 1.f);
+			diffuseR[lane] = diffuse.x;
+			diffuseG[lane] = diffuse.y;
+			diffuseB[lane] = diffuse.z;
+			specularR[lane] = specular.x;
+			specularG[lane] = specular.y;
+			specularB[lane] = specular.z;
+			alphaSquared[lane] = alpha * alpha;
+
+			// Ambient, the environment reflected by diffuse and by the split-sum specular.
+			Vector3 diffuseLight = Vector3(ambientLightIntensity);
+			Vector3 specularLight = Vector3(ambientLightIntensity);
+			if (payload.environment)
+			{
+				Vector3 worldNormal = normal;
+				Vector3 reflection = normal * (2.f * (normal | view)) - view;
+				if (payload.environmentTransform)
+				{
+					worldNormal = (*payload.environmentTransform * Vector4(worldNormal, 0.f)).XYZ();
+					reflection = (*payload.environmentTransform * Vector4(reflection, 0.f)).XYZ();
+				}
+				diffuseLight = payload.environment->Diffuse(worldNormal);
+				specularLight = payload.environment->Specular(reflection, roughness);
+			}
+			const Vector2 scaleBias = brdfLut.Sample(NdotV[lane], roughness);
+			const Vector3 ambient = (diffuse * diffuseLight + (specular * scaleBias.x + Vector3(scaleBias.y)) * specularLight) * payload.ambientOcclusion;
+			resultR[lane] = ambient.x;
+			resultG[lane] = ambient.y;
+			resultB[lane] = ambient.z;
+		}
+
+		const R128 PX = RegisterLoadAligned(pointX), PY = RegisterLoadAligned(pointY), PZ = RegisterLoadAligned(pointZ);
+		const R128 NX = RegisterLoadAligned(normalX), NY = RegisterLoadAligned(normalY), NZ = RegisterLoadAligned(normalZ);
+		const R128 VX = RegisterLoadAligned(viewX), VY = RegisterLoadAligned(viewY), VZ = RegisterLoadAligned(viewZ);
+		const R128 NoV = RegisterLoadAligned(NdotV);
+		const R128 diffR = RegisterLoadAligned(diffuseR), diffG = RegisterLoadAligned(diffuseG), diffB = RegisterLoadAligned(diffuseB);
+		const R128 specR = RegisterLoadAligned(specularR), specG = RegisterLoadAligned(specularG), specB = RegisterLoadAligned(specularB);
+		const R128 a2 = RegisterLoadAligned(alphaSquared);
+		const R128 oneMinusA2 = RegisterSubtract(Number::R_ONE, a2);
+		const R128 viewTerm = RegisterSqrt(RegisterMultiplyAdd(RegisterMultiply(NoV, NoV), oneMinusA2, a2));
+		const R128 epsilon = MakeRegister(1e-6f);
+		R128 colorR = RegisterLoadAligned(resultR);
+		R128 colorG = RegisterLoadAligned(resultG);
+		R128 colorB = RegisterLoadAligned(resultB);
+
+		for (size_t lightIndex = 0; lightIndex < pointlights.size(); ++lightIndex)
+		{
+			// The fraction of light reaching every lane, from the shadow mask or the shadow maps.
+			alignas(16) float visibility[4];
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				const DeferredFragmentPayload& payload = payloads[lane];
+				visibility[lane] = lightIndex < 32 && (payload.shadowMask >> lightIndex) & 1 ? 0.f
+					: payload.lightVisibility && lightIndex < 32 ? payload.lightVisibility[lightIndex] : 1.f;
+			}
+			const R128 lightVisibility = RegisterLoadAligned(visibility);
+			if (RegisterMaskBits(RegisterGT(lightVisibility, Number::R_ZERO)) == 0)
+			{
+				continue;
+			}
+
+			const PointLight& perLight = pointlights[lightIndex];
+			R128 LX = RegisterSubtract(MakeRegister(perLight.location.x), PX);
+			R128 LY = RegisterSubtract(MakeRegister(perLight.location.y), PY);
+			R128 LZ = RegisterSubtract(MakeRegister(perLight.location.z), PZ);
+			const R128 distanceSquared = RegisterMax(RegisterMultiplyAdd(LZ, LZ, RegisterMultiplyAddMultiply(LX, LX, LY, LY)), epsilon);
+			const R128 invDistance = RegisterDivide(Number::R_ONE, RegisterSqrt(distanceSquared));
+			LX = RegisterMultiply(LX, invDistance);
+			LY = RegisterMultiply(LY, invDistance);
+			LZ = RegisterMultiply(LZ, invDistance);
+
+			const R128 HX = RegisterAdd(LX, VX);
+			const R128 HY = RegisterAdd(LY, VY);
+			const R128 HZ = RegisterAdd(LZ, VZ);
+			const R128 invHalf = RegisterReciprocalSqrt(RegisterMax(RegisterMultiplyAdd(HZ, HZ, RegisterMultiplyAddMultiply(HX, HX, HY, HY)), epsilon));
+			const R128 NoL = RegisterMax(RegisterMultiplyAdd(NZ, LZ, RegisterMultiplyAddMultiply(NX, LX, NY, LY)), Number::R_ZERO);
+			const R128 NoH = RegisterMin(RegisterMax(RegisterMultiply(RegisterMultiplyAdd(NZ, HZ, RegisterMultiplyAddMultiply(NX, HX, NY, HY)), invHalf), Number::R_ZERO), Number::R_ONE);
+			const R128 VoH = RegisterMin(RegisterMax(RegisterMultiply(RegisterMultiplyAdd(VZ, HZ, RegisterMultiplyAddMultiply(VX, HX, VY, HY)), invHalf), Number::R_ZERO), Number::R_ONE);
+
+			// GGX distribution, D = a2 / (PI * (NoH^2 * (a2 - 1) + 1)^2).
+			const R128 denominator = RegisterMultiplyAdd(RegisterMultiply(NoH, NoH), RegisterNegate(oneMinusA2), Number::R_ONE);
+			const R128 distribution = RegisterDivide(a2, RegisterMax(RegisterMultiply(Number::R_PI, RegisterMultiply(denominator, denominator)), epsilon));
+
+			// Height-correlated Smith visibility, V = 0.5 / (NoL * sqrt(NoV^2 * (1 - a2) + a2) + NoV * sqrt(NoL^2 * (1 - a2) + a2)).
+			const R128 lightTerm = RegisterSqrt(RegisterMultiplyAdd(RegisterMultiply(NoL, NoL), oneMinusA2, a2));
+			const R128 smith = RegisterDivide(Number::R_HALF, RegisterMax(RegisterMultiplyAddMultiply(NoL, viewTerm, NoV, lightTerm), epsilon));
+
+			// Schlick fresnel, F = F0 + (1 - F0) * (1 - VoH)^5.
+			const R128 oneMinusVoH = RegisterSubtract(Number::R_ONE, VoH);
+			const R128 oneMinusVoH2 = RegisterMultiply(oneMinusVoH, oneMinusVoH);
+			const R128 fresnel = RegisterMultiply(RegisterMultiply(oneMinusVoH2, oneMinusVoH2), oneMinusVoH);
+			const R128 FR = RegisterMultiplyAdd(specR, RegisterSubtract(Number::R_ONE, fresnel), fresnel);
+			const R128 FG = RegisterMultiplyAdd(specG, RegisterSubtract(Number::R_ONE, fresnel), fresnel);
+			const R128 FB = RegisterMultiplyAdd(specB, RegisterSubtract(Number::R_ONE, fresnel), fresnel);
+
+			// The intensity of point light is scaled by PI, a white lambertian surface facing it reflects intensity / distance^2.
+			const R128 specularTerm = RegisterMultiply(Number::R_PI, RegisterMultiply(distribution, smith));
+			const R128 radiance = RegisterMultiply(RegisterMultiply(MakeRegister(perLight.intensity), lightVisibility), RegisterDivide(NoL, distanceSquared));
+			colorR = RegisterMultiplyAdd(RegisterMultiplyAdd(FR, RegisterSubtract(specularTerm, diffR), diffR), radiance, colorR);
+			colorG = RegisterMultiplyAdd(RegisterMultiplyAdd(FG, RegisterSubtract(specularTerm, diffG), diffG), radiance, colorG);
+			colorB = RegisterMultiplyAdd(RegisterMultiplyAdd(FB, RegisterSubtract(specularTerm, diffB), diffB), radiance, colorB);
+		}
+
+		RegisterStoreAligned(colorR, resultR);
+		RegisterStoreAligned(colorG, resultG);
+		RegisterStoreAligned(colorB, resultB);
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			if (bits & (1 << lane))
+			{
+				colors[lane] = Color::FromLinearVector(resultR[lane], resultG[lane], resultB[lane]);
+			}
+		}
+	}
 }
\ No newline at end of file
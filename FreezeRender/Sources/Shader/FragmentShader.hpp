@@ -9,6 +9,11 @@
 
 namespace Shader
 {
+	/// forward declaration.
+	class EnvironmentLighting;
+	/// forward declaration.
+
+
 	/**
 	 * @brief The data structure used by the fragment shader.
 	 */
@@ -121,6 +126,25 @@ namespace Shader
 
 		Vector3 normal;
 		Color diffuse;
+
+		// The metallic-roughness parameters of material, the base color is `diffuse`.
+		float metallic = 0.f;
+		float roughness = 0.5f;
+
+		// The lights occluded from the shading point, one bit per light in order, only the ambient term is left.
+		unsigned int shadowMask = 0;
+
+		// The fraction of every light reaching the shading point, filtered from shadow maps, null if fully lit.
+		const float* lightVisibility = nullptr;
+
+		// The fraction of ambient light reaching the shading point, from screen-space ambient occlusion.
+		float ambientOcclusion = 1.f;
+
+		// The ambient light of a prefiltered environment, null if the ambient light is uniform.
+		const EnvironmentLighting* environment = nullptr;
+
+		// From the space of shading point to the world space of environment, null if they are the same.
+		const Matrix* environmentTransform = nullptr;
 	};
 
 
@@ -132,6 +156,17 @@ namespace Shader
 		static Color Nothing(const DeferredFragmentPayload& payload) { return Color::Black; }
 
 		Color PhongShader(const DeferredFragmentPayload& payload);
+
+		/**
+		 * @brief GGX specular with height-correlated Smith visibility and Schlick fresnel, Lambert diffuse,
+		 *        the ambient light is the prefiltered environment or a uniform one, integrated by the split-sum BRDF LUT.
+		 */
+		Color PbrShader(const DeferredFragmentPayload& payload);
+
+		/**
+		 * @brief `PbrShader` of 4 payloads in SIMD, only the lanes set in `bits` are written to `colors`.
+		 */
+		void PbrQuadShader(const DeferredFragmentPayload (&payloads)[4], const int& bits, Color (&colors)[4]);
 	}
 
 
@@ -141,8 +176,12 @@ namespace Shader
 	class DeferredFragmentShader
 	{
 		typedef Color(*PrivateHandle)(const DeferredFragmentPayload&);
+		typedef void(*PrivateQuadHandle)(const DeferredFragmentPayload (&)[4], const int&, Color (&)[4]);
+
+		static constexpr const PrivateHandle handle = DeferredFragment::PbrShader;
 
-		static constexpr const PrivateHandle handle = DeferredFragment::PhongShader;
+		// The SIMD entry of `handle`, null if the shader has only the scalar one.
+		static constexpr const PrivateQuadHandle quadHandle = DeferredFragment::PbrQuadShader;
 
 	public:
 
@@ -166,5 +205,26 @@ namespace Shader
 				return Color::Black;
 			}
 		}
+
+		/**
+		 * @brief Shade 4 payloads at once, only the lanes set in `bits` are written to `colors`.
+		 */
+		force_inline without_globalvar void operator() (const DeferredFragmentPayload (&payloads)[4], const int& bits, Color (&colors)[4])
+		{
+			if constexpr (quadHandle != nullptr)
+			{
+				quadHandle(payloads, bits, colors);
+			}
+			else
+			{
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					if (bits & (1 << lane))
+					{
+						colors[lane] = (*this)(payloads[lane]);
+					}
+				}
+			}
+		}
 	};
 }
\ No newline at end of file
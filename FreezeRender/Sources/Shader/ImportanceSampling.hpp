@@ -0,0 +1,45 @@
+#pragma once
+
+#include <Core/Matrix.hpp>
+#include <Utility/Number.hpp>
+#include <cmath>
+
+
+
+namespace Shader
+{
+	/**
+	 * @brief The i-th point of Hammersley sequence, the second coordinate is the bit reversal of i.
+	 */
+	inline Vector2 Hammersley(const unsigned int& i, const unsigned int& sampleNum)
+	{
+		unsigned int bits = i;
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return { static_cast<float>(i) / sampleNum, static_cast<float>(bits) * 2.3283064365386963e-10f };
+	}
+
+	/**
+	 * @brief The half vector around +z distributed by GGX of `alpha`.
+	 */
+	inline Vector3 ImportanceSampleGGX(const Vector2& xi, const float& alpha)
+	{
+		const float phi = 2.f * Number::PI * xi.x;
+		const float cosTheta = std::sqrt((1.f - xi.y) / (1.f + (alpha * alpha - 1.f) * xi.y));
+		const float sinTheta = std::sqrt(1.f - cosTheta * cosTheta);
+		return { sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta };
+	}
+
+	/**
+	 * @brief GGX distribution of half vectors, D = alpha^2 / (PI * (NdotH^2 * (alpha^2 - 1) + 1)^2).
+	 */
+	inline float DistributionGGX(const float& NdotH, const float& alpha)
+	{
+		const float alphaSquared = alpha * alpha;
+		const float denominator = NdotH * NdotH * (alphaSquared - 1.f) + 1.f;
+		return alphaSquared / (Number::PI * denominator * denominator);
+	}
+}
@@ -110,6 +110,16 @@ namespace Number
 	 */
 	#define RegisterStoreAligned( reg, ptr )          _mm_store_ps( (float*)(ptr), reg )
 
+	/**
+	 * @brief Load a R128 from unaligned memory.
+	 */
+	#define RegisterLoad( ptr )                       _mm_loadu_ps( (const float*)(ptr) )
+
+	/**
+	 * @brief Stores a R128 to unaligned memory.
+	 */
+	#define RegisterStore( reg, ptr )                 _mm_storeu_ps( (float*)(ptr), reg )
+
 	/**
 	 * @brief Mask a shuffle mask.
 	 */
@@ -222,6 +232,18 @@ namespace Number
 	 */
 	#define RegisterDivide( reg1, reg2 )              _mm_div_ps( (reg1), (reg2) )
 
+	/**
+	 * @brief Computes the square root of R128.
+	 * @return        ( sqrt(reg.x), same for yzw )
+	 */
+	#define RegisterSqrt( reg )                       _mm_sqrt_ps( (reg) )
+
+	/**
+	 * @brief Computes the approximate reciprocal square root of R128, the relative error is at most 1.5 * 2^-12.
+	 * @return        ( 1 / sqrt(reg.x), same for yzw )
+	 */
+	#define RegisterReciprocalSqrt( reg )             _mm_rsqrt_ps( (reg) )
+
 	/**
 	 * @brief Multiplies two R128, adds in the third R128.
 	 * @return        ( reg1.x * reg2.x + reg3.x, same for yzw )
@@ -504,5 +526,82 @@ namespace Number
 		}
 	}
 
+	/**
+	 * @brief Load a R256i from unaligned memory.
+	 */
+	#define Register8IntegerLoad( ptr )                _mm256_loadu_si256( (const __m256i*)(ptr) )
+
+	/**
+	 * @brief Stores the elements of R256i to memory, only if the sign bit of the corresponding mask element is set.
+	 */
+	#define Register8IntegerMaskStore( reg, mask, ptr ) _mm256_maskstore_epi32( (int*)(ptr), (mask), (reg) )
+
+	/**
+	 * @brief Adds two R256i as 4 signed 64-bits integer.
+	 * @return        ( reg1[0] + reg2[0], same for [1][2][3] )
+	 */
+	#define Register8IntegerAdd64( reg1, reg2 )        _mm256_add_epi64( (reg1), (reg2) )
+
+	/**
+	 * @brief Returns an integer bit-mask (0x0 - 0xf) of 4 signed 64-bits integer.
+	 * @return        Bit i = ( reg[i] < 0 )
+	 */
+	#define Register8IntegerSignBits64( reg )          _mm256_movemask_pd( _mm256_castsi256_pd( (reg) ) )
+
+	/**
+	 * @brief Returns a signed 32-bits R256i based on 8 integer.
+	 */
+	force_inline R256i MakeRegister8Integer(const int& x1, const int& y1, const int& z1, const int& w1, const int& x2, const int& y2, const int& z2, const int& w2)
+	{
+		return _mm256_setr_epi32(x1, y1, z1, w1, x2, y2, z2, w2);
+	}
+
+	/**
+	 * @brief Returns a signed 32-bits R256i based on 1 integer.
+	 */
+	force_inline R256i MakeRegister8Integer(const int& val)
+	{
+		return _mm256_set1_epi32(val);
+	}
+
+	/**
+	 * @brief Returns a signed 64-bits R256i based on 4 integer.
+	 */
+	force_inline R256i MakeRegister8Integer64(const long long& x, const long long& y, const long long& z, const long long& w)
+	{
+		return _mm256_setr_epi64x(x, y, z, w);
+	}
+
+	/**
+	 * @brief Returns a signed 64-bits R256i based on 1 integer.
+	 */
+	force_inline R256i MakeRegister8Integer64(const long long& val)
+	{
+		return _mm256_set1_epi64x(val);
+	}
+
+	/**
+	 * @brief Returns an integer bit-mask (0x00 - 0xff) of 8 pointers.
+	 * @return        Bit i = ( ptr[i] != nullptr )
+	 */
+	force_inline unsigned int Register8PointerMaskBits(const void* const* ptr)
+	{
+		const R256i zero = _mm256_setzero_si256();
+		if constexpr (sizeof(void*) == 8)
+		{
+			const R256i low = Register8IntegerLoad(ptr);
+			const R256i high = Register8IntegerLoad(ptr + 4);
+			const int nullLow = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(low, zero)));
+			const int nullHigh = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(high, zero)));
+			return ~(nullLow | (nullHigh << 4)) & 0xFF;
+		}
+		else
+		{
+			const R256i all = Register8IntegerLoad(ptr);
+			const int nullAll = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(all, zero)));
+			return ~nullAll & 0xFF;
+		}
+	}
+
 
 #endif // !SIMD_HPP_AVX_IMPL
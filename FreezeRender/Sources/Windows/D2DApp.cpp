@@ -330,6 +330,7 @@ void D2DApp::CalculateFrameStats()
 		out << m_wndCaption
 			<< " | " << "FPS: " << fps
 			<< " | " << "Frame Time: " << mspf << " ms";
+		HandleFrameStatsEvent(out);
 		SetWindowTextA(m_hWnd, out.str().c_str());
 		timeElapsed += 1.0f;
 		frameCnt = 0;
@@ -8,6 +8,7 @@
 // C++ RunTime Header.
 #include <string>
 #include <bitset>
+#include <iosfwd>
 
 // D2D1 Runtimer header.
 #include <dxgi1_4.h>
@@ -118,6 +119,8 @@ protected:
 
 	virtual HPAINTRESULT HandlePaintEvent(const float deltaTime) = 0;
 
+	virtual void HandleFrameStatsEvent(std::ostream& out) {}
+
 	virtual void Tick(const float deltaTime) = 0;
 	/// Override message handle.
 